@@ -0,0 +1,141 @@
+/**
+ * @file Config.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-20
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "Config.h"
+#include "KnxTelegram.h"
+
+#define CONFIG_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define CONFIG_SECTOR_OFFSET(sector) (CONFIG_FLASH_OFFSET - (sector) * FLASH_SECTOR_SIZE)
+
+_Static_assert(sizeof(KnxConfig) <= FLASH_PAGE_SIZE, "KnxConfig has to fit into one flash page");
+
+/**
+ * @brief FNV-1a, checksum of everything kept in flash
+ * 
+ * @param data 
+ * @param size 
+ * @return uint32_t 
+ */
+uint32_t configHash(const void *data, uint32_t size) {
+  const uint8_t *bytes = (const uint8_t*)data;
+  uint32_t hash = 2166136261u;
+
+  for (uint32_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Hash of everything but the checksum
+ * 
+ * @param config 
+ * @return uint32_t 
+ */
+static uint32_t configChecksum(const KnxConfig *config) {
+  return configHash(config, offsetof(KnxConfig, checksum));
+}
+
+/**
+ * @brief Read config from flash
+ * 
+ * @param config 
+ * @return true when flash holds valid config of this version with a valid target
+ */
+bool configLoad(KnxConfig *config) {
+  const KnxConfig *stored = (const KnxConfig*)(XIP_BASE + CONFIG_FLASH_OFFSET);
+
+  if (stored->magic != CONFIG_MAGIC || stored->version != CONFIG_VERSION
+      || stored->size != sizeof(KnxConfig) || stored->checksum != configChecksum(stored)) {
+    return false;
+  }
+
+  memcpy(config, stored, sizeof(KnxConfig));
+  config->targetAddress[sizeof(config->targetAddress) - 1] = 0;
+
+  // Comes back on every boot, a broken target would never go away
+  return knxTargetGroupAddressStringValid(config->targetAddress);
+}
+
+/**
+ * @brief Write config to flash, skipped when nothing changed
+ * Core1 runs from flash too, so it is parked for the erase and program
+ * @param config header and checksum are filled in
+ * @return true when flash was written
+ */
+bool configSave(KnxConfig *config) {
+  static uint8_t page[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+
+  config->magic = CONFIG_MAGIC;
+  config->version = CONFIG_VERSION;
+  config->size = sizeof(KnxConfig);
+  config->checksum = configChecksum(config);
+
+  if (memcmp((const void*)(XIP_BASE + CONFIG_FLASH_OFFSET), config, sizeof(KnxConfig)) == 0) {
+    return false;
+  }
+
+  memset(page, 0xFF, sizeof(page));
+  memcpy(page, config, sizeof(KnxConfig));
+  return configSectorSave(0, page, FLASH_PAGE_SIZE);
+}
+
+/**
+ * @brief Flash sector content, plain XIP read
+ * 
+ * @param sector CONFIG_SECTOR_*
+ * @return const void* 
+ */
+const void *configSectorData(uint8_t sector) {
+  return (const void*)(XIP_BASE + CONFIG_SECTOR_OFFSET(sector));
+}
+
+/**
+ * @brief Replace sector content, skipped when nothing changed
+ * Core1 runs from flash too, so it is parked for the erase and program
+ * @param sector CONFIG_SECTOR_*
+ * @param data in RAM
+ * @param size up to one sector, tail of the last page is padded
+ * @return true when flash was written
+ */
+bool configSectorSave(uint8_t sector, const void *data, uint32_t size) {
+  static uint8_t tail[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+  uint32_t offset = CONFIG_SECTOR_OFFSET(sector);
+  uint32_t pages = size / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+
+  if (size > FLASH_SECTOR_SIZE || memcmp(configSectorData(sector), data, size) == 0) {
+    return false;
+  }
+
+  if (pages < size) {
+    memset(tail, 0xFF, sizeof(tail));
+    memcpy(tail, (const uint8_t*)data + pages, size - pages);
+  }
+
+  multicore_lockout_start_blocking();
+  uint32_t irq = save_and_disable_interrupts();
+  flash_range_erase(offset, FLASH_SECTOR_SIZE);
+  if (pages) {
+    flash_range_program(offset, data, pages);
+  }
+  if (pages < size) {
+    flash_range_program(offset + pages, tail, FLASH_PAGE_SIZE);
+  }
+  restore_interrupts(irq);
+  multicore_lockout_end_blocking();
+  return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file Config.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Settings kept in the last flash sector
+ * @version 0.1
+ * @date 2023-07-20
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Config Description
+ * 
+ * Loading is a plain XIP read, so it is done before anything else at boot.
+ * Saving erases and programs one sector with core1 locked out and
+ * interrupts disabled (~50 ms), so it is only done when something changed.
+ * 
+ * Sectors below the config one are handed out to modules with bigger
+ * tables, same rules apply to them.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CONFIG_MAGIC 0x43584E4B  // "KNXC"
+#define CONFIG_VERSION 1
+
+/* Changes are saved once they settle, to spare the flash */
+#define CONFIG_SAVE_DELAY_MS 2000
+
+/* Counted down from the config sector */
+#define CONFIG_SECTOR_TIMERS 1
+#define CONFIG_SECTOR_RULES 2
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  char targetAddress[12];
+  uint32_t checksum;
+} KnxConfig;
+
+/** === Config === */
+bool configLoad(KnxConfig *config);
+bool configSave(KnxConfig *config);
+uint32_t configHash(const void *data, uint32_t size);
+
+/** === Module sectors === */
+const void *configSectorData(uint8_t sector);
+bool configSectorSave(uint8_t sector, const void *data, uint32_t size);
+
+#endif // CONFIG_H
@@ -29,11 +29,13 @@
 //  https://tools.ietf.org/html/rfc2132 -- DHCP Options and BOOTP Vendor Extensions
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 
 #include "cyw43_config.h"
 #include "dhcpserver.h"
+#include "Log.h"
 #include "lwip/udp.h"
 
 #define DHCPDISCOVER    (1)
@@ -58,12 +60,14 @@
 #define DHCP_OPT_MAX_MSG_SIZE       (57)
 #define DHCP_OPT_VENDOR_CLASS_ID    (60)
 #define DHCP_OPT_CLIENT_ID          (61)
+#define DHCP_OPT_RAPID_COMMIT       (80) // RFC 4039
 #define DHCP_OPT_END                (255)
 
 #define PORT_DHCP_SERVER (67)
 #define PORT_DHCP_CLIENT (68)
 
 #define DEFAULT_LEASE_TIME_S (24 * 60 * 60) // in seconds
+#define OFFER_TIME_S (30) // offered address is reserved until client requests it
 
 #define MAC_LEN (6)
 #define MAKE_IP4(a, b, c, d) ((a) << 24 | (b) << 16 | (c) << 8 | (d))
@@ -86,6 +90,10 @@ typedef struct {
     uint8_t options[312]; // optional parameters, variable, starts with magic
 } dhcp_msg_t;
 
+// Replies are built here and handed to lwIP by reference, no per-packet
+// buffer on the stack and no copy into a freshly allocated pbuf
+static dhcp_msg_t dhcp_reply;
+
 static int dhcp_socket_new_dgram(struct udp_pcb **udp, void *cb_data, udp_recv_fn cb_udp_recv) {
     // family is AF_INET
     // type is SOCK_DGRAM
@@ -118,13 +126,12 @@ static int dhcp_socket_sendto(struct udp_pcb **udp, const void *buf, size_t len,
         len = 0xffff;
     }
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    // lwIP copies referenced data itself if it has to queue the packet
+    struct pbuf *p = pbuf_alloc_reference((void *)buf, len, PBUF_REF);
     if (p == NULL) {
         return -ENOMEM;
     }
 
-    memcpy(p->payload, buf, len);
-
     ip_addr_t dest;
     IP4_ADDR(ip_2_ip4(&dest), ip >> 24 & 0xff, ip >> 16 & 0xff, ip >> 8 & 0xff, ip & 0xff);
     err_t err = udp_sendto(*udp, p, &dest, port);
@@ -138,8 +145,15 @@ static int dhcp_socket_sendto(struct udp_pcb **udp, const void *buf, size_t len,
     return len;
 }
 
-static uint8_t *opt_find(uint8_t *opt, uint8_t cmd) {
-    for (int i = 0; i < 308 && opt[i] != DHCP_OPT_END;) {
+static const uint8_t *opt_find(const uint8_t *opt, size_t len, uint8_t cmd) {
+    for (size_t i = 0; i + 1 < len && opt[i] != DHCP_OPT_END;) {
+        if (opt[i] == DHCP_OPT_PAD) {
+            i++;
+            continue;
+        }
+        if (i + 2 + opt[i + 1] > len) {
+            break;
+        }
         if (opt[i] == cmd) {
             return &opt[i];
         }
@@ -175,100 +189,302 @@ static void opt_write_u32(uint8_t **opt, uint8_t cmd, uint32_t val) {
     *opt = o;
 }
 
+static uint32_t lease_hash(const uint8_t *mac) {
+    uint32_t h = 5381;
+    for (int i = 0; i < MAC_LEN; ++i) {
+        h = (h * 33) ^ mac[i];
+    }
+    return h & (DHCPS_HASH_SIZE - 1);
+}
+
+static int lease_find(dhcp_server_t *d, const uint8_t *mac) {
+    for (uint8_t i = d->hash[lease_hash(mac)]; i != DHCPS_NONE; i = d->lease[i].hash_next) {
+        if (memcmp(d->lease[i].mac, mac, MAC_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void lease_hash_insert(dhcp_server_t *d, uint8_t i) {
+    uint8_t *bucket = &d->hash[lease_hash(d->lease[i].mac)];
+    d->lease[i].hash_next = *bucket;
+    *bucket = i;
+}
+
+static void lease_hash_remove(dhcp_server_t *d, uint8_t i) {
+    uint8_t *link = &d->hash[lease_hash(d->lease[i].mac)];
+    while (*link != DHCPS_NONE) {
+        if (*link == i) {
+            *link = d->lease[i].hash_next;
+            return;
+        }
+        link = &d->lease[*link].hash_next;
+    }
+}
+
+// Doubly linked list helpers, shared by the free list and the wheel slots
+static void lease_list_remove(dhcp_server_t *d, uint8_t *head, uint8_t *tail, uint8_t i) {
+    dhcp_server_lease_t *l = &d->lease[i];
+    if (l->prev != DHCPS_NONE) {
+        d->lease[l->prev].next = l->next;
+    } else {
+        *head = l->next;
+    }
+    if (l->next != DHCPS_NONE) {
+        d->lease[l->next].prev = l->prev;
+    } else if (tail) {
+        *tail = l->prev;
+    }
+    l->next = l->prev = DHCPS_NONE;
+}
+
+static void lease_wheel_insert(dhcp_server_t *d, uint8_t i) {
+    // Number of ticks until expiry, rounded up so the lease is never expired early
+    int32_t ticks = ((int32_t)(d->lease[i].expiry - d->wheel_time) + DHCPS_WHEEL_TICK_MS - 1) / DHCPS_WHEEL_TICK_MS;
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > DHCPS_WHEEL_SLOTS - 1) {
+        ticks = DHCPS_WHEEL_SLOTS - 1;
+    }
+    d->lease[i].slot = (d->wheel_pos + ticks) % DHCPS_WHEEL_SLOTS;
+    uint8_t *slot = &d->wheel[d->lease[i].slot];
+    d->lease[i].prev = DHCPS_NONE;
+    d->lease[i].next = *slot;
+    if (*slot != DHCPS_NONE) {
+        d->lease[*slot].prev = i;
+    }
+    *slot = i;
+}
+
+static void lease_free_push(dhcp_server_t *d, uint8_t i) {
+    dhcp_server_lease_t *l = &d->lease[i];
+    memset(l->mac, 0, MAC_LEN);
+    l->state = DHCPS_LEASE_FREE;
+    l->hash_next = DHCPS_NONE;
+    l->next = DHCPS_NONE;
+    l->prev = d->free_tail;
+    if (d->free_tail != DHCPS_NONE) {
+        d->lease[d->free_tail].next = i;
+    } else {
+        d->free_head = i;
+    }
+    d->free_tail = i;
+}
+
+static void lease_release(dhcp_server_t *d, uint8_t i) {
+    lease_list_remove(d, &d->wheel[d->lease[i].slot], NULL, i);
+    lease_hash_remove(d, i);
+    lease_free_push(d, i);
+}
+
+// Take a free lease (a specific one, or the least recently freed) and assign it to mac
+static int lease_alloc(dhcp_server_t *d, int i, const uint8_t *mac, uint32_t lease_ms) {
+    if (i < 0) {
+        i = d->free_head;
+        if (i == DHCPS_NONE) {
+            return -1;
+        }
+    } else if (d->lease[i].state != DHCPS_LEASE_FREE) {
+        return -1;
+    }
+    lease_list_remove(d, &d->free_head, &d->free_tail, i);
+    memcpy(d->lease[i].mac, mac, MAC_LEN);
+    d->lease[i].state = DHCPS_LEASE_OFFERED;
+    d->lease[i].expiry = cyw43_hal_ticks_ms() + lease_ms;
+    lease_hash_insert(d, i);
+    lease_wheel_insert(d, i);
+    return i;
+}
+
+void dhcp_server_expire_leases(dhcp_server_t *d) {
+    uint32_t now = cyw43_hal_ticks_ms();
+    uint32_t ticks = (now - d->wheel_time) / DHCPS_WHEEL_TICK_MS;
+
+    // After a long idle period one turn of the wheel visits every lease
+    if (ticks > DHCPS_WHEEL_SLOTS) {
+        d->wheel_time += (ticks - DHCPS_WHEEL_SLOTS) * DHCPS_WHEEL_TICK_MS;
+        ticks = DHCPS_WHEEL_SLOTS;
+    }
+
+    for (; ticks > 0; --ticks) {
+        d->wheel_time += DHCPS_WHEEL_TICK_MS;
+        d->wheel_pos = (d->wheel_pos + 1) % DHCPS_WHEEL_SLOTS;
+        uint8_t i = d->wheel[d->wheel_pos];
+        d->wheel[d->wheel_pos] = DHCPS_NONE;
+        while (i != DHCPS_NONE) {
+            uint8_t next = d->lease[i].next;
+            if ((int32_t)(d->lease[i].expiry - now) <= 0) {
+                // Already unlinked from the wheel slot
+                lease_hash_remove(d, i);
+                lease_free_push(d, i);
+            } else {
+                // Renewed or beyond the wheel horizon
+                lease_wheel_insert(d, i);
+            }
+            i = next;
+        }
+    }
+}
+
+static void lease_bind(dhcp_server_t *d, uint8_t i) {
+    // Lease stays in its wheel slot and is re-inserted when the slot comes around
+    d->lease[i].state = DHCPS_LEASE_BOUND;
+    d->lease[i].expiry = cyw43_hal_ticks_ms() + DEFAULT_LEASE_TIME_S * 1000;
+    // Deferred log takes 6 arguments, MAC and IP go in separate entries
+    LOG_INFO("DHCPS: client connected: MAC=%02x:%02x:%02x:%02x:%02x:%02x\n",
+        d->lease[i].mac[0], d->lease[i].mac[1], d->lease[i].mac[2], d->lease[i].mac[3], d->lease[i].mac[4], d->lease[i].mac[5]);
+    LOG_INFO("DHCPS: IP=%u.%u.%u.%u\n",
+        ip4_addr1(ip_2_ip4(&d->ip)), ip4_addr2(ip_2_ip4(&d->ip)), ip4_addr3(ip_2_ip4(&d->ip)), DHCPS_BASE_IP + i);
+}
+
+// Lease index for an address of our pool, -1 if the address is not ours
+static int lease_index(dhcp_server_t *d, const uint8_t *ip) {
+    if (memcmp(ip, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0) {
+        return -1;
+    }
+    int i = ip[3] - DHCPS_BASE_IP;
+    if (i < 0 || i >= DHCPS_MAX_IP) {
+        return -1;
+    }
+    return i;
+}
+
+static void dhcp_server_nak(dhcp_server_t *d, dhcp_msg_t *dhcp_msg) {
+    uint8_t *opt = dhcp_msg->options + 4;
+    dhcp_msg->op = DHCPOFFER;
+    memset(dhcp_msg->yiaddr, 0, 4);
+    opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPNACK);
+    opt_write_n(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip)));
+    *opt++ = DHCP_OPT_END;
+    dhcp_socket_sendto(&d->udp, dhcp_msg, opt - (uint8_t *)dhcp_msg, 0xffffffff, PORT_DHCP_CLIENT);
+}
+
 static void dhcp_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *src_addr, u16_t src_port) {
     dhcp_server_t *d = arg;
     (void)upcb;
     (void)src_addr;
     (void)src_port;
 
-    // This is around 548 bytes
-    dhcp_msg_t dhcp_msg;
-
     #define DHCP_MIN_SIZE (240 + 3)
-    if (p->tot_len < DHCP_MIN_SIZE) {
+    // Parse in place, requests always fit into a single pool pbuf
+    if (p->tot_len < DHCP_MIN_SIZE || p->len != p->tot_len) {
         goto ignore_request;
     }
 
-    size_t len = pbuf_copy_partial(p, &dhcp_msg, sizeof(dhcp_msg), 0);
-    if (len < DHCP_MIN_SIZE) {
-        goto ignore_request;
-    }
+    // Payload is not word aligned, so only byte fields are accessed
+    const uint8_t *req = p->payload;
+    const uint8_t *chaddr = req + offsetof(dhcp_msg_t, chaddr);
+    const uint8_t *ciaddr = req + offsetof(dhcp_msg_t, ciaddr);
+    const uint8_t *req_opt = req + offsetof(dhcp_msg_t, options) + 4; // assume magic cookie: 99, 130, 83, 99
+    size_t req_opt_len = p->len - offsetof(dhcp_msg_t, options) - 4;
+
+    dhcp_msg_t *dhcp_msg = &dhcp_reply;
+    memcpy(dhcp_msg, req, offsetof(dhcp_msg_t, sname));
+    memset(dhcp_msg->sname, 0, sizeof(dhcp_msg->sname) + sizeof(dhcp_msg->file));
+    memcpy(dhcp_msg->options, req + offsetof(dhcp_msg_t, options), 4);
 
-    dhcp_msg.op = DHCPOFFER;
-    memcpy(&dhcp_msg.yiaddr, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4);
+    dhcp_msg->op = DHCPOFFER;
+    memcpy(&dhcp_msg->yiaddr, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4);
 
-    uint8_t *opt = (uint8_t *)&dhcp_msg.options;
-    opt += 4; // assume magic cookie: 99, 130, 83, 99
+    uint8_t *opt = dhcp_msg->options + 4;
 
-    uint8_t *msgtype = opt_find(opt, DHCP_OPT_MSG_TYPE);
+    const uint8_t *msgtype = opt_find(req_opt, req_opt_len, DHCP_OPT_MSG_TYPE);
     if (msgtype == NULL) {
         // A DHCP package without MSG_TYPE?
         goto ignore_request;
     }
 
+    dhcp_server_expire_leases(d);
+
+    bool lease_time = true;
+    uint32_t dest = 0xffffffff;
     switch (msgtype[2]) {
         case DHCPDISCOVER: {
-            int yi = DHCPS_MAX_IP;
-            for (int i = 0; i < DHCPS_MAX_IP; ++i) {
-                if (memcmp(d->lease[i].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
-                    // MAC match, use this IP address
-                    yi = i;
-                    break;
-                }
-                if (yi == DHCPS_MAX_IP) {
-                    // Look for a free IP address
-                    if (memcmp(d->lease[i].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                        // IP available
-                        yi = i;
-                    }
-                    uint32_t expiry = d->lease[i].expiry << 16 | 0xffff;
-                    if ((int32_t)(expiry - cyw43_hal_ticks_ms()) < 0) {
-                        // IP expired, reuse it
-                        memset(d->lease[i].mac, 0, MAC_LEN);
-                        yi = i;
-                    }
-                }
+            bool rapid_commit = opt_find(req_opt, req_opt_len, DHCP_OPT_RAPID_COMMIT) != NULL;
+            int yi = lease_find(d, chaddr);
+            if (yi >= 0 && d->lease[yi].state == DHCPS_LEASE_OFFERED) {
+                // Keep the offer alive, lease is re-inserted when its wheel slot comes around
+                d->lease[yi].expiry = cyw43_hal_ticks_ms() + OFFER_TIME_S * 1000;
+            } else if (yi < 0) {
+                yi = lease_alloc(d, -1, chaddr, OFFER_TIME_S * 1000);
             }
-            if (yi == DHCPS_MAX_IP) {
+            if (yi < 0) {
                 // No more IP addresses left
                 goto ignore_request;
             }
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
-            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPOFFER);
+            dhcp_msg->yiaddr[3] = DHCPS_BASE_IP + yi;
+            if (rapid_commit) {
+                // Two message exchange, client is bound right away
+                lease_bind(d, yi);
+                opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPACK);
+                opt_write_n(&opt, DHCP_OPT_RAPID_COMMIT, 0, "");
+            } else {
+                opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPOFFER);
+            }
             break;
         }
 
         case DHCPREQUEST: {
-            uint8_t *o = opt_find(opt, DHCP_OPT_REQUESTED_IP);
-            if (o == NULL) {
-                // Should be NACK
+            const uint8_t *sid = opt_find(req_opt, req_opt_len, DHCP_OPT_SERVER_ID);
+            if (sid != NULL && memcmp(sid + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4) != 0) {
+                // Client selected another server, give back what we offered
+                int old = lease_find(d, chaddr);
+                if (old >= 0 && d->lease[old].state == DHCPS_LEASE_OFFERED) {
+                    lease_release(d, old);
+                }
                 goto ignore_request;
             }
-            if (memcmp(o + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0) {
-                // Should be NACK
+
+            // SELECTING and INIT-REBOOT use option 50, RENEWING and REBINDING use ciaddr
+            const uint8_t *o = opt_find(req_opt, req_opt_len, DHCP_OPT_REQUESTED_IP);
+            const uint8_t *requested = o != NULL ? o + 2 : ciaddr;
+            if (o == NULL && memcmp(ciaddr, "\x00\x00\x00\x00", 4) == 0) {
                 goto ignore_request;
             }
-            uint8_t yi = o[5] - DHCPS_BASE_IP;
-            if (yi >= DHCPS_MAX_IP) {
-                // Should be NACK
+            int yi = lease_index(d, requested);
+            if (yi < 0) {
+                // Address from another network or outside of our pool
+                dhcp_server_nak(d, dhcp_msg);
                 goto ignore_request;
             }
-            if (memcmp(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
-                // MAC match, ok to use this IP address
-            } else if (memcmp(d->lease[yi].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                // IP unused, ok to use this IP address
-                memcpy(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN);
+            if (d->lease[yi].state != DHCPS_LEASE_FREE && memcmp(d->lease[yi].mac, chaddr, MAC_LEN) == 0) {
+                // MAC match, ok to use this IP address (also fast path for INIT-REBOOT of known clients)
+            } else if (d->lease[yi].state == DHCPS_LEASE_FREE && o != NULL) {
+                // IP unused, ok to use this IP address, drop any other address held by this MAC
+                int old = lease_find(d, chaddr);
+                if (old >= 0) {
+                    lease_release(d, old);
+                }
+                lease_alloc(d, yi, chaddr, DEFAULT_LEASE_TIME_S * 1000);
             } else {
-                // IP already in use
-                // Should be NACK
+                // IP already in use, or renewing a lease we do not know (anymore)
+                dhcp_server_nak(d, dhcp_msg);
                 goto ignore_request;
             }
-            d->lease[yi].expiry = (cyw43_hal_ticks_ms() + DEFAULT_LEASE_TIME_S * 1000) >> 16;
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
+            lease_bind(d, yi);
+            dhcp_msg->yiaddr[3] = DHCPS_BASE_IP + yi;
             opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPACK);
-            printf("DHCPS: client connected: MAC=%02x:%02x:%02x:%02x:%02x:%02x IP=%u.%u.%u.%u\n",
-                dhcp_msg.chaddr[0], dhcp_msg.chaddr[1], dhcp_msg.chaddr[2], dhcp_msg.chaddr[3], dhcp_msg.chaddr[4], dhcp_msg.chaddr[5],
-                dhcp_msg.yiaddr[0], dhcp_msg.yiaddr[1], dhcp_msg.yiaddr[2], dhcp_msg.yiaddr[3]);
+            break;
+        }
+
+        case DHCPRELEASE: {
+            int yi = lease_find(d, chaddr);
+            if (yi >= 0 && yi == lease_index(d, ciaddr)) {
+                lease_release(d, yi);
+            }
+            // RELEASE has no reply
+            goto ignore_request;
+        }
+
+        case DHCPINFORM: {
+            // Client configured its address itself and only wants the other parameters
+            memset(dhcp_msg->yiaddr, 0, 4);
+            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPACK);
+            lease_time = false;
+            if (memcmp(ciaddr, "\x00\x00\x00\x00", 4) != 0) {
+                dest = MAKE_IP4(ciaddr[0], ciaddr[1], ciaddr[2], ciaddr[3]);
+            }
             break;
         }
 
@@ -280,9 +496,11 @@ static void dhcp_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     opt_write_n(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->nm)));
     opt_write_n(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // aka gateway; can have mulitple addresses
     opt_write_n(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // this server is the dns
-    opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+    if (lease_time) {
+        opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+    }
     *opt++ = DHCP_OPT_END;
-    dhcp_socket_sendto(&d->udp, &dhcp_msg, opt - (uint8_t *)&dhcp_msg, 0xffffffff, PORT_DHCP_CLIENT);
+    dhcp_socket_sendto(&d->udp, dhcp_msg, opt - (uint8_t *)dhcp_msg, dest, PORT_DHCP_CLIENT);
 
 ignore_request:
     pbuf_free(p);
@@ -292,6 +510,14 @@ void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm) {
     ip_addr_copy(d->ip, *ip);
     ip_addr_copy(d->nm, *nm);
     memset(d->lease, 0, sizeof(d->lease));
+    memset(d->hash, DHCPS_NONE, sizeof(d->hash));
+    memset(d->wheel, DHCPS_NONE, sizeof(d->wheel));
+    d->wheel_pos = 0;
+    d->wheel_time = cyw43_hal_ticks_ms();
+    d->free_head = d->free_tail = DHCPS_NONE;
+    for (int i = 0; i < DHCPS_MAX_IP; ++i) {
+        lease_free_push(d, i);
+    }
     if (dhcp_socket_new_dgram(&d->udp, d, dhcp_server_process) != 0) {
         return;
     }
@@ -28,22 +28,60 @@
 
 #include "lwip/ip_addr.h"
 
+// Pool is DHCPS_BASE_IP .. DHCPS_BASE_IP + DHCPS_MAX_IP - 1, up to a full /24
+#ifndef DHCPS_BASE_IP
 #define DHCPS_BASE_IP (16)
-#define DHCPS_MAX_IP (8)
+#endif
+#ifndef DHCPS_MAX_IP
+#define DHCPS_MAX_IP (64)
+#endif
+
+// Buckets of the MAC hashed lease index, power of 2
+#ifndef DHCPS_HASH_SIZE
+#define DHCPS_HASH_SIZE (64)
+#endif
+
+// Lease expiry timer wheel, covers DHCPS_WHEEL_SLOTS * DHCPS_WHEEL_TICK_MS,
+// longer leases are simply re-inserted when their slot comes around
+#define DHCPS_WHEEL_SLOTS (64)
+#define DHCPS_WHEEL_TICK_MS (10 * 1000)
+
+#define DHCPS_NONE (0xff)
+
+_Static_assert(DHCPS_BASE_IP >= 2 && DHCPS_BASE_IP + DHCPS_MAX_IP <= 255, "DHCP pool has to fit into a /24");
+_Static_assert((DHCPS_HASH_SIZE & (DHCPS_HASH_SIZE - 1)) == 0, "DHCPS_HASH_SIZE has to be power of 2");
+
+typedef enum {
+    DHCPS_LEASE_FREE,
+    DHCPS_LEASE_OFFERED,
+    DHCPS_LEASE_BOUND,
+} dhcp_server_lease_state_t;
 
 typedef struct _dhcp_server_lease_t {
     uint8_t mac[6];
-    uint16_t expiry;
+    uint8_t state;
+    uint8_t hash_next; // next lease in the same hash bucket
+    uint8_t next; // free list when free, timer wheel slot otherwise
+    uint8_t prev;
+    uint8_t slot; // timer wheel slot when not free
+    uint32_t expiry; // in cyw43_hal_ticks_ms()
 } dhcp_server_lease_t;
 
 typedef struct _dhcp_server_t {
     ip_addr_t ip;
     ip_addr_t nm;
     dhcp_server_lease_t lease[DHCPS_MAX_IP];
+    uint8_t hash[DHCPS_HASH_SIZE];
+    uint8_t wheel[DHCPS_WHEEL_SLOTS];
+    uint8_t wheel_pos;
+    uint32_t wheel_time;
+    uint8_t free_head;
+    uint8_t free_tail;
     struct udp_pcb *udp;
 } dhcp_server_t;
 
 void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm);
 void dhcp_server_deinit(dhcp_server_t *d);
+void dhcp_server_expire_leases(dhcp_server_t *d);
 
 #endif // MICROPY_INCLUDED_LIB_NETUTILS_DHCPSERVER_H
@@ -11,13 +11,14 @@
 #include <stdbool.h>
 
 #include "dnsserver.h"
+#include "Log.h"
 #include "lwip/udp.h"
 
 #define PORT_DNS_SERVER 53
 #define DUMP_DATA 0
 
 #define DEBUG_printf(...)
-#define ERROR_printf printf
+#define ERROR_printf LOG_ERROR
 
 typedef struct dns_header_t_ {
     uint16_t id;
@@ -30,6 +31,13 @@ typedef struct dns_header_t_ {
 
 #define MAX_DNS_MSG_SIZE 300
 
+#define DNS_QTYPE_A     1
+#define DNS_QTYPE_ANY   255
+
+// Replies are built here and handed to lwIP by reference, no per-packet
+// buffer on the stack and no copy into a freshly allocated pbuf
+static uint8_t dns_reply[MAX_DNS_MSG_SIZE] __attribute__((aligned(4)));
+
 static int dns_socket_new_dgram(struct udp_pcb **udp, void *cb_data, udp_recv_fn cb_udp_recv) {
     *udp = udp_new();
     if (*udp == NULL) {
@@ -78,13 +86,13 @@ static int dns_socket_sendto(struct udp_pcb **udp, const void *buf, size_t len,
         len = 0xffff;
     }
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    // lwIP copies referenced data itself if it has to queue the packet
+    struct pbuf *p = pbuf_alloc_reference((void *)buf, len, PBUF_REF);
     if (p == NULL) {
         ERROR_printf("DNS: Failed to send message out of memory\n");
         return -ENOMEM;
     }
 
-    memcpy(p->payload, buf, len);
     err_t err = udp_sendto(*udp, p, dest, port);
 
     pbuf_free(p);
@@ -100,15 +108,69 @@ static int dns_socket_sendto(struct udp_pcb **udp, const void *buf, size_t len,
     return len;
 }
 
+static uint32_t dns_hash_char(uint32_t hash, uint8_t c) {
+    // FNV-1a, names are case insensitive
+    if (c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+    }
+    return (hash ^ c) * 16777619u;
+}
+
+#define DNS_HASH_INIT 2166136261u
+
+// Compare wire format qname with a dotted lower case name
+static bool dns_name_equal(const uint8_t *qname, const char *name) {
+    while (*qname) {
+        int label_len = *qname++;
+        for (int i = 0; i < label_len; i++) {
+            // Labels may contain 0x00, never walk past the end of name
+            if (*name == 0) {
+                return false;
+            }
+            uint8_t c = qname[i];
+            if (c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+            if (c != (uint8_t)*name++) {
+                return false;
+            }
+        }
+        qname += label_len;
+        if (*qname && *name++ != '.') {
+            return false;
+        }
+    }
+    return *name == 0;
+}
+
+static void dns_make_answer(uint8_t *answer, const ip_addr_t *ip, uint32_t ttl) {
+    *answer++ = 0xc0; // pointer
+    *answer++ = sizeof(dns_header_t); // to the (only) question right after the header
+
+    *answer++ = 0;
+    *answer++ = DNS_QTYPE_A; // host address
+
+    *answer++ = 0;
+    *answer++ = 1; // Internet class
+
+    *answer++ = ttl >> 24;
+    *answer++ = ttl >> 16;
+    *answer++ = ttl >> 8;
+    *answer++ = ttl;
+
+    *answer++ = 0;
+    *answer++ = 4; // length
+    memcpy(answer, &ip4_addr_get_u32(ip_2_ip4(ip)), 4);
+}
+
 static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *src_addr, u16_t src_port) {
     dns_server_t *d = arg;
     DEBUG_printf("dns_server_process %u\n", p->tot_len);
 
-    uint8_t dns_msg[MAX_DNS_MSG_SIZE];
-    dns_header_t *dns_hdr = (dns_header_t*)dns_msg;
-
-    size_t msg_len = pbuf_copy_partial(p, dns_msg, sizeof(dns_msg), 0);
-    if (msg_len < sizeof(dns_header_t)) {
+    // Parse in place, queries always fit into a single pool pbuf
+    const uint8_t *dns_msg = p->payload;
+    size_t msg_len = p->len;
+    if (p->len != p->tot_len || msg_len < sizeof(dns_header_t)) {
         goto ignore_request;
     }
 
@@ -116,8 +178,9 @@ static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     dump_bytes(dns_msg, msg_len);
 #endif
 
-    uint16_t flags = lwip_ntohs(dns_hdr->flags);
-    uint16_t question_count = lwip_ntohs(dns_hdr->question_count);
+    // Payload is not word aligned, read header byte wise
+    uint16_t flags = dns_msg[2] << 8 | dns_msg[3];
+    uint16_t question_count = dns_msg[4] << 8 | dns_msg[5];
 
     DEBUG_printf("len %d\n", msg_len);
     DEBUG_printf("dns flags 0x%x\n", flags);
@@ -151,6 +214,7 @@ static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     const uint8_t *question_ptr_start = dns_msg + sizeof(dns_header_t);
     const uint8_t *question_ptr_end = dns_msg + msg_len;
     const uint8_t *question_ptr = question_ptr_start;
+    uint32_t hash = DNS_HASH_INIT;
     while(question_ptr < question_ptr_end) {
         if (*question_ptr == 0) {
             question_ptr++;
@@ -158,13 +222,17 @@ static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         } else {
             if (question_ptr > question_ptr_start) {
                 DEBUG_printf(".");
+                hash = dns_hash_char(hash, '.');
             }
             int label_len = *question_ptr++;
-            if (label_len > 63) {
+            if (label_len > 63 || question_ptr + label_len > question_ptr_end) {
                 DEBUG_printf("Invalid label\n");
                 goto ignore_request;
             }
             DEBUG_printf("%.*s", label_len, question_ptr);
+            for (int i = 0; i < label_len; i++) {
+                hash = dns_hash_char(hash, question_ptr[i]);
+            }
             question_ptr += label_len;
         }
     }
@@ -176,42 +244,48 @@ static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         goto ignore_request;
     }
 
-    // Skip QNAME and QTYPE
+    // Skip QTYPE and QCLASS
     question_ptr += 4;
-
-    // Generate answer
-    uint8_t *answer_ptr = dns_msg + (question_ptr - dns_msg);
-    *answer_ptr++ = 0xc0; // pointer
-    *answer_ptr++ = question_ptr_start - dns_msg; // pointer to question
-    
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1; // host address
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1; // Internet class
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 60; // ttl 60s
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 4; // length
-    memcpy(answer_ptr, &d->ip.addr, 4); // use our address
-    answer_ptr += 4;
+    if (question_ptr > question_ptr_end) {
+        DEBUG_printf("Truncated question\n");
+        goto ignore_request;
+    }
+    uint16_t qtype = question_ptr[-4] << 8 | question_ptr[-3];
+
+    // Reply starts with the header and the question of the request
+    memcpy(dns_reply, dns_msg, question_ptr - dns_msg);
+    dns_header_t *dns_hdr = (dns_header_t*)dns_reply;
+    uint8_t *answer_ptr = dns_reply + (question_ptr - dns_msg);
+    uint16_t answer_count = 0;
+
+    if (qtype == DNS_QTYPE_A || qtype == DNS_QTYPE_ANY) {
+        // Names from the host table, anything else resolves to us (captive portal)
+        const uint8_t *answer = d->captive_answer;
+        for (int i = 0; i < d->host_count; i++) {
+            if (d->hosts[i].hash == hash && dns_name_equal(question_ptr_start, d->hosts[i].name)) {
+                answer = d->hosts[i].answer;
+                break;
+            }
+        }
+        memcpy(answer_ptr, answer, DNS_ANSWER_SIZE);
+        answer_ptr += DNS_ANSWER_SIZE;
+        answer_count = 1;
+    }
+    // AAAA, HTTPS/SVCB and everything else get NODATA right away,
+    // so clients fall back to IPv4 without waiting for a timeout
 
     dns_hdr->flags = lwip_htons(
                 0x1 << 15 | // QR = response
                 0x1 << 10 | // AA = authoritive
                 0x1 << 7);   // RA = authenticated
     dns_hdr->question_count = lwip_htons(1);
-    dns_hdr->answer_record_count = lwip_htons(1);
+    dns_hdr->answer_record_count = lwip_htons(answer_count);
     dns_hdr->authority_record_count = 0;
     dns_hdr->additional_record_count = 0;
 
     // Send the reply
-    DEBUG_printf("Sending %d byte reply to %s:%d\n", answer_ptr - dns_msg, ipaddr_ntoa(src_addr), src_port);
-    dns_socket_sendto(&d->udp, &dns_msg, answer_ptr - dns_msg, src_addr, src_port);
+    DEBUG_printf("Sending %d byte reply to %s:%d\n", answer_ptr - dns_reply, ipaddr_ntoa(src_addr), src_port);
+    dns_socket_sendto(&d->udp, dns_reply, answer_ptr - dns_reply, src_addr, src_port);
 
 ignore_request:
     pbuf_free(p);
@@ -227,9 +301,27 @@ void dns_server_init(dns_server_t *d, ip_addr_t *ip) {
         return;
     }
     ip_addr_copy(d->ip, *ip);
+    dns_make_answer(d->captive_answer, &d->ip, DNS_SERVER_CAPTIVE_TTL_S);
+    d->host_count = 0;
     DEBUG_printf("dns server listening on port %d\n", PORT_DNS_SERVER);
 }
 
+bool dns_server_add_host(dns_server_t *d, const char *name, const ip_addr_t *ip) {
+    if (d->host_count >= DNS_SERVER_MAX_HOSTS || strlen(name) >= DNS_SERVER_MAX_HOST_NAME) {
+        return false;
+    }
+
+    dns_server_host_t *host = &d->hosts[d->host_count++];
+    host->hash = DNS_HASH_INIT;
+    for (int i = 0; name[i]; i++) {
+        host->name[i] = (name[i] >= 'A' && name[i] <= 'Z') ? name[i] + 'a' - 'A' : name[i];
+        host->hash = dns_hash_char(host->hash, name[i]);
+    }
+    host->name[strlen(name)] = 0;
+    dns_make_answer(host->answer, ip, DNS_SERVER_HOST_TTL_S);
+    return true;
+}
+
 void dns_server_deinit(dns_server_t *d) {
     dns_socket_free(&d->udp);
 }
@@ -7,14 +7,42 @@
 #ifndef _DNSSERVER_H_
 #define _DNSSERVER_H_
 
+#include <stdbool.h>
 #include "lwip/ip_addr.h"
 
+// TTL for names not in the host table, kept short so clients do not
+// cache our address after leaving the access point
+#ifndef DNS_SERVER_CAPTIVE_TTL_S
+#define DNS_SERVER_CAPTIVE_TTL_S 60
+#endif
+
+// TTL for names in the host table
+#ifndef DNS_SERVER_HOST_TTL_S
+#define DNS_SERVER_HOST_TTL_S 3600
+#endif
+
+#define DNS_SERVER_MAX_HOSTS 4
+#define DNS_SERVER_MAX_HOST_NAME 32
+
+// Precomputed A record: name pointer, type, class, ttl, length, address
+#define DNS_ANSWER_SIZE 16
+
+typedef struct dns_server_host_t_ {
+    uint32_t hash;
+    char name[DNS_SERVER_MAX_HOST_NAME];
+    uint8_t answer[DNS_ANSWER_SIZE];
+} dns_server_host_t;
+
 typedef struct dns_server_t_ {
     struct udp_pcb *udp;
      ip_addr_t ip;
+    uint8_t captive_answer[DNS_ANSWER_SIZE];
+    dns_server_host_t hosts[DNS_SERVER_MAX_HOSTS];
+    uint8_t host_count;
 } dns_server_t;
 
 void dns_server_init(dns_server_t *d, ip_addr_t *ip);
 void dns_server_deinit(dns_server_t *d);
+bool dns_server_add_host(dns_server_t *d, const char *name, const ip_addr_t *ip);
 
 #endif
@@ -0,0 +1,167 @@
+/**
+ * @file knxCaptureReplay.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Replay a /capture download on the host
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Usage: knxCaptureReplay [-n] [-q] capture.pcap [speed]
+ * 
+ * Loads the pcap into the device KnxCapture ring, with the recorded
+ * timestamps, and replays it through knxCaptureReplay at original or
+ * multiplied speed. Every event goes through the telegram decoder and is
+ * printed the way the bus monitor shows it:
+ *  -> -n jumps from event to event instead of waiting for real
+ *  -> -q prints the summary only
+ * 
+ * Summary has the decoder time per event, measured on the host clock,
+ * so real traffic can serve as a decoder benchmark.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "HostScheduler.h"
+#include "KnxCapture.h"
+#include "KnxTelegram.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#define PCAP_MAGIC_US 0xA1B2C3D4
+
+typedef struct {
+  bool quiet;
+  uint32_t events;
+  uint32_t groupValues;
+  uint64_t decodeNs;
+} ReplayStats;
+
+static uint32_t replayRead32(const uint8_t *bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t replayNowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Fill capture ring from pcap written by /capture
+ * 
+ * @param file 
+ * @return int32_t records loaded, -1 when file is no KNX capture
+ */
+static int32_t replayLoad(FILE *file) {
+  uint8_t header[24];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || replayRead32(header) != PCAP_MAGIC_US
+      || replayRead32(&header[20]) != KNX_CAPTURE_PCAP_LINKTYPE) {
+    return -1;
+  }
+
+  int32_t records = 0;
+  uint8_t record[16];
+  while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+    uint64_t time = (uint64_t)replayRead32(record) * 1000000 + replayRead32(&record[4]);
+    uint32_t length = replayRead32(&record[8]);
+    uint8_t packet[2 + KNX_BUS_MAX_TELEGRAM];
+    if (length < 1 || length > sizeof(packet) || fread(packet, 1, length, file) != length) {
+      return -1;
+    }
+
+    // Tagged events carry the DPT they were queued with between type and telegram
+    uint8_t typeLength = packet[0] & KNX_CAPTURE_PCAP_DPT ? 2 : 1;
+    if (length < typeLength) {
+      return -1;
+    }
+
+    KnxBusEvent event;
+    event.type = packet[0] & ~KNX_CAPTURE_PCAP_DPT;
+    event.dpt = typeLength == 2 ? packet[1] : 0;
+    event.timestamp = time;
+    event.telegram.length = length - typeLength;
+    memcpy(event.telegram.data, &packet[typeLength], length - typeLength);
+
+    hostSetTimeUs(time);
+    knxCaptureRecord(&event);
+    records++;
+  }
+  return records;
+}
+
+static void replayEvent(const KnxBusEvent *event, void *arg) {
+  ReplayStats *stats = arg;
+  KnxGroupValue groupValue;
+
+  uint64_t start = replayNowNs();
+  bool isGroupValue = knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue);
+  stats->decodeNs += replayNowNs() - start;
+  stats->events++;
+  stats->groupValues += isGroupValue;
+
+  if (stats->quiet) {
+    return;
+  }
+
+  uint64_t now = time_us_64();
+  KnxSourceAddress source = knxDecodeSourceAddressField(event->telegram.data[1] << 8 | event->telegram.data[2]);
+  printf("[%lu.%06lu] %u %d.%d.%d", (unsigned long)(now / 1000000), (unsigned long)(now % 1000000), event->type,
+    source.area, source.line, source.device);
+  if (isGroupValue) {
+    KnxTargetGroupAddress target = knxDecodeTargetGroupAddressField(groupValue.target);
+    printf(" -> %d/%d/%d cmd %d dpt %d value %d\n", target.main, target.middle, target.sub,
+      groupValue.cmd, groupValue.dpt, groupValue.value);
+  } else {
+    KnxTargetPhysicalAddress target = knxDecodeTargetPhysicalAddressField(event->telegram.data[3] << 8 | event->telegram.data[4]);
+    printf(" -> %d.%d.%d\n", target.area, target.line, target.device);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ReplayStats stats = { 0 };
+  bool realTime = true;
+  int arg = 1;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    realTime &= strcmp(argv[arg], "-n") != 0;
+    stats.quiet |= strcmp(argv[arg], "-q") == 0;
+  }
+  if (arg >= argc) {
+    fprintf(stderr, "usage: knxCaptureReplay [-n] [-q] capture.pcap [speed]\n");
+    return 2;
+  }
+
+  FILE *file = fopen(argv[arg], "rb");
+  if (!file) {
+    perror(argv[arg]);
+    return 2;
+  }
+  uint16_t speed = arg + 1 < argc ? atoi(argv[arg + 1]) : 1;
+
+  logInit();
+  int32_t records = replayLoad(file);
+  fclose(file);
+  if (records < 0) {
+    fprintf(stderr, "%s: not a KNX capture\n", argv[arg]);
+    return 1;
+  }
+
+  KnxCaptureStats capture = knxCaptureStats();
+  hostSchedulerRealTime(realTime);
+  uint64_t started = time_us_64();
+  uint32_t expected = knxCaptureReplay(speed ? speed : 1, replayEvent, &stats);
+  schedulerRun(NULL);
+  logFlush(NULL);
+
+  printf("%d records, %u dropped, %u replayed in %lu us, %u group values, %.1f ns/decode\n",
+    records, capture.dropped, stats.events, (unsigned long)(time_us_64() - started), stats.groupValues,
+    stats.events ? (double)stats.decodeNs / stats.events : 0.0);
+  return stats.events == expected && expected == (uint32_t)records ? 0 : 1;
+}
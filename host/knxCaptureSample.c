@@ -0,0 +1,85 @@
+/**
+ * @file knxCaptureSample.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Writes a pcap the way /capture does, for the replay test
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Usage: knxCaptureSample out.pcap
+ * 
+ * Records switch, dimming and read telegrams every 10 ms plus one
+ * individual addressed frame and one tagged down stop into the capture
+ * ring and exports it through knxCapturePcapOpen / knxCapturePcapRead.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "KnxCapture.h"
+#include "KnxTelegram.h"
+#include "Log.h"
+
+#define SAMPLE_TELEGRAMS 300
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: knxCaptureSample out.pcap\n");
+    return 2;
+  }
+
+  logInit();
+  uint16_t source = knxCreateSourceAddressFieldFromString("1.1.5");
+  for (uint16_t i = 0; i < SAMPLE_TELEGRAMS; i++) {
+    KnxGroupValue groupValue = { 0x0A00 | (i & 0x0F), KNX_CMD_VALUE_WRITE, KNX_DPT_SWITCH, i & 1 };
+    if (i % 3 == 1) {
+      groupValue.dpt = KNX_DPT_DIMMING;
+      groupValue.value = i & 0xFF;
+    } else if (i % 3 == 2) {
+      groupValue.cmd = KNX_CMD_VALUE_READ;
+      groupValue.value = 0;
+    }
+
+    KnxBusEvent event = { .type = KNX_BUS_EVENT_RECEIVED };
+    event.telegram.length = knxCreateGroupValueTelegram(event.telegram.data, source, groupValue);
+    hostSetTimeUs(1000000 + i * 10000);
+    event.timestamp = time_us_32();
+    knxCaptureRecord(&event);
+  }
+
+  uint8_t connect[] = { KNX_TPCI_CONNECT };
+  KnxBusEvent event = { .type = KNX_BUS_EVENT_CONFIRMED };
+  event.telegram.length = knxCreateIndividualTelegram(event.telegram.data, source, 0x1106, connect, sizeof(connect));
+  event.timestamp = time_us_32();
+  knxCaptureRecord(&event);
+
+  // Down stop of our own, only the tag tells it from switch off
+  KnxGroupValue stop = { 0x0A01, KNX_CMD_VALUE_WRITE, KNX_DPT_DIMMING_CONTROL, 0 };
+  event.dpt = stop.dpt;
+  event.telegram.length = knxCreateGroupValueTelegram(event.telegram.data, source, stop);
+  knxCaptureRecord(&event);
+
+  FILE *file = fopen(argv[1], "wb");
+  if (!file) {
+    perror(argv[1]);
+    return 2;
+  }
+
+  int32_t length = knxCapturePcapOpen();
+  uint32_t offset = 0;
+  while (offset < (uint32_t)length) {
+    uint16_t chunk;
+    const char *data = knxCapturePcapRead(offset, &chunk);
+    if (!data) {
+      fprintf(stderr, "capture read failed at %u\n", offset);
+      return 1;
+    }
+    fwrite(data, 1, chunk, file);
+    offset += chunk;
+  }
+  fclose(file);
+  return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file knxDimmingStopTest.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Dimming steps of our own must not switch the light
+ * @version 0.1
+ * @date 2023-07-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Down stop (control 0) and down step 1 (control 1) are the same one byte
+ * payload as switch off / on. Ramp writes go through the same path as on
+ * the device: group value telegram, tagged with the DPT when queued, back
+ * as CONFIRMED event. Every event is handled the way knxBusHandleEvent
+ * classifies it, once live and once replayed from the capture ring:
+ *  -> switch object state has to stay on
+ *  -> cached value of the group address has to stay switch on
+ * Same telegram without tag, as received from a push-button, still decodes
+ * as switch on the wire. Once the address carried dimming control the cache
+ * tags it before handling, so it must not switch either; an address without
+ * dimming control keeps the switch.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "HostScheduler.h"
+#include "KnxCache.h"
+#include "KnxCapture.h"
+#include "KnxRamp.h"
+#include "KnxTelegram.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#define TEST_SOURCE "1.1.5"
+#define TEST_TARGET "0.1.1"
+
+static uint8_t knxState;
+static uint32_t errors = 0;
+
+static void handleEvent(const KnxBusEvent *event, void *arg) {
+  KnxGroupValue groupValue;
+  (void)arg;
+
+  if (!knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue)
+      || groupValue.cmd == KNX_CMD_VALUE_READ || groupValue.dpt == KNX_DPT_DIMMING_CONTROL) {
+    return;
+  }
+
+  if (groupValue.dpt == KNX_DPT_SWITCH && groupValue.target == knxCreateTargetGroupAddressFieldFromString(TEST_TARGET)) {
+    knxState = groupValue.value & 0x01;
+  }
+  knxCacheUpdate(&groupValue);
+}
+
+static KnxBusEvent createEvent(char *target, uint8_t type, uint8_t dpt, uint8_t value) {
+  KnxGroupValue groupValue = { knxCreateTargetGroupAddressFieldFromString(target), KNX_CMD_VALUE_WRITE, dpt, value };
+  KnxBusEvent event = { .type = type, .timestamp = time_us_32() };
+  event.telegram.length = knxCreateGroupValueTelegram(event.telegram.data, knxCreateSourceAddressFieldFromString(TEST_SOURCE), groupValue);
+  return event;
+}
+
+/* knxBusProcessEvents order */
+static void processEvent(KnxBusEvent *event) {
+  knxCacheTagEvent(event);
+  knxCaptureRecord(event);
+  handleEvent(event, NULL);
+}
+
+/* knxGroupWrite and core1 in one, tag goes with the telegram */
+static bool rampWrite(uint16_t target, uint8_t dpt, uint8_t value) {
+  (void)target;
+  KnxBusEvent event = createEvent(TEST_TARGET, KNX_BUS_EVENT_CONFIRMED, dpt, value);
+  event.dpt = dpt;
+  processEvent(&event);
+  return true;
+}
+
+static void checkSwitchOn(const char *when) {
+  KnxGroupValue cached;
+  if (knxState != 1) {
+    printf("%s: switch state %u\n", when, knxState);
+    errors++;
+  }
+  if (!knxCacheGet(knxCreateTargetGroupAddressFieldFromString(TEST_TARGET), &cached)
+      || cached.dpt != KNX_DPT_SWITCH || cached.value != 1) {
+    printf("%s: cached dpt %u value %u\n", when, cached.dpt, cached.value);
+    errors++;
+  }
+}
+
+int main(void) {
+  logInit();
+  hostSchedulerRealTime(false);
+  knxRampInit(rampWrite);
+  uint16_t target = knxCreateTargetGroupAddressFieldFromString(TEST_TARGET);
+
+  KnxBusEvent on = createEvent(TEST_TARGET, KNX_BUS_EVENT_RECEIVED, KNX_DPT_SWITCH, 1);
+  processEvent(&on);
+  checkSwitchOn("switched on");
+
+  knxRampControl(target, 0x01);
+  checkSwitchOn("down step 1");
+  knxRampControl(target, 0x00);
+  checkSwitchOn("down stop");
+
+  // Replay starts from the switch write, ramp telegrams follow it
+  knxState = 0;
+  knxCaptureReplay(1, handleEvent, NULL);
+  schedulerRun(NULL);
+  checkSwitchOn("replayed");
+
+  KnxGroupValue received;
+  KnxBusEvent stop = createEvent(TEST_TARGET, KNX_BUS_EVENT_RECEIVED, KNX_DPT_DIMMING_CONTROL, 0);
+  if (!knxDecodeGroupValueTelegram(stop.telegram.data, stop.telegram.length, stop.dpt, &received)
+      || received.dpt != KNX_DPT_SWITCH) {
+    printf("received stop: not decoded as switch\n");
+    errors++;
+  }
+  processEvent(&stop);
+  checkSwitchOn("received stop");
+
+  KnxBusEvent other = createEvent("0.1.2", KNX_BUS_EVENT_RECEIVED, KNX_DPT_SWITCH, 1);
+  knxCacheTagEvent(&other);
+  if (other.dpt != 0) {
+    printf("other address: tagged %u\n", other.dpt);
+    errors++;
+  }
+
+  logFlush(NULL);
+  printf("%u errors\n", errors);
+  return errors ? 1 : 0;
+}
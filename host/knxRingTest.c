@@ -0,0 +1,86 @@
+/**
+ * @file knxRingTest.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Two thread test of the SPSC ring
+ * @version 0.1
+ * @date 2023-07-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Producer thread plays core1 pushing bus events, consumer thread plays
+ * core0 popping them. Items are telegram sized and carry a running count
+ * in every byte, so a lost, repeated, reordered or torn item shows up.
+ * Both sides retry on a full / empty ring, yielding so the test also
+ * finishes on a single CPU.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "KnxRing.h"
+
+#define RING_TEST_CAPACITY 16
+#define RING_TEST_COUNT 1000000
+
+typedef struct {
+  uint32_t count;
+  uint8_t data[23];
+} RingTestItem;
+
+static RingTestItem items[RING_TEST_CAPACITY];
+static KnxRing ring;
+
+static void *producer(void *arg) {
+  RingTestItem item;
+  (void)arg;
+
+  for (uint32_t i = 0; i < RING_TEST_COUNT; i++) {
+    item.count = i;
+    memset(item.data, i & 0xFF, sizeof(item.data));
+    while (!knxRingPush(&ring, &item)) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t thread;
+  RingTestItem item;
+  uint32_t errors = 0;
+
+  knxRingInit(&ring, items, sizeof(RingTestItem), RING_TEST_CAPACITY);
+  if (pthread_create(&thread, NULL, producer, NULL)) {
+    fprintf(stderr, "pthread_create failed\n");
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < RING_TEST_COUNT; i++) {
+    while (!knxRingPop(&ring, &item)) {
+      sched_yield();
+    }
+    if (item.count != i) {
+      errors++;
+      continue;
+    }
+    for (uint8_t j = 0; j < sizeof(item.data); j++) {
+      if (item.data[j] != (i & 0xFF)) {
+        errors++;
+        break;
+      }
+    }
+  }
+
+  pthread_join(thread, NULL);
+  if (!knxRingIsEmpty(&ring)) {
+    errors++;
+  }
+
+  printf("%u items, %u errors\n", RING_TEST_COUNT, errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * @file logDecode.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Turn LOG_BINARY output back into text
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Usage: logDecode firmware.elf [log.bin]
+ * 
+ * Reads the frames logFlush writes with LOG_BINARY from the file or
+ * stdin and prints them the way the device would have. Format and %s
+ * strings are looked up at their address in the loadable segments of
+ * the ELF the device runs. Bytes outside frames are printed unchanged.
+ * 
+ * Arguments are 32 bit on the device, length modifiers which mean
+ * 64 bit on the host are dropped before formatting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <elf.h>
+#include "Log.h"
+
+#define LOG_DECODE_MAX_SEGMENTS 16
+#define LOG_DECODE_MAX_SPEC 32
+
+typedef struct {
+  uint64_t address;
+  uint64_t size;
+  const char *data;
+} LogDecodeSegment;
+
+static char *image;
+static LogDecodeSegment segments[LOG_DECODE_MAX_SEGMENTS];
+static uint8_t segmentCount = 0;
+
+/**
+ * @brief Load ELF and remember where its loadable segments are
+ * 
+ * @param path 
+ * @return false when file is no ELF
+ */
+static bool logDecodeLoadElf(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  image = malloc(size);
+  if (!image || fread(image, 1, size, file) != (size_t)size || size < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG) != 0) {
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  bool is64 = image[EI_CLASS] == ELFCLASS64;
+  uint64_t phoff = is64 ? ((Elf64_Ehdr *)image)->e_phoff : ((Elf32_Ehdr *)image)->e_phoff;
+  uint16_t phnum = is64 ? ((Elf64_Ehdr *)image)->e_phnum : ((Elf32_Ehdr *)image)->e_phnum;
+
+  for (uint16_t i = 0; i < phnum && segmentCount < LOG_DECODE_MAX_SEGMENTS; i++) {
+    uint32_t type;
+    uint64_t offset, address, fileSize;
+    if (is64) {
+      Elf64_Phdr *ph = (Elf64_Phdr *)(image + phoff) + i;
+      type = ph->p_type;
+      offset = ph->p_offset;
+      address = ph->p_vaddr;
+      fileSize = ph->p_filesz;
+    } else {
+      Elf32_Phdr *ph = (Elf32_Phdr *)(image + phoff) + i;
+      type = ph->p_type;
+      offset = ph->p_offset;
+      address = ph->p_vaddr;
+      fileSize = ph->p_filesz;
+    }
+    if (type == PT_LOAD && fileSize && offset + fileSize <= (uint64_t)size) {
+      LogDecodeSegment *segment = &segments[segmentCount++];
+      segment->address = address;
+      segment->size = fileSize;
+      segment->data = image + offset;
+    }
+  }
+  return segmentCount > 0;
+}
+
+/**
+ * @brief Find NUL terminated string the device had at address
+ * 
+ * @param address 
+ * @return const char* NULL when address is not in the ELF
+ */
+static const char *logDecodeString(uint32_t address) {
+  for (uint8_t i = 0; i < segmentCount; i++) {
+    const LogDecodeSegment *segment = &segments[i];
+    if (address >= segment->address && address < segment->address + segment->size) {
+      uint64_t offset = address - segment->address;
+      if (memchr(segment->data + offset, 0, segment->size - offset)) {
+        return segment->data + offset;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief printf with 32 bit device arguments
+ * 
+ * @param fmt 
+ * @param args 
+ */
+static void logDecodeFormat(const char *fmt, const uint32_t args[6]) {
+  uint8_t next = 0;
+
+  while (*fmt) {
+    if (*fmt != '%') {
+      putchar(*fmt++);
+      continue;
+    }
+    if (fmt[1] == '%') {
+      putchar('%');
+      fmt += 2;
+      continue;
+    }
+
+    // Flags, width and precision are kept, 64 bit length modifiers are not
+    char spec[LOG_DECODE_MAX_SPEC];
+    uint8_t length = 0;
+    spec[length++] = *fmt++;
+    while (*fmt && !strchr("diouxXcspfeEgGaAn", *fmt) && length < LOG_DECODE_MAX_SPEC - 2) {
+      if (!strchr("lLzjtq", *fmt)) {
+        spec[length++] = *fmt;
+      }
+      fmt++;
+    }
+    if (!*fmt) {
+      break;
+    }
+    char conversion = *fmt++;
+    spec[length++] = conversion;
+    spec[length] = 0;
+
+    uint32_t arg = next < 6 ? args[next++] : 0;
+    switch (conversion) {
+      case 's': {
+        const char *string = logDecodeString(arg);
+        if (string) {
+          printf(spec, string);
+        } else {
+          printf("<%08x>", arg);
+        }
+        break;
+      }
+      case 'd':
+      case 'i':
+      case 'c':
+        printf(spec, (int)(int32_t)arg);
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        printf(spec, (unsigned)arg);
+        break;
+      case 'p':
+        printf("0x%08x", arg);
+        break;
+      default:
+        // Floats never make it into 32 bit arguments
+        printf("<%s:%08x>", spec, arg);
+        break;
+    }
+  }
+}
+
+static uint32_t logDecodeWord(const uint8_t *bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || !logDecodeLoadElf(argv[1])) {
+    fprintf(stderr, "usage: logDecode firmware.elf [log.bin]\n");
+    return 2;
+  }
+
+  FILE *input = argc > 2 ? fopen(argv[2], "rb") : stdin;
+  if (!input) {
+    perror(argv[2]);
+    return 2;
+  }
+
+  uint8_t frame[LOG_FRAME_SIZE];
+  uint8_t length = 0;
+  int c;
+  while ((c = fgetc(input)) != EOF) {
+    // Wait for sync, everything else is text printed by other code
+    if (length == 0 && c != LOG_FRAME_SYNC0) {
+      putchar(c);
+      continue;
+    }
+    if (length == 1 && c != LOG_FRAME_SYNC1) {
+      putchar(LOG_FRAME_SYNC0);
+      length = 0;
+      ungetc(c, input);
+      continue;
+    }
+    frame[length++] = c;
+    if (length < LOG_FRAME_SIZE) {
+      continue;
+    }
+    length = 0;
+
+    uint32_t words[8];
+    for (uint8_t i = 0; i < 8; i++) {
+      words[i] = logDecodeWord(&frame[3 + i * 4]);
+    }
+
+    if (words[0] == 0) {
+      printf("log entries dropped: %u\n", words[2]);
+      continue;
+    }
+
+    const char *fmt = logDecodeString(words[0]);
+    printf("[%u.%06u] %u ", words[1] / 1000000, words[1] % 1000000, frame[2]);
+    if (fmt) {
+      logDecodeFormat(fmt, &words[2]);
+    } else {
+      printf("<unknown format %08x>\n", words[0]);
+    }
+  }
+
+  if (input != stdin) {
+    fclose(input);
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file logSample.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Writes LOG_BINARY frames for the logDecode test
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Runs the device Log.c with LOG_BINARY, output goes to stdout. The test
+ * pipes it into logDecode with this very executable as the ELF, which is
+ * why it is linked without PIE: string addresses have to be the ones
+ * written in the file and fit into 32 bits.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "Log.h"
+
+static const char *logSampleName = "knx.switch";
+
+int main(void) {
+  logInit();
+
+  hostSetTimeUs(1500000);
+  LOG_INFO("first response %u us after reset\n", 1500000);
+  hostSetTimeUs(2000042);
+  LOG_WARN("mqtt write to %04x dropped, bus %s\n", 0x0A03, "busy");
+  LOG_ERROR("host %s, signed %d, byte %02hhx, long %lu\n", logSampleName, -7, 0x1AB, 123456UL);
+  printf("plain text\n");
+  fflush(stdout);
+  logFlush(NULL);
+
+  // One more than the ring holds
+  for (uint16_t i = 0; i <= LOG_RING_SIZE; i++) {
+    LOG_DEBUG("entry %u\n", i);
+  }
+  logFlush(NULL);
+  fflush(stdout);
+  return 0;
+}
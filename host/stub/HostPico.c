@@ -0,0 +1,42 @@
+/**
+ * @file HostPico.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "pico/stdlib.h"
+
+static uint64_t hostTime = 0;
+
+uint64_t time_us_64(void) {
+  return hostTime;
+}
+
+uint32_t time_us_32(void) {
+  return hostTime;
+}
+
+absolute_time_t get_absolute_time(void) {
+  return hostTime;
+}
+
+uint32_t to_ms_since_boot(absolute_time_t time) {
+  return time / 1000;
+}
+
+uint32_t get_core_num(void) {
+  return 0;
+}
+
+int putchar_raw(int c) {
+  return putchar(c);
+}
+
+void hostSetTimeUs(uint64_t time) {
+  hostTime = time;
+}
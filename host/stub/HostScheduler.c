@@ -0,0 +1,88 @@
+/**
+ * @file HostScheduler.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Scheduler.h timers on the host virtual clock
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Timers are kept in a list in start order, schedulerRun fires the
+ * earliest one and moves the virtual clock to its due time. With
+ * hostSchedulerRealTime the wait happens for real, otherwise the clock
+ * simply jumps. Work items are not needed by the host tools.
+ */
+
+#include <stddef.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "Scheduler.h"
+#include "HostScheduler.h"
+
+static async_at_time_worker_t *timers = NULL;
+static bool realTime = false;
+
+void hostSchedulerRealTime(bool enabled) {
+  realTime = enabled;
+}
+
+void schedulerInit(async_context_t *context) {
+  (void)context;
+}
+
+bool schedulerStartTimer(SchedulerTimer *timer, uint32_t delayMs, uint32_t periodMs, SchedulerCallback callback, void *arg) {
+  schedulerStopTimer(timer);
+  timer->worker.user_data = timer;
+  timer->worker.next_time = time_us_64() + (uint64_t)delayMs * 1000;
+  timer->periodMs = periodMs;
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->worker.next = timers;
+  timers = &timer->worker;
+  return true;
+}
+
+void schedulerStopTimer(SchedulerTimer *timer) {
+  for (async_at_time_worker_t **link = &timers; *link; link = &(*link)->next) {
+    if (*link == &timer->worker) {
+      *link = timer->worker.next;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Fire timers until complete is set or none is left
+ * 
+ * @param complete may be NULL
+ */
+void schedulerRun(volatile bool *complete) {
+  while (timers && !(complete && *complete)) {
+    async_at_time_worker_t *due = timers;
+    for (async_at_time_worker_t *worker = timers->next; worker; worker = worker->next) {
+      if (worker->next_time <= due->next_time) {
+        due = worker;
+      }
+    }
+
+    uint64_t now = time_us_64();
+    if (due->next_time > now) {
+      if (realTime) {
+        uint64_t wait = due->next_time - now;
+        struct timespec sleep = { wait / 1000000, (wait % 1000000) * 1000 };
+        nanosleep(&sleep, NULL);
+      }
+      hostSetTimeUs(due->next_time);
+    }
+
+    SchedulerTimer *timer = due->user_data;
+    schedulerStopTimer(timer);
+    if (timer->periodMs) {
+      schedulerStartTimer(timer, timer->periodMs, timer->periodMs, timer->callback, timer->arg);
+    }
+    timer->callback(timer->arg);
+  }
+}
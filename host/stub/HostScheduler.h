@@ -0,0 +1,20 @@
+/**
+ * @file HostScheduler.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host side controls of HostScheduler.c
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_SCHEDULER_H
+#define HOST_SCHEDULER_H
+
+#include <stdbool.h>
+
+/* true = timers wait for real, false = virtual clock jumps to the next one */
+void hostSchedulerRealTime(bool enabled);
+
+#endif // HOST_SCHEDULER_H
@@ -0,0 +1,24 @@
+/**
+ * @file cyw43_config.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the cyw43 millisecond tick
+ * @version 0.1
+ * @date 2023-07-05
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_CYW43_CONFIG_H
+#define HOST_CYW43_CONFIG_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint32_t cyw43_hal_ticks_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+#endif // HOST_CYW43_CONFIG_H
@@ -0,0 +1,25 @@
+/**
+ * @file sync.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for interrupt masking, host tools have no IRQs
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+#include <stdint.h>
+
+static inline uint32_t save_and_disable_interrupts(void) {
+  return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+  (void)status;
+}
+
+#endif // HOST_HARDWARE_SYNC_H
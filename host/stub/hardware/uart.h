@@ -0,0 +1,17 @@
+/**
+ * @file uart.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the UART type KnxBus.h names
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_HARDWARE_UART_H
+#define HOST_HARDWARE_UART_H
+
+typedef struct uart_inst uart_inst_t;
+
+#endif // HOST_HARDWARE_UART_H
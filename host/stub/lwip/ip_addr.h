@@ -0,0 +1,44 @@
+/**
+ * @file ip_addr.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the IPv4 only lwIP address types
+ * @version 0.1
+ * @date 2023-07-05
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_LWIP_IP_ADDR_H
+#define HOST_LWIP_IP_ADDR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t err_t;
+
+#define ERR_OK 0
+#define ERR_MEM -1
+
+typedef struct {
+  u32_t addr;
+} ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+#define IP_ANY_TYPE NULL
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define ip4_addr_get_u32(ipaddr) ((ipaddr)->addr)
+#define ip4_addr1(ipaddr) (((const u8_t *)(ipaddr))[0])
+#define ip4_addr2(ipaddr) (((const u8_t *)(ipaddr))[1])
+#define ip4_addr3(ipaddr) (((const u8_t *)(ipaddr))[2])
+#define ip_addr_copy(dest, src) ((dest) = (src))
+#define IP4_ADDR(ipaddr, a, b, c, d) \
+  ((ipaddr)->addr = htonl((u32_t)(a) << 24 | (u32_t)(b) << 16 | (u32_t)(c) << 8 | (u32_t)(d)))
+#define lwip_htons(x) htons(x)
+#define ipaddr_ntoa(ipaddr) ""
+
+#endif // HOST_LWIP_IP_ADDR_H
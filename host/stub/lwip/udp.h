@@ -0,0 +1,52 @@
+/**
+ * @file udp.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the lwIP raw UDP API
+ * @version 0.1
+ * @date 2023-07-05
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Just enough for the DHCP and DNS servers: a pcb keeps its receive
+ * callback so a host tool can feed it datagrams, udp_sendto hands the
+ * reply to hostUdpSent which the tool provides.
+ */
+
+#ifndef HOST_LWIP_UDP_H
+#define HOST_LWIP_UDP_H
+
+#include "lwip/ip_addr.h"
+
+struct pbuf {
+  struct pbuf *next;
+  void *payload;
+  u16_t tot_len;
+  u16_t len;
+};
+
+#define PBUF_REF 0
+
+struct udp_pcb;
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb {
+  udp_recv_fn recv;
+  void *recv_arg;
+};
+
+struct pbuf *pbuf_alloc_reference(void *payload, u16_t length, int type);
+u8_t pbuf_free(struct pbuf *p);
+
+struct udp_pcb *udp_new(void);
+void udp_remove(struct udp_pcb *pcb);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port);
+
+/* Provided by the host tool */
+void hostUdpSent(const uint8_t *data, u16_t length, u16_t port);
+
+#endif // HOST_LWIP_UDP_H
@@ -0,0 +1,33 @@
+/**
+ * @file async_context.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the async_context types Scheduler.h embeds
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#ifndef HOST_PICO_ASYNC_CONTEXT_H
+#define HOST_PICO_ASYNC_CONTEXT_H
+
+#include <stdint.h>
+
+typedef struct async_context async_context_t;
+
+typedef struct async_at_time_worker {
+  struct async_at_time_worker *next;
+  void *do_work;
+  uint64_t next_time;
+  void *user_data;
+} async_at_time_worker_t;
+
+typedef struct async_when_pending_worker {
+  struct async_when_pending_worker *next;
+  void *do_work;
+  int work_pending;
+  void *user_data;
+} async_when_pending_worker_t;
+
+#endif // HOST_PICO_ASYNC_CONTEXT_H
@@ -0,0 +1,36 @@
+/**
+ * @file stdlib.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Host stand-in for the parts of pico_stdlib the modules use
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Time is a virtual microsecond clock set by the host tool, so captures
+ * and logs come out the same on every run. See HostPico.c.
+ */
+
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef uint64_t absolute_time_t;
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+absolute_time_t get_absolute_time(void);
+uint32_t to_ms_since_boot(absolute_time_t time);
+uint32_t get_core_num(void);
+int putchar_raw(int c);
+
+/* Host tool side */
+void hostSetTimeUs(uint64_t time);
+
+#endif // HOST_PICO_STDLIB_H
@@ -0,0 +1,287 @@
+/**
+ * @file udpReplayBench.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief DHCP and DNS packet replay benchmark
+ * @version 0.1
+ * @date 2023-07-05
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Replays a fixed set of requests through the real dhcp_server_process
+ * and dns_server_process on top of the host lwIP stand-in:
+ *  -> DHCP: DISCOVER, REQUEST, RELEASE for 32 clients
+ *  -> DNS: A for the host name, A for any other name, AAAA
+ * 
+ * Every run checks the replies, then times the servers twice:
+ *  -> in place: request parsed from the pbuf, reply sent by reference
+ *  -> copy: request first copied to a stack buffer and the reply to a
+ *     freshly allocated one, the two copies the servers used to make
+ * 
+ * Usage: udpReplayBench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "dhcpserver.h"
+#include "dnsserver.h"
+#include "lwip/udp.h"
+
+#define BENCH_CLIENTS 32
+#define BENCH_DHCP_SIZE 548
+#define BENCH_DNS_SIZE 300
+
+#define DHCP_OPTIONS_OFFSET 236
+
+typedef struct {
+  uint8_t data[BENCH_DHCP_SIZE];
+  uint16_t length;
+  uint16_t port;
+} BenchPacket;
+
+static BenchPacket dhcpPackets[BENCH_CLIENTS * 3];
+static BenchPacket dnsPackets[3];
+
+static struct udp_pcb pcbs[2];
+static uint8_t pcbCount = 0;
+static struct pbuf replyPbuf;
+
+static bool copyMode = false;
+static uint32_t replies = 0;
+static uint8_t lastReply[BENCH_DHCP_SIZE];
+static uint16_t lastReplyLength = 0;
+static volatile uint32_t sink;
+
+/** === lwIP stand-in === */
+
+void logWrite(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f) {
+}
+
+struct pbuf *pbuf_alloc_reference(void *payload, u16_t length, int type) {
+  replyPbuf.next = NULL;
+  replyPbuf.payload = payload;
+  replyPbuf.len = replyPbuf.tot_len = length;
+  return &replyPbuf;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+  return 1;
+}
+
+struct udp_pcb *udp_new(void) {
+  return pcbCount < 2 ? &pcbs[pcbCount++] : NULL;
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+  pcb->recv = recv;
+  pcb->recv_arg = recv_arg;
+}
+
+err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+  return ERR_OK;
+}
+
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, u16_t dst_port) {
+  if (copyMode) {
+    uint8_t *copy = malloc(p->tot_len);
+    memcpy(copy, p->payload, p->tot_len);
+    sink += copy[p->tot_len - 1];
+    free(copy);
+  }
+  hostUdpSent(p->payload, p->tot_len, dst_port);
+  return ERR_OK;
+}
+
+void hostUdpSent(const uint8_t *data, u16_t length, u16_t port) {
+  memcpy(lastReply, data, length);
+  lastReplyLength = length;
+  replies++;
+}
+
+/** === Requests === */
+
+static void benchDhcp(BenchPacket *packet, uint8_t type, uint8_t client, bool requestIp) {
+  uint8_t *msg = packet->data;
+  memset(msg, 0, sizeof(packet->data));
+  msg[0] = 1;  // BOOTREQUEST
+  msg[1] = 1;  // Ethernet
+  msg[2] = 6;
+  msg[4] = client;  // xid
+  memcpy(&msg[28], "\x02\x00\x5e\x10\x00", 5);  // chaddr
+  msg[33] = client;
+
+  uint8_t *opt = &msg[DHCP_OPTIONS_OFFSET];
+  memcpy(opt, "\x63\x82\x53\x63", 4);
+  opt += 4;
+  *opt++ = 53;
+  *opt++ = 1;
+  *opt++ = type;
+  if (requestIp) {
+    *opt++ = 50;
+    *opt++ = 4;
+    memcpy(opt, "\xc0\xa8\x04", 3);
+    opt[3] = DHCPS_BASE_IP + client;
+    opt += 4;
+    *opt++ = 54;
+    *opt++ = 4;
+    memcpy(opt, "\xc0\xa8\x04\x01", 4);
+    opt += 4;
+  }
+  if (type == 7) {
+    memcpy(&msg[12], "\xc0\xa8\x04", 3);  // ciaddr
+    msg[15] = DHCPS_BASE_IP + client;
+  }
+  *opt++ = 255;
+
+  // Clients pad to the minimal BOOTP size
+  packet->length = 300;
+  packet->port = 67;
+}
+
+static void benchDns(BenchPacket *packet, const char *name, uint16_t qtype) {
+  uint8_t *msg = packet->data;
+  memset(msg, 0, sizeof(packet->data));
+  msg[1] = 0x42;  // id
+  msg[2] = 0x01;  // RD
+  msg[5] = 1;  // one question
+
+  uint8_t *q = &msg[12];
+  while (*name) {
+    const char *dot = strchr(name, '.');
+    uint8_t label = dot ? dot - name : strlen(name);
+    *q++ = label;
+    memcpy(q, name, label);
+    q += label;
+    name += label + (dot ? 1 : 0);
+  }
+  *q++ = 0;
+  *q++ = qtype >> 8;
+  *q++ = qtype;
+  *q++ = 0;
+  *q++ = 1;
+
+  packet->length = q - msg;
+  packet->port = 53;
+}
+
+/**
+ * @brief Hand packet to the server bound on its port, like lwIP would
+ * 
+ * @param packet 
+ */
+static void benchDeliver(const BenchPacket *packet) {
+  struct udp_pcb *pcb = &pcbs[packet->port == 67 ? 0 : 1];
+  struct pbuf p = { NULL, (void *)packet->data, packet->length, packet->length };
+  ip_addr_t from;
+  IP4_ADDR(&from, 192, 168, 4, 16);
+
+  if (copyMode) {
+    uint8_t copy[BENCH_DHCP_SIZE];
+    memcpy(copy, packet->data, packet->length);
+    p.payload = copy;
+    pcb->recv(pcb->recv_arg, pcb, &p, &from, 68);
+    return;
+  }
+  pcb->recv(pcb->recv_arg, pcb, &p, &from, 68);
+}
+
+static uint64_t benchNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Replay all requests once and verify the answers
+ * 
+ * @return uint32_t number of wrong replies
+ */
+static uint32_t benchCheck(void) {
+  uint32_t errors = 0;
+
+  for (uint8_t i = 0; i < BENCH_CLIENTS * 3; i++) {
+    uint32_t before = replies;
+    benchDeliver(&dhcpPackets[i]);
+    uint8_t type = dhcpPackets[i].data[DHCP_OPTIONS_OFFSET + 6];
+    if (type == 7) {
+      errors += replies != before;
+      continue;
+    }
+    // Reply type is the first option, OFFER for DISCOVER and ACK for REQUEST.
+    // Offer comes from the free list, the acked address is the requested one
+    uint8_t expected = type == 1 ? 2 : 5;
+    if (replies != before + 1 || lastReply[DHCP_OPTIONS_OFFSET + 6] != expected
+        || (expected == 5 && lastReply[16 + 3] != DHCPS_BASE_IP + i / 3)) {
+      errors++;
+    }
+  }
+
+  // Host name, captive answer and NODATA
+  static const uint8_t answers[3] = { 1, 1, 0 };
+  for (uint8_t i = 0; i < 3; i++) {
+    uint32_t before = replies;
+    benchDeliver(&dnsPackets[i]);
+    if (replies != before + 1 || lastReply[7] != answers[i]) {
+      errors++;
+    }
+  }
+  return errors;
+}
+
+static void benchRun(const BenchPacket packets[], uint8_t count, uint32_t rounds, const char *name) {
+  for (uint8_t mode = 0; mode < 2; mode++) {
+    copyMode = mode;
+    uint64_t start = benchNow();
+    for (uint32_t r = 0; r < rounds; r++) {
+      for (uint8_t i = 0; i < count; i++) {
+        benchDeliver(&packets[i]);
+      }
+    }
+    uint64_t elapsed = benchNow() - start;
+    printf("%-4s %-8s %8.1f ns/packet\n", name, mode ? "copy" : "in place", (double)elapsed / ((uint64_t)rounds * count));
+  }
+  copyMode = false;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t rounds = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+  static dhcp_server_t dhcp;
+  static dns_server_t dns;
+  ip_addr_t ip, mask;
+  IP4_ADDR(&ip, 192, 168, 4, 1);
+  IP4_ADDR(&mask, 255, 255, 255, 0);
+
+  dhcp_server_init(&dhcp, &ip, &mask);
+  dns_server_init(&dns, &ip);
+  dns_server_add_host(&dns, "knx.switch", &ip);
+
+  for (uint8_t i = 0; i < BENCH_CLIENTS; i++) {
+    benchDhcp(&dhcpPackets[i * 3], 1, i, false);
+    benchDhcp(&dhcpPackets[i * 3 + 1], 3, i, true);
+    benchDhcp(&dhcpPackets[i * 3 + 2], 7, i, false);
+  }
+  benchDns(&dnsPackets[0], "knx.switch", 1);
+  benchDns(&dnsPackets[1], "connectivitycheck.gstatic.com", 1);
+  benchDns(&dnsPackets[2], "knx.switch", 28);
+
+  for (uint8_t mode = 0; mode < 2; mode++) {
+    copyMode = mode;
+    uint32_t errors = benchCheck();
+    if (errors) {
+      printf("%u wrong replies in %s mode\n", errors, mode ? "copy" : "in place");
+      return 1;
+    }
+  }
+
+  benchRun(dhcpPackets, BENCH_CLIENTS * 3, rounds, "dhcp");
+  benchRun(dnsPackets, 3, rounds, "dns");
+  return 0;
+}
@@ -0,0 +1,359 @@
+/**
+ * @file KnxBus.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "KnxBus.h"
+#include "KnxRing.h"
+#include "KnxTelegram.h"
+#include "Log.h"
+
+#define KNX_BUS_COMMAND_QUEUE_SIZE 16
+#define KNX_BUS_EVENT_QUEUE_SIZE 32
+
+/* Partially received frame is dropped after this inter-byte gap */
+#define KNX_BUS_RX_TIMEOUT_US 2000
+
+/* TPUART repeats up to 3 times on busy/NACK, so give it plenty of time */
+#define KNX_BUS_CON_TIMEOUT_US 200000
+
+typedef struct {
+  uint8_t dpt;  // returned in the TX result event
+  KnxBusTelegram telegram;
+} KnxBusCommand;
+
+static KnxBusCommand commandItems[KNX_BUS_COMMAND_QUEUE_SIZE];
+static KnxBusEvent eventItems[KNX_BUS_EVENT_QUEUE_SIZE];
+static KnxRing commandRing;
+static KnxRing eventRing;
+
+static uart_inst_t *knxBusUart;
+static volatile KnxBusNotify knxBusNotify;
+static void *volatile knxBusNotifyArg;
+static volatile uint32_t droppedEvents = 0;
+
+/** === Written by core0, read by core1 while receiving === */
+static volatile uint32_t groupFilter[KNX_BUS_GROUP_FILTER_WORDS];
+static volatile uint32_t individualFilter = 0;  // first << 16 | count, one store
+
+/** === Core1 only state === */
+static KnxBusCommand txCommand;
+static bool txActive = false;
+static bool txWaitCon = false;
+static uint8_t txStep = 0;
+static uint32_t txStarted = 0;
+
+static KnxBusEvent rxEvent;
+static uint8_t rxExpected = 0;
+static uint32_t rxLastByte = 0;
+static uint8_t rxAck = 0;
+
+/**
+ * @brief Push event for core0, count it when core0 is not keeping up
+ * 
+ * @param event 
+ */
+static void knxBusPushEvent(const KnxBusEvent *event) {
+  if (!knxRingPush(&eventRing, event)) {
+    droppedEvents++;
+    return;
+  }
+
+  if (knxBusNotify) {
+    knxBusNotify(knxBusNotifyArg);
+  }
+}
+
+/**
+ * @brief Finish pending transmission with L_Data.con result
+ * 
+ * @param confirmed 
+ * @param now 
+ */
+static void knxBusConfirm(bool confirmed, uint32_t now) {
+  if (!txWaitCon) {
+    return;
+  }
+
+  KnxBusEvent event;
+  event.type = confirmed ? KNX_BUS_EVENT_CONFIRMED : KNX_BUS_EVENT_FAILED;
+  event.timestamp = now;
+  event.dpt = txCommand.dpt;
+  event.telegram = txCommand.telegram;
+  knxBusPushEvent(&event);
+
+  txActive = false;
+  txWaitCon = false;
+}
+
+/**
+ * @brief Is frame addressed to us, destination has just arrived
+ * Standard frame has address type in the length byte, extended in its second control byte
+ * @param telegram 
+ * @return true when TPUART should ACK it
+ */
+static bool knxBusAddressed(const KnxBusTelegram *telegram) {
+  bool extended = (telegram->data[0] & TPUART_FRAME_MASK) == TPUART_FRAME_EXTENDED;
+  uint8_t destination = extended ? 4 : 3;
+  uint16_t address = telegram->data[destination] << 8 | telegram->data[destination + 1];
+
+  if (telegram->data[extended ? 1 : 5] & 0x80) {
+    return (groupFilter[address >> 5] >> (address & 31)) & 1;
+  }
+
+  uint32_t individual = individualFilter;
+  return (uint16_t)(address - (individual >> 16)) < (individual & 0xFFFF);
+}
+
+/**
+ * @brief Assemble frames and services sent by TPUART
+ * 
+ * @param byte 
+ * @param now 
+ */
+static void knxBusReceiveByte(uint8_t byte, uint32_t now) {
+  KnxBusTelegram *telegram = &rxEvent.telegram;
+
+  if (telegram->length && (now - rxLastByte) > KNX_BUS_RX_TIMEOUT_US) {
+    telegram->length = 0;
+  }
+  rxLastByte = now;
+
+  if (telegram->length == 0) {
+    if ((byte & TPUART_FRAME_MASK) == TPUART_FRAME_STANDARD
+        || (byte & TPUART_FRAME_MASK) == TPUART_FRAME_EXTENDED) {
+      rxEvent.type = KNX_BUS_EVENT_RECEIVED;
+      rxEvent.timestamp = now;
+      rxEvent.dpt = 0;
+      telegram->data[telegram->length++] = byte;
+      rxExpected = 0;
+    } else if (byte == TPUART_DATA_CON_POSITIVE || byte == TPUART_DATA_CON_NEGATIVE) {
+      knxBusConfirm(byte == TPUART_DATA_CON_POSITIVE, now);
+    }
+
+    // Reset and state indications have no evaluation
+    return;
+  }
+
+  telegram->data[telegram->length++] = byte;
+
+  // Destination is complete in both frame formats, ACK window is open now
+  if (telegram->length == 6) {
+    rxAck = TPUART_ACK_INFORMATION | (knxBusAddressed(telegram) ? TPUART_ACK_ADDRESSED : 0);
+  }
+
+  // Length is known once the length field arrived
+  if (rxExpected == 0) {
+    bool extended = (telegram->data[0] & TPUART_FRAME_MASK) == TPUART_FRAME_EXTENDED;
+    if (! extended && telegram->length == 6) {
+      rxExpected = 8 + knxGetDataLength(byte);
+    } else if (extended && telegram->length == 7) {
+      rxExpected = 9 + byte;
+    }
+
+    if (rxExpected > KNX_BUS_MAX_TELEGRAM) {
+      telegram->length = 0;
+    }
+    return;
+  }
+
+  if (telegram->length == rxExpected) {
+    if (knxCalculateChecksum(telegram->data, telegram->length) == telegram->data[telegram->length - 1]) {
+      knxBusPushEvent(&rxEvent);
+    } else {
+      LOG_WARN("bus checksum error, %u bytes\n", telegram->length);
+    }
+    telegram->length = 0;
+  }
+}
+
+/**
+ * @brief Answer received frame, never between control and data byte of our own
+ * 
+ */
+static void knxBusSendAck(void) {
+  if (rxAck && txStep % 2 == 0 && uart_is_writable(knxBusUart)) {
+    uart_putc_raw(knxBusUart, rxAck);
+    rxAck = 0;
+  }
+}
+
+/**
+ * @brief Feed next telegram to TPUART without blocking RX
+ * Every telegram byte is sent as pair of control and data byte,
+ * pending ACK goes in between two pairs
+ * 
+ * @param now 
+ */
+static void knxBusTransmit(uint32_t now) {
+  if (! txActive) {
+    if (! knxRingPop(&commandRing, &txCommand)) {
+      return;
+    }
+    txActive = true;
+    txWaitCon = false;
+    txStep = 0;
+  }
+
+  if (txWaitCon) {
+    if ((now - txStarted) > KNX_BUS_CON_TIMEOUT_US) {
+      knxBusConfirm(false, now);
+    }
+    return;
+  }
+
+  while (txStep < txCommand.telegram.length * 2 && uart_is_writable(knxBusUart)) {
+    if (rxAck && txStep % 2 == 0) {
+      break;
+    }
+    uint8_t i = txStep / 2;
+    if (txStep % 2) {
+      uart_putc_raw(knxBusUart, txCommand.telegram.data[i]);
+    } else if (i == (txCommand.telegram.length - 1)) {
+      uart_putc_raw(knxBusUart, TPUART_DATA_END | i);
+    } else {
+      uart_putc_raw(knxBusUart, TPUART_DATA_START_CONTINUE | i);
+    }
+    txStep++;
+  }
+
+  if (txStep == txCommand.telegram.length * 2) {
+    txWaitCon = true;
+    txStarted = now;
+  }
+}
+
+static void knxBusCore1Entry(void) {
+  // Core0 parks us while it writes flash
+  multicore_lockout_victim_init();
+
+  while (true) {
+    uint32_t now = time_us_32();
+
+    while (uart_is_readable(knxBusUart)) {
+      knxBusReceiveByte(uart_getc(knxBusUart), now);
+    }
+
+    knxBusSendAck();
+    knxBusTransmit(now);
+  }
+}
+
+/**
+ * @brief Start bus engine on core1
+ * UART has to be configured already, core1 owns it from now on.
+ * Runs before Wi-Fi is up, events wait in the ring until core0 takes them
+ * 
+ * @param uart 
+ */
+void knxBusInit(uart_inst_t *uart) {
+  knxBusUart = uart;
+  knxRingInit(&commandRing, commandItems, sizeof(KnxBusCommand), KNX_BUS_COMMAND_QUEUE_SIZE);
+  knxRingInit(&eventRing, eventItems, sizeof(KnxBusEvent), KNX_BUS_EVENT_QUEUE_SIZE);
+  multicore_launch_core1(knxBusCore1Entry);
+}
+
+/**
+ * @brief Set callback which wakes core0 when events are ready
+ * Called on core1, has to be safe from there
+ * 
+ * @param notify 
+ * @param notifyArg 
+ */
+void knxBusSetNotify(KnxBusNotify notify, void *notifyArg) {
+  knxBusNotifyArg = notifyArg;
+  __dmb();
+  knxBusNotify = notify;
+}
+
+/**
+ * @brief Queue telegram for transmission
+ * 
+ * @param telegram 
+ * @param size 
+ * @return false when queue is full or telegram too long
+ */
+bool knxBusSend(const uint8_t telegram[], uint8_t size) {
+  return knxBusSendTagged(telegram, size, 0);
+}
+
+/**
+ * @brief Queue group value telegram, its TX result event carries the DPT
+ * 
+ * @param telegram 
+ * @param size 
+ * @param dpt 
+ * @return false when queue is full or telegram too long
+ */
+bool knxBusSendTagged(const uint8_t telegram[], uint8_t size, uint8_t dpt) {
+  KnxBusCommand command;
+  if (size == 0 || size > KNX_BUS_MAX_TELEGRAM) {
+    return false;
+  }
+
+  command.dpt = dpt;
+  command.telegram.length = size;
+  memcpy(command.telegram.data, telegram, size);
+  return knxRingPush(&commandRing, &command);
+}
+
+/**
+ * @brief Get next event from bus engine
+ * 
+ * @param event 
+ * @return false when there are no events
+ */
+bool knxBusPollEvent(KnxBusEvent *event) {
+  return knxRingPop(&eventRing, event);
+}
+
+/**
+ * @brief Number of events lost because core0 did not drain the ring
+ * 
+ * @return uint32_t 
+ */
+uint32_t knxBusDroppedEvents(void) {
+  return droppedEvents;
+}
+
+/**
+ * @brief Add or remove group address from the ones TPUART acknowledges
+ * Core0 only. Whoever accepted an address is responsible for removing it
+ * 
+ * @param group 
+ * @param accept 
+ */
+void knxBusAcceptGroup(uint16_t group, bool accept) {
+  uint32_t bit = 1u << (group & 31);
+  uint32_t word = groupFilter[group >> 5];
+  groupFilter[group >> 5] = accept ? word | bit : word & ~bit;
+}
+
+/**
+ * @brief Set individual addresses TPUART acknowledges, device and its tunnels
+ * 
+ * @param first 
+ * @param count 0 = none
+ */
+void knxBusAcceptIndividual(uint16_t first, uint8_t count) {
+  individualFilter = (uint32_t)first << 16 | count;
+}
+
+/**
+ * @brief Is group address acknowledged on the bus
+ * 
+ * @param group 
+ * @return true 
+ */
+bool knxBusGroupAccepted(uint16_t group) {
+  return (groupFilter[group >> 5] >> (group & 31)) & 1;
+}
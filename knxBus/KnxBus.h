@@ -0,0 +1,85 @@
+/**
+ * @file KnxBus.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief TPUART bus engine running on core1
+ * @version 0.1
+ * @date 2023-07-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Bus Engine
+ * 
+ * Core1 owns the TPUART exclusively. Network side (core0) talks to it
+ * only through two SPSC rings:
+ *  -> command ring (core0 -> core1): telegrams to transmit
+ *  -> event ring (core1 -> core0): received telegrams and TX results
+ * 
+ * Wi-Fi interrupts on core0 never delay bus timing and a busy bus never
+ * blocks lwIP.
+ * 
+ * Engine starts before Wi-Fi, the notify callback is set once core0 is
+ * ready to take events. Until then they wait in the event ring.
+ * 
+ * Every telegram is passed to core0, but TPUART is only told to ACK the
+ * ones addressed to us. Decision has to be made while the frame is still
+ * on the wire, so core1 looks the destination up in a bitmap over all
+ * 64Ki group addresses (one word load and a shift) and in the range of
+ * our individual addresses. Core0 is the only writer, every bit flips
+ * with a single word store.
+ * 
+ * One byte group values don't say on the wire whether they are a switch
+ * or a dimming control, so commands carry the DPT core0 queued them with
+ * and core1 hands it back with the TX result.
+ */
+
+#ifndef KNX_BUS_H
+#define KNX_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/uart.h"
+
+/* Standard frame with 15 bytes of payload */
+#define KNX_BUS_MAX_TELEGRAM 23
+
+/* One bit per group address */
+#define KNX_BUS_GROUP_FILTER_WORDS (65536 / 32)
+
+typedef enum {
+  KNX_BUS_EVENT_RECEIVED,   // telegram received from the bus
+  KNX_BUS_EVENT_CONFIRMED,  // our telegram was acknowledged (L_Data.con positive)
+  KNX_BUS_EVENT_FAILED,     // our telegram was not acknowledged or timed out
+} KnxBusEventType;
+
+typedef struct {
+  uint8_t length;
+  uint8_t data[KNX_BUS_MAX_TELEGRAM];
+} KnxBusTelegram;
+
+typedef struct {
+  uint8_t type;
+  uint32_t timestamp;  // time_us_32() on core1 when first byte was seen
+  uint8_t dpt;         // DPT our telegram was queued with or its address is known by, 0 when unknown
+  KnxBusTelegram telegram;
+} KnxBusEvent;
+
+/* Called on core1 after events were pushed, has to be safe from other core */
+typedef void (*KnxBusNotify)(void *arg);
+
+/** === Core0 API === */
+void knxBusInit(uart_inst_t *uart);
+void knxBusSetNotify(KnxBusNotify notify, void *notifyArg);
+bool knxBusSend(const uint8_t telegram[], uint8_t size);
+bool knxBusSendTagged(const uint8_t telegram[], uint8_t size, uint8_t dpt);
+bool knxBusPollEvent(KnxBusEvent *event);
+uint32_t knxBusDroppedEvents(void);
+
+/** === Acceptance filter === */
+void knxBusAcceptGroup(uint16_t group, bool accept);
+void knxBusAcceptIndividual(uint16_t first, uint8_t count);
+bool knxBusGroupAccepted(uint16_t group);
+
+#endif // KNX_BUS_H
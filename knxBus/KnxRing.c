@@ -0,0 +1,87 @@
+/**
+ * @file KnxRing.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include <assert.h>
+#include "KnxRing.h"
+
+/**
+ * @brief Initialize ring over caller provided storage
+ * 
+ * @param ring 
+ * @param items storage for capacity * itemSize bytes
+ * @param itemSize 
+ * @param capacity (power of 2)
+ */
+void knxRingInit(KnxRing *ring, void *items, uint32_t itemSize, uint32_t capacity) {
+  assert(capacity && (capacity & (capacity - 1)) == 0);
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->mask = capacity - 1;
+  ring->itemSize = itemSize;
+  ring->items = items;
+}
+
+/**
+ * @brief Push item, producer side only
+ * 
+ * @param ring 
+ * @param item 
+ * @return false when ring is full
+ */
+bool knxRingPush(KnxRing *ring, const void *item) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (head - tail > ring->mask) {
+    return false;
+  }
+
+  memcpy(ring->items + (head & ring->mask) * ring->itemSize, item, ring->itemSize);
+
+  // Publish item only after it has been copied
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Pop item, consumer side only
+ * 
+ * @param ring 
+ * @param item 
+ * @return false when ring is empty
+ */
+bool knxRingPop(KnxRing *ring, void *item) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (head == tail) {
+    return false;
+  }
+
+  memcpy(item, ring->items + (tail & ring->mask) * ring->itemSize, ring->itemSize);
+
+  // Release slot only after it has been copied
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Check if ring has no items, consumer side only
+ * 
+ * @param ring 
+ * @return true 
+ * @return false 
+ */
+bool knxRingIsEmpty(KnxRing *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire)
+    == atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
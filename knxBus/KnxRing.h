@@ -0,0 +1,40 @@
+/**
+ * @file KnxRing.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Lock-free single producer / single consumer ring
+ * @version 0.1
+ * @date 2023-07-02
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Used to pass telegrams between the network core (core0) and the bus
+ * core (core1). Exactly one side may push and exactly one side may pop,
+ * no locks or disabled interrupts are needed. Only standard C11 atomics
+ * are used, so the same ring can be exercised by two host threads.
+ */
+
+#ifndef KNX_RING_H
+#define KNX_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct {
+  _Atomic uint32_t head;  // written by producer only
+  _Atomic uint32_t tail;  // written by consumer only
+  uint32_t mask;
+  uint32_t itemSize;
+  uint8_t *items;
+} KnxRing;
+
+/** Capacity has to be power of 2 */
+void knxRingInit(KnxRing *ring, void *items, uint32_t itemSize, uint32_t capacity);
+bool knxRingPush(KnxRing *ring, const void *item);
+bool knxRingPop(KnxRing *ring, void *item);
+bool knxRingIsEmpty(KnxRing *ring);
+
+#endif // KNX_RING_H
@@ -0,0 +1,153 @@
+/**
+ * @file KnxCache.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-14
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "KnxCache.h"
+
+_Static_assert((KNX_CACHE_SIZE & (KNX_CACHE_SIZE - 1)) == 0, "KNX_CACHE_SIZE has to be power of 2");
+
+// Empty slots have dpt 0
+static KnxGroupValue cache[KNX_CACHE_SIZE];
+
+// Addresses seen with dimming control, 0 (broadcast) is an empty slot
+static uint16_t controlTargets[KNX_CACHE_SIZE];
+
+/**
+ * @brief Find slot of group address, or empty slot where it belongs
+ * 
+ * @param target 
+ * @return KnxGroupValue* NULL when table is full
+ */
+static KnxGroupValue *knxCacheSlot(uint16_t target) {
+  uint16_t index = (target * 40503u) >> 8;
+
+  for (uint16_t i = 0; i < KNX_CACHE_SIZE; i++) {
+    KnxGroupValue *slot = &cache[(index + i) & (KNX_CACHE_SIZE - 1)];
+    if (slot->dpt == 0 || slot->target == target) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Find slot of dimming control address, or empty slot where it belongs
+ * 
+ * @param target 
+ * @return uint16_t* NULL when table is full or target is broadcast
+ */
+static uint16_t *knxCacheControlSlot(uint16_t target) {
+  uint16_t index = (target * 40503u) >> 8;
+  if (target == 0) {
+    return NULL;
+  }
+
+  for (uint16_t i = 0; i < KNX_CACHE_SIZE; i++) {
+    uint16_t *slot = &controlTargets[(index + i) & (KNX_CACHE_SIZE - 1)];
+    if (*slot == 0 || *slot == target) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Tag live event on an address known to carry dimming control
+ * Our own tagged ramps and step codes above 1 mark the address, later untagged
+ * down stop and down step 1 (push-button hold) on it are not taken for a switch
+ * @param event tagged in place, before anyone decodes or records it
+ */
+void knxCacheTagEvent(KnxBusEvent *event) {
+  KnxGroupValue groupValue;
+  if (!knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue)
+      || groupValue.cmd == KNX_CMD_VALUE_READ) {
+    return;
+  }
+
+  uint16_t *slot = knxCacheControlSlot(groupValue.target);
+  if (groupValue.dpt == KNX_DPT_DIMMING_CONTROL) {
+    if (slot) {
+      *slot = groupValue.target;
+    }
+    event->dpt = KNX_DPT_DIMMING_CONTROL;
+  } else if (event->dpt == 0 && groupValue.dpt == KNX_DPT_SWITCH && slot && *slot == groupValue.target) {
+    event->dpt = KNX_DPT_DIMMING_CONTROL;
+  }
+}
+
+/**
+ * @brief Store value of group address
+ * 
+ * @param groupValue 
+ * @return true when value is new or changed
+ */
+bool knxCacheUpdate(const KnxGroupValue *groupValue) {
+  KnxGroupValue *slot = knxCacheSlot(groupValue->target);
+  if (!slot) {
+    return false;
+  }
+
+  if (slot->dpt == groupValue->dpt && slot->value == groupValue->value) {
+    return false;
+  }
+
+  *slot = *groupValue;
+  return true;
+}
+
+/**
+ * @brief Get last known value of group address
+ * 
+ * @param target 
+ * @param groupValue 
+ * @return true when address is known
+ */
+bool knxCacheGet(uint16_t target, KnxGroupValue *groupValue) {
+  KnxGroupValue *slot = knxCacheSlot(target);
+  if (!slot || slot->dpt == 0) {
+    return false;
+  }
+
+  *groupValue = *slot;
+  return true;
+}
+
+/**
+ * @brief DPT to write a value to group address with
+ * Last one seen on the address, 0 and 1 still are dimmer values for a dimmer
+ * @param target 
+ * @param value 
+ * @return uint8_t cached DPT, switch for 0 and 1 and dimming above for unknown addresses
+ */
+uint8_t knxCacheDpt(uint16_t target, uint8_t value) {
+  KnxGroupValue groupValue;
+  if (knxCacheGet(target, &groupValue)) {
+    return groupValue.dpt;
+  }
+  return value > 1 ? KNX_DPT_DIMMING : KNX_DPT_SWITCH;
+}
+
+/**
+ * @brief Get entry by table index, for walking the whole cache
+ * 
+ * @param index 0 .. KNX_CACHE_SIZE - 1
+ * @param groupValue 
+ * @return true when slot is used
+ */
+bool knxCacheAt(uint16_t index, KnxGroupValue *groupValue) {
+  if (index >= KNX_CACHE_SIZE || cache[index].dpt == 0) {
+    return false;
+  }
+
+  *groupValue = cache[index];
+  return true;
+}
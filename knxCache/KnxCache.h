@@ -0,0 +1,41 @@
+/**
+ * @file KnxCache.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Last known value of every group address seen on the bus
+ * @version 0.1
+ * @date 2023-07-14
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Cache Description
+ * 
+ * Fixed size open addressing table keyed by group address, filled from
+ * group value writes and responses (received and our own confirmed ones).
+ * Core0 only, no locking.
+ * 
+ * Second table of the same size remembers addresses which carried dimming
+ * control, one byte values on them are tagged before they are decoded.
+ */
+
+#ifndef KNX_CACHE_H
+#define KNX_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxTelegram.h"
+#include "KnxBus.h"
+
+/* Has to be power of 2 */
+#define KNX_CACHE_SIZE 64
+
+/** === Cache === */
+bool knxCacheUpdate(const KnxGroupValue *groupValue);
+bool knxCacheGet(uint16_t target, KnxGroupValue *groupValue);
+uint8_t knxCacheDpt(uint16_t target, uint8_t value);
+void knxCacheTagEvent(KnxBusEvent *event);
+bool knxCacheAt(uint16_t index, KnxGroupValue *groupValue);
+
+#endif // KNX_CACHE_H
@@ -0,0 +1,362 @@
+/**
+ * @file KnxCapture.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "KnxCapture.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+_Static_assert((KNX_CAPTURE_SIZE & (KNX_CAPTURE_SIZE - 1)) == 0, "KNX_CAPTURE_SIZE has to be power of 2");
+
+#define KNX_CAPTURE_MASK (KNX_CAPTURE_SIZE - 1)
+#define KNX_CAPTURE_PCAP_HEADER 24
+#define KNX_CAPTURE_PCAP_RECORD 16
+
+/* Record header: DPT flag in bit 7, type in bits 6-5, telegram length in bits 4-0 */
+#define KNX_CAPTURE_DPT_FLAG 0x80
+#define KNX_CAPTURE_TYPE_SHIFT 5
+#define KNX_CAPTURE_TYPE_MASK 0x03
+#define KNX_CAPTURE_LENGTH_MASK 0x1F
+
+typedef struct {
+  bool active;
+  bool first;          // time of the first record is tailTime, its delta is stale
+  uint32_t pos;        // next record
+  uint32_t remaining;  // records left to read
+  uint64_t time;       // of the record read last
+} KnxCaptureReader;
+
+// Positions run freely and are masked on access
+static uint8_t ring[KNX_CAPTURE_SIZE];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t records = 0;
+static uint64_t tailTime;
+static uint64_t lastTime;
+static uint32_t dropped = 0;
+
+/** === Download === */
+static KnxCaptureReader download;
+static uint32_t downloadStarted;
+static uint32_t pcapLength;
+static char chunk[256] __attribute__((aligned(4)));
+static uint32_t chunkStart;
+static uint16_t chunkLength;
+
+/** === Replay === */
+static KnxCaptureReader replay;
+static SchedulerTimer replayTimer;
+static KnxCaptureReplayHandler replayHandler;
+static void *replayArg;
+static uint16_t replaySpeed;
+static uint64_t replayStarted;
+static uint64_t replayBase;
+static uint32_t replayCount;
+static uint32_t replayBusyUs;
+
+static uint64_t knxCaptureReadVarint(uint32_t *pos) {
+  uint64_t value = 0;
+  uint8_t shift = 0;
+  uint8_t byte;
+
+  do {
+    byte = ring[(*pos)++ & KNX_CAPTURE_MASK];
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  return value;
+}
+
+/**
+ * @brief Read record at reader position and move past it
+ * 
+ * @param reader 
+ * @param event telegram and type, timestamp is left alone
+ * @return uint64_t absolute time of the record
+ */
+static uint64_t knxCaptureReadRecord(KnxCaptureReader *reader, KnxBusEvent *event) {
+  uint64_t delta = knxCaptureReadVarint(&reader->pos);
+  uint8_t header = ring[reader->pos++ & KNX_CAPTURE_MASK];
+
+  event->type = (header >> KNX_CAPTURE_TYPE_SHIFT) & KNX_CAPTURE_TYPE_MASK;
+  event->dpt = header & KNX_CAPTURE_DPT_FLAG ? ring[reader->pos++ & KNX_CAPTURE_MASK] : 0;
+  event->telegram.length = header & KNX_CAPTURE_LENGTH_MASK;
+  for (uint8_t i = 0; i < event->telegram.length; i++) {
+    event->telegram.data[i] = ring[reader->pos++ & KNX_CAPTURE_MASK];
+  }
+
+  reader->time = reader->first ? tailTime : reader->time + delta;
+  reader->first = false;
+  reader->remaining--;
+  return reader->time;
+}
+
+static void knxCaptureOpenReader(KnxCaptureReader *reader) {
+  reader->active = true;
+  reader->first = true;
+  reader->pos = tail;
+  reader->remaining = records;
+  reader->time = tailTime;
+}
+
+/**
+ * @brief Drop oldest record, next one becomes the time base
+ * 
+ */
+static void knxCaptureEvict(void) {
+  knxCaptureReadVarint(&tail);
+  uint8_t header = ring[tail++ & KNX_CAPTURE_MASK];
+  tail += (header & KNX_CAPTURE_LENGTH_MASK) + (header & KNX_CAPTURE_DPT_FLAG ? 1 : 0);
+  records--;
+
+  if (records) {
+    uint32_t pos = tail;
+    tailTime += knxCaptureReadVarint(&pos);
+  }
+}
+
+/**
+ * @brief Append bus engine event to the ring
+ * 
+ * @param event 
+ */
+void knxCaptureRecord(const KnxBusEvent *event) {
+  if (replay.active || event->telegram.length > KNX_CAPTURE_LENGTH_MASK) {
+    dropped++;
+    return;
+  }
+
+  // Core1 timestamp is 32 bit, extend it using how long ago it was taken
+  uint64_t time = time_us_64() - (uint32_t)(time_us_32() - event->timestamp);
+  uint64_t delta = records ? time - lastTime : 0;
+
+  uint8_t varint[10];
+  uint8_t varintLength = 0;
+  do {
+    varint[varintLength] = delta & 0x7F;
+    delta >>= 7;
+    if (delta) {
+      varint[varintLength] |= 0x80;
+    }
+    varintLength++;
+  } while (delta);
+
+  uint32_t needed = varintLength + 1 + (event->dpt ? 1 : 0) + event->telegram.length;
+  while (KNX_CAPTURE_SIZE - (head - tail) < needed) {
+    if (download.active && download.remaining && download.pos == tail) {
+      if (time_us_32() - downloadStarted < KNX_CAPTURE_READ_TIMEOUT_US) {
+        dropped++;
+        return;
+      }
+      download.active = false;
+    }
+    knxCaptureEvict();
+  }
+
+  for (uint8_t i = 0; i < varintLength; i++) {
+    ring[head++ & KNX_CAPTURE_MASK] = varint[i];
+  }
+  ring[head++ & KNX_CAPTURE_MASK] = (event->dpt ? KNX_CAPTURE_DPT_FLAG : 0)
+    | (event->type << KNX_CAPTURE_TYPE_SHIFT) | event->telegram.length;
+  if (event->dpt) {
+    ring[head++ & KNX_CAPTURE_MASK] = event->dpt;
+  }
+  for (uint8_t i = 0; i < event->telegram.length; i++) {
+    ring[head++ & KNX_CAPTURE_MASK] = event->telegram.data[i];
+  }
+
+  if (records == 0) {
+    tailTime = time;
+  }
+  lastTime = time;
+  records++;
+}
+
+/**
+ * @brief Ring usage
+ * 
+ * @return KnxCaptureStats
+ */
+KnxCaptureStats knxCaptureStats(void) {
+  KnxCaptureStats stats = { records, head - tail, dropped };
+  return stats;
+}
+
+static void knxCapturePut32(char *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+/**
+ * @brief Start download of current ring content
+ * 
+ * @return int32_t pcap size, -1 when another download is running
+ */
+int32_t knxCapturePcapOpen(void) {
+  if (download.active && time_us_32() - downloadStarted < KNX_CAPTURE_READ_TIMEOUT_US) {
+    return -1;
+  }
+
+  // Record headers grow from 1 byte plus delta to a type byte plus pcap header
+  pcapLength = KNX_CAPTURE_PCAP_HEADER;
+  uint32_t pos = tail;
+  for (uint32_t i = 0; i < records; i++) {
+    knxCaptureReadVarint(&pos);
+    uint8_t header = ring[pos++ & KNX_CAPTURE_MASK];
+    uint8_t length = (header & KNX_CAPTURE_LENGTH_MASK) + (header & KNX_CAPTURE_DPT_FLAG ? 1 : 0);
+    pos += length;
+    pcapLength += KNX_CAPTURE_PCAP_RECORD + 1 + length;
+  }
+
+  knxCaptureOpenReader(&download);
+  downloadStarted = time_us_32();
+  chunkStart = 0;
+  chunkLength = 0;
+  return pcapLength;
+}
+
+/**
+ * @brief Get pcap data at offset, whole records are expanded into a chunk at a time
+ * Same offset can be asked again until the server moves past it
+ * @param offset 
+ * @param length 
+ * @return const char* NULL when download lost its records or offset is out of order
+ */
+const char *knxCapturePcapRead(uint32_t offset, uint16_t *length) {
+  if (offset >= chunkStart && offset < chunkStart + chunkLength) {
+    *length = chunkStart + chunkLength - offset;
+    return &chunk[offset - chunkStart];
+  }
+
+  if (!download.active || offset != chunkStart + chunkLength) {
+    return NULL;
+  }
+
+  chunkStart = offset;
+  chunkLength = 0;
+
+  if (offset == 0) {
+    knxCapturePut32(&chunk[0], 0xA1B2C3D4);  // microsecond timestamps
+    knxCapturePut32(&chunk[4], 2 | 4 << 16);  // version 2.4
+    knxCapturePut32(&chunk[8], 0);
+    knxCapturePut32(&chunk[12], 0);
+    knxCapturePut32(&chunk[16], 2 + KNX_BUS_MAX_TELEGRAM);
+    knxCapturePut32(&chunk[20], KNX_CAPTURE_PCAP_LINKTYPE);
+    chunkLength = KNX_CAPTURE_PCAP_HEADER;
+  }
+
+  KnxBusEvent event;
+  while (download.remaining && chunkLength + KNX_CAPTURE_PCAP_RECORD + 2 + KNX_BUS_MAX_TELEGRAM <= sizeof(chunk)) {
+    uint64_t time = knxCaptureReadRecord(&download, &event);
+    char *record = &chunk[chunkLength];
+    uint8_t typeLength = event.dpt ? 2 : 1;
+    knxCapturePut32(&record[0], time / 1000000);
+    knxCapturePut32(&record[4], time % 1000000);
+    knxCapturePut32(&record[8], typeLength + event.telegram.length);
+    knxCapturePut32(&record[12], typeLength + event.telegram.length);
+    record[KNX_CAPTURE_PCAP_RECORD] = event.dpt ? event.type | KNX_CAPTURE_PCAP_DPT : event.type;
+    if (event.dpt) {
+      record[KNX_CAPTURE_PCAP_RECORD + 1] = event.dpt;
+    }
+    memcpy(&record[KNX_CAPTURE_PCAP_RECORD + typeLength], event.telegram.data, event.telegram.length);
+    chunkLength += KNX_CAPTURE_PCAP_RECORD + typeLength + event.telegram.length;
+  }
+
+  // Done, records are free to be overwritten again
+  if (download.remaining == 0) {
+    download.active = false;
+  }
+
+  if (chunkLength == 0) {
+    return NULL;
+  }
+
+  *length = chunkLength;
+  return chunk;
+}
+
+static void knxCaptureReplayFinish(void) {
+  replay.active = false;
+  LOG_INFO("replay: %u events, %u us in handler\n", replayCount, replayBusyUs);
+}
+
+/**
+ * @brief Hand due events to the handler, then sleep until the next one
+ * 
+ * @param arg unused
+ */
+static void knxCaptureReplayStep(void *arg) {
+  (void)arg;
+  KnxBusEvent event;
+
+  for (uint8_t i = 0; i < KNX_CAPTURE_REPLAY_BATCH; i++) {
+    if (!replay.active) {
+      return;
+    }
+    if (replay.remaining == 0) {
+      knxCaptureReplayFinish();
+      return;
+    }
+
+    // Peek time of next record
+    KnxCaptureReader next = replay;
+    uint64_t time = knxCaptureReadRecord(&next, &event);
+    uint64_t due = replayStarted + (time - replayBase) / replaySpeed;
+    uint64_t now = time_us_64();
+    if (due > now) {
+      schedulerStartTimer(&replayTimer, (due - now + 999) / 1000, 0, knxCaptureReplayStep, NULL);
+      return;
+    }
+
+    replay = next;
+    event.timestamp = time_us_32();
+    replayHandler(&event, replayArg);
+    replayBusyUs += time_us_32() - event.timestamp;
+    replayCount++;
+  }
+
+  // Let Wi-Fi and lwIP run before the next batch
+  schedulerStartTimer(&replayTimer, 0, 0, knxCaptureReplayStep, NULL);
+}
+
+/**
+ * @brief Replay ring content through handler, recording is paused meanwhile
+ * 
+ * @param speed 1 = original timing, n = n times faster, 0 = stop running replay
+ * @param handler 
+ * @param arg 
+ * @return uint32_t number of events to be replayed
+ */
+uint32_t knxCaptureReplay(uint16_t speed, KnxCaptureReplayHandler handler, void *arg) {
+  if (replay.active) {
+    schedulerStopTimer(&replayTimer);
+    knxCaptureReplayFinish();
+  }
+
+  if (speed == 0 || records == 0) {
+    return 0;
+  }
+
+  knxCaptureOpenReader(&replay);
+  replayHandler = handler;
+  replayArg = arg;
+  replaySpeed = speed;
+  replayStarted = time_us_64();
+  replayBase = tailTime;
+  replayCount = 0;
+  replayBusyUs = 0;
+  knxCaptureReplayStep(NULL);
+  return records;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file KnxCapture.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Bus traffic recorder with pcap export and replay
+ * @version 0.1
+ * @date 2023-07-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Capture Description
+ * 
+ * Every bus engine event is kept in a RAM ring as a compact record:
+ *  -> Time since previous record in us (LEB128, usually 2-3 bytes)
+ *  -> Event type (2 bits) and telegram length (5 bits), top bit set
+ *     when a DPT byte follows
+ *  -> DPT our own telegram was queued with, if any
+ *  -> Telegram as seen on the TPUART, checksum included
+ * Oldest records are dropped to make room, so the ring always holds the
+ * most recent traffic.
+ * 
+ * Download expands it to pcap (LINKTYPE_USER0, microsecond timestamps
+ * since boot). Every packet starts with the KnxBusEventType byte followed
+ * by the telegram, type has bit 7 set and the DPT byte in between for
+ * tagged events. Records the download has not reached yet are never
+ * overwritten, frames which don't fit meanwhile are counted as dropped.
+ * 
+ * Replay feeds the recorded events back through the core0 event handler
+ * at original or multiplied speed. Recording is paused while replaying.
+ * 
+ * Core0 only.
+ */
+
+#ifndef KNX_CAPTURE_H
+#define KNX_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxBus.h"
+
+/* Has to be power of 2 */
+#ifndef KNX_CAPTURE_SIZE
+#define KNX_CAPTURE_SIZE 8192
+#endif
+
+/* Download which stalls longer than this stops protecting its records */
+#define KNX_CAPTURE_READ_TIMEOUT_US 10000000
+
+/* Replay yields to the rest of the system after this many events */
+#define KNX_CAPTURE_REPLAY_BATCH 16
+
+#define KNX_CAPTURE_PCAP_LINKTYPE 147  // LINKTYPE_USER0
+#define KNX_CAPTURE_PCAP_DPT 0x80      // type byte flag, DPT byte follows
+
+typedef void (*KnxCaptureReplayHandler)(const KnxBusEvent *event, void *arg);
+
+typedef struct {
+  uint32_t records;
+  uint32_t bytes;
+  uint32_t dropped;
+} KnxCaptureStats;
+
+/** === Recording === */
+void knxCaptureRecord(const KnxBusEvent *event);
+KnxCaptureStats knxCaptureStats(void);
+
+/** === pcap download === */
+int32_t knxCapturePcapOpen(void);
+const char *knxCapturePcapRead(uint32_t offset, uint16_t *length);
+
+/** === Replay === */
+uint32_t knxCaptureReplay(uint16_t speed, KnxCaptureReplayHandler handler, void *arg);
+
+#endif // KNX_CAPTURE_H
@@ -0,0 +1,847 @@
+/**
+ * @file KnxNetIp.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-21
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "lwip/udp.h"
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/igmp.h"
+#include "KnxNetIp.h"
+#include "KnxTelegram.h"
+#include "RateLimit.h"
+#include "Log.h"
+
+#define KNX_NET_IP_HEADER_SIZE 6
+#define KNX_NET_IP_HPAI_SIZE 8
+#define KNX_NET_IP_MAX_FRAME 96
+#define KNX_NET_IP_NAME_SIZE 30
+
+/* Connection types and layers */
+#define KNX_NET_IP_TUNNEL_CONNECTION 0x04
+#define KNX_NET_IP_TUNNEL_LINKLAYER 0x02
+
+typedef struct {
+  uint8_t length;
+  uint8_t cemi[KNX_BUS_MAX_TELEGRAM + KNX_CEMI_OVERHEAD];
+} KnxNetIpFrame;
+
+/* Sent to the bus engine, waiting for L_Data.con */
+typedef struct {
+  KnxBusTelegram telegrams[KNX_NET_IP_PENDING_LEN];
+  uint8_t count;
+} KnxNetIpPending;
+
+typedef struct {
+  uint8_t channel;  // 0 = free
+  uint16_t individualAddress;
+  ip_addr_t controlAddr;
+  uint16_t controlPort;
+  ip_addr_t dataAddr;
+  uint16_t dataPort;
+  uint8_t rxSequence;  // expected from client
+  uint8_t txSequence;  // of the frame at queue head
+  uint32_t lastAlive;
+  bool waitAck;
+  uint8_t retries;
+  uint32_t sentAt;
+  KnxNetIpFrame queue[KNX_NET_IP_QUEUE_LEN];
+  uint8_t queueHead;
+  uint8_t queueCount;
+  KnxNetIpPending pending;
+} KnxNetIpTunnel;
+
+typedef struct {
+  KnxNetIpFrame tx[KNX_NET_IP_ROUTING_QUEUE_LEN];  // bus -> multicast, held while others are busy
+  uint8_t txHead;
+  uint8_t txCount;
+  KnxBusTelegram rx[KNX_NET_IP_ROUTING_QUEUE_LEN];  // multicast -> bus, held by rate limit
+  uint8_t rxHead;
+  uint8_t rxCount;
+  KnxNetIpPending pending;
+  uint32_t busyUntil;
+  uint8_t busyCount;
+  uint32_t busySent;
+  uint16_t lost;
+} KnxNetIpRouter;
+
+static struct udp_pcb *knxNetIpPcb;
+static KnxNetIpTunnel tunnels[KNX_NET_IP_MAX_TUNNELS];
+static KnxNetIpRouter router;
+static ip_addr_t routingGroup;
+static uint16_t deviceAddress;
+static char deviceName[KNX_NET_IP_NAME_SIZE];
+static uint8_t lastChannel = 0;
+static ip4_addr_t localAddr;
+static uint8_t macAddr[6];
+
+static uint8_t rxBuffer[KNX_NET_IP_MAX_FRAME];
+// Replies are sent by reference, lwIP copies them if it has to queue
+static uint8_t txBuffer[KNX_NET_IP_MAX_FRAME] __attribute__((aligned(4)));
+
+static uint32_t knxNetIpNow(void) {
+  return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * @brief Write KNXnet/IP header
+ * 
+ * @param buffer 
+ * @param service 
+ * @param length of the whole datagram
+ */
+static void knxNetIpHeader(uint8_t *buffer, uint16_t service, uint16_t length) {
+  buffer[0] = KNX_NET_IP_HEADER_SIZE;
+  buffer[1] = 0x10;  // protocol version 1.0
+  buffer[2] = service >> 8;
+  buffer[3] = service & 0xFF;
+  buffer[4] = length >> 8;
+  buffer[5] = length & 0xFF;
+}
+
+/**
+ * @brief Send datagram prepared in txBuffer
+ * 
+ * @param length 
+ * @param addr 
+ * @param port 
+ */
+static void knxNetIpSend(uint16_t length, const ip_addr_t *addr, uint16_t port) {
+  struct pbuf *p = pbuf_alloc_reference(txBuffer, length, PBUF_REF);
+  if (!p) {
+    return;
+  }
+
+  err_t err = udp_sendto(knxNetIpPcb, p, addr, port);
+  pbuf_free(p);
+  if (err != ERR_OK) {
+    LOG_DEBUG("knxnet/ip send failed %d\n", err);
+  }
+}
+
+/**
+ * @brief Write our endpoint as host protocol address information
+ * 
+ * @param hpai 
+ */
+static void knxNetIpWriteHpai(uint8_t *hpai) {
+  hpai[0] = KNX_NET_IP_HPAI_SIZE;
+  hpai[1] = 0x01;  // IPv4 UDP
+  memcpy(&hpai[2], &ip4_addr_get_u32(&localAddr), 4);
+  hpai[6] = KNX_NET_IP_PORT >> 8;
+  hpai[7] = KNX_NET_IP_PORT & 0xFF;
+}
+
+/**
+ * @brief Read client endpoint, empty one means reply to the sender (NAT mode)
+ * 
+ * @param hpai 
+ * @param srcAddr 
+ * @param srcPort 
+ * @param addr 
+ * @param port 
+ */
+static void knxNetIpReadHpai(const uint8_t *hpai, const ip_addr_t *srcAddr, uint16_t srcPort, ip_addr_t *addr, uint16_t *port) {
+  uint32_t ip;
+  memcpy(&ip, &hpai[2], 4);
+  *port = hpai[6] << 8 | hpai[7];
+
+  if (ip == 0 || *port == 0) {
+    ip_addr_copy(*addr, *srcAddr);
+    *port = srcPort;
+  } else {
+    ip_addr_set_ip4_u32(addr, ip);
+  }
+}
+
+/**
+ * @brief Write device information and supported service families
+ * 
+ * @param buffer 
+ * @return uint16_t written length
+ */
+static uint16_t knxNetIpWriteDibs(uint8_t *buffer) {
+  uint8_t *device = buffer;
+  memset(device, 0, 54);
+  device[0] = 54;
+  device[1] = 0x01;  // device info
+  device[2] = 0x02;  // TP1
+  device[4] = deviceAddress >> 8;
+  device[5] = deviceAddress & 0xFF;
+  memcpy(&device[8], macAddr, 6);  // serial number
+  device[14] = 224;  // routing multicast address
+  device[15] = 0;
+  device[16] = 23;
+  device[17] = 12;
+  memcpy(&device[18], macAddr, 6);
+  memcpy(&device[24], deviceName, KNX_NET_IP_NAME_SIZE);
+
+  uint8_t *families = &buffer[54];
+  families[0] = 8;
+  families[1] = 0x02;  // supported service families
+  families[2] = 0x02;  // core
+  families[3] = 1;
+  families[4] = 0x04;  // tunneling
+  families[5] = 1;
+  families[6] = 0x05;  // routing
+  families[7] = 1;
+  return 54 + 8;
+}
+
+static KnxNetIpTunnel *knxNetIpFindTunnel(uint8_t channel) {
+  for (int i = 0; i < KNX_NET_IP_MAX_TUNNELS; i++) {
+    if (channel && tunnels[i].channel == channel) {
+      return &tunnels[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Take free tunnel and give it unused channel id
+ * 
+ * @return KnxNetIpTunnel* NULL when all are connected
+ */
+static KnxNetIpTunnel *knxNetIpOpenTunnel(void) {
+  for (int i = 0; i < KNX_NET_IP_MAX_TUNNELS; i++) {
+    if (tunnels[i].channel == 0) {
+      KnxNetIpTunnel *tunnel = &tunnels[i];
+      memset(tunnel, 0, sizeof(KnxNetIpTunnel));
+      do {
+        lastChannel++;
+      } while (lastChannel == 0 || knxNetIpFindTunnel(lastChannel));
+      tunnel->channel = lastChannel;
+      tunnel->individualAddress = deviceAddress + 1 + i;
+      tunnel->lastAlive = knxNetIpNow();
+      return tunnel;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Send frame at queue head to the client
+ * 
+ * @param tunnel 
+ */
+static void knxNetIpSendFrame(KnxNetIpTunnel *tunnel) {
+  KnxNetIpFrame *frame = &tunnel->queue[tunnel->queueHead];
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 4 + frame->length;
+
+  knxNetIpHeader(txBuffer, KNX_NET_IP_TUNNELING_REQUEST, length);
+  txBuffer[6] = 4;
+  txBuffer[7] = tunnel->channel;
+  txBuffer[8] = tunnel->txSequence;
+  txBuffer[9] = 0;
+  memcpy(&txBuffer[10], frame->cemi, frame->length);
+  knxNetIpSend(length, &tunnel->dataAddr, tunnel->dataPort);
+
+  tunnel->waitAck = true;
+  tunnel->sentAt = knxNetIpNow();
+}
+
+/**
+ * @brief Queue cEMI frame for the client, sent right away when nothing waits for ack
+ * 
+ * @param tunnel 
+ * @param cemi 
+ * @param length 
+ */
+static void knxNetIpQueue(KnxNetIpTunnel *tunnel, const uint8_t *cemi, uint8_t length) {
+  if (tunnel->queueCount == KNX_NET_IP_QUEUE_LEN) {
+    LOG_WARN("tunnel %u queue full\n", tunnel->channel);
+    return;
+  }
+
+  KnxNetIpFrame *frame = &tunnel->queue[(tunnel->queueHead + tunnel->queueCount) % KNX_NET_IP_QUEUE_LEN];
+  frame->length = length;
+  memcpy(frame->cemi, cemi, length);
+  tunnel->queueCount++;
+
+  if (!tunnel->waitAck) {
+    tunnel->retries = 0;
+    knxNetIpSendFrame(tunnel);
+  }
+}
+
+/**
+ * @brief Client acked queue head, continue with next frame
+ * 
+ * @param tunnel 
+ */
+static void knxNetIpAcked(KnxNetIpTunnel *tunnel) {
+  tunnel->queueHead = (tunnel->queueHead + 1) % KNX_NET_IP_QUEUE_LEN;
+  tunnel->queueCount--;
+  tunnel->txSequence++;
+  tunnel->waitAck = false;
+
+  if (tunnel->queueCount) {
+    tunnel->retries = 0;
+    knxNetIpSendFrame(tunnel);
+  }
+}
+
+/**
+ * @brief Drop tunnel and tell the client
+ * 
+ * @param tunnel 
+ */
+static void knxNetIpDisconnect(KnxNetIpTunnel *tunnel) {
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 2 + KNX_NET_IP_HPAI_SIZE;
+  knxNetIpHeader(txBuffer, KNX_NET_IP_DISCONNECT_REQUEST, length);
+  txBuffer[6] = tunnel->channel;
+  txBuffer[7] = 0;
+  knxNetIpWriteHpai(&txBuffer[8]);
+  knxNetIpSend(length, &tunnel->controlAddr, tunnel->controlPort);
+
+  tunnel->channel = 0;
+}
+
+/**
+ * @brief Remember telegram handed to the bus engine
+ * 
+ * @param pending 
+ * @param telegram 
+ * @return false when list is full or bus engine did not take it
+ */
+static bool knxNetIpSendPending(KnxNetIpPending *pending, const KnxBusTelegram *telegram) {
+  if (pending->count == KNX_NET_IP_PENDING_LEN || !knxBusSend(telegram->data, telegram->length)) {
+    return false;
+  }
+
+  pending->telegrams[pending->count++] = *telegram;
+  return true;
+}
+
+/**
+ * @brief Remove request confirmed by bus engine from pending list
+ * Requests in front of it lost their confirmation and are dropped too
+ * @param pending 
+ * @param telegram 
+ * @return true when it was on the list
+ */
+static bool knxNetIpTakePending(KnxNetIpPending *pending, const KnxBusTelegram *telegram) {
+  for (int i = 0; i < pending->count; i++) {
+    KnxBusTelegram *sent = &pending->telegrams[i];
+    if (sent->length == telegram->length && memcmp(sent->data, telegram->data, telegram->length) == 0) {
+      pending->count -= i + 1;
+      memmove(pending->telegrams, &pending->telegrams[i + 1], pending->count * sizeof(KnxBusTelegram));
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Handle cEMI frame from client
+ * Only L_Data.req is supported, it goes to the bus engine
+ * @param tunnel 
+ * @param cemi 
+ * @param size 
+ */
+static void knxNetIpRequest(KnxNetIpTunnel *tunnel, const uint8_t *cemi, uint16_t size) {
+  if (size > KNX_BUS_MAX_TELEGRAM + KNX_CEMI_OVERHEAD || cemi[0] != KNX_CEMI_LDATA_REQ) {
+    return;
+  }
+
+  KnxBusTelegram telegram;
+  telegram.length = knxCreateTelegramFromCemi(cemi, size, telegram.data);
+  if (telegram.length == 0) {
+    LOG_WARN("tunnel %u unsupported frame\n", tunnel->channel);
+    return;
+  }
+
+  // Clients leave source empty, the tunnel address is filled in
+  if (telegram.data[1] == 0 && telegram.data[2] == 0) {
+    telegram.data[1] = tunnel->individualAddress >> 8;
+    telegram.data[2] = tunnel->individualAddress & 0xFF;
+    telegram.data[telegram.length - 1] = knxCalculateChecksum(telegram.data, telegram.length);
+  }
+
+  if (tunnel->pending.count < KNX_NET_IP_PENDING_LEN
+      && rateLimitBus(telegram.length, knxNetIpNow())
+      && knxNetIpSendPending(&tunnel->pending, &telegram)) {
+    return;
+  }
+
+  // Bus is saturated, client gets negative confirmation right away
+  KnxNetIpFrame frame;
+  frame.length = knxCreateCemiFromTelegram(telegram.data, telegram.length, KNX_CEMI_LDATA_CON, frame.cemi);
+  frame.cemi[2] |= KNX_CEMI_CTRL1_ERROR;
+  knxNetIpQueue(tunnel, frame.cemi, frame.length);
+}
+
+static void knxNetIpConnect(const uint8_t *request, uint16_t size, const ip_addr_t *addr, uint16_t port) {
+  // Control endpoint, data endpoint, connection request information
+  if (size < KNX_NET_IP_HEADER_SIZE + 2 * KNX_NET_IP_HPAI_SIZE + 4) {
+    return;
+  }
+
+  ip_addr_t controlAddr;
+  uint16_t controlPort;
+  knxNetIpReadHpai(&request[6], addr, port, &controlAddr, &controlPort);
+
+  const uint8_t *cri = &request[22];
+  KnxNetIpTunnel *tunnel = NULL;
+  uint8_t status = KNX_NET_IP_E_NO_ERROR;
+  if (cri[0] != 4 || cri[1] != KNX_NET_IP_TUNNEL_CONNECTION) {
+    status = KNX_NET_IP_E_CONNECTION_TYPE;
+  } else if (cri[2] != KNX_NET_IP_TUNNEL_LINKLAYER) {
+    status = KNX_NET_IP_E_TUNNELING_LAYER;
+  } else if (!(tunnel = knxNetIpOpenTunnel())) {
+    status = KNX_NET_IP_E_NO_MORE_CONNECTIONS;
+  }
+
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 2;
+  txBuffer[6] = tunnel ? tunnel->channel : 0;
+  txBuffer[7] = status;
+
+  if (tunnel) {
+    tunnel->controlAddr = controlAddr;
+    tunnel->controlPort = controlPort;
+    knxNetIpReadHpai(&request[14], addr, port, &tunnel->dataAddr, &tunnel->dataPort);
+
+    // Our data endpoint and connection response data with tunnel address
+    knxNetIpWriteHpai(&txBuffer[8]);
+    txBuffer[16] = 4;
+    txBuffer[17] = KNX_NET_IP_TUNNEL_CONNECTION;
+    txBuffer[18] = tunnel->individualAddress >> 8;
+    txBuffer[19] = tunnel->individualAddress & 0xFF;
+    length += KNX_NET_IP_HPAI_SIZE + 4;
+    LOG_INFO("tunnel %u connected\n", tunnel->channel);
+  }
+
+  knxNetIpHeader(txBuffer, KNX_NET_IP_CONNECT_RESPONSE, length);
+  knxNetIpSend(length, &controlAddr, controlPort);
+}
+
+/**
+ * @brief Answer heartbeat or disconnect, both carry channel and control endpoint
+ * 
+ * @param request 
+ * @param size 
+ * @param addr 
+ * @param port 
+ * @param response service
+ */
+static void knxNetIpConnectionState(const uint8_t *request, uint16_t size, const ip_addr_t *addr, uint16_t port, uint16_t response) {
+  if (size < KNX_NET_IP_HEADER_SIZE + 2 + KNX_NET_IP_HPAI_SIZE) {
+    return;
+  }
+
+  ip_addr_t controlAddr;
+  uint16_t controlPort;
+  knxNetIpReadHpai(&request[8], addr, port, &controlAddr, &controlPort);
+
+  KnxNetIpTunnel *tunnel = knxNetIpFindTunnel(request[6]);
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 2;
+  knxNetIpHeader(txBuffer, response, length);
+  txBuffer[6] = request[6];
+  txBuffer[7] = tunnel ? KNX_NET_IP_E_NO_ERROR : KNX_NET_IP_E_CONNECTION_ID;
+  knxNetIpSend(length, &controlAddr, controlPort);
+
+  if (!tunnel) {
+    return;
+  }
+
+  tunnel->lastAlive = knxNetIpNow();
+  if (response == KNX_NET_IP_DISCONNECT_RESPONSE) {
+    LOG_INFO("tunnel %u disconnected\n", tunnel->channel);
+    tunnel->channel = 0;
+  }
+}
+
+static void knxNetIpTunneling(const uint8_t *request, uint16_t size) {
+  // Connection header: length, channel, sequence, status
+  if (size < KNX_NET_IP_HEADER_SIZE + 4 + 2 || request[6] != 4) {
+    return;
+  }
+
+  KnxNetIpTunnel *tunnel = knxNetIpFindTunnel(request[7]);
+  uint8_t sequence = request[8];
+  if (!tunnel) {
+    return;
+  }
+
+  // Repeated request whose ack got lost is acked again but not sent twice
+  bool expected = sequence == tunnel->rxSequence;
+  if (!expected && sequence != (uint8_t)(tunnel->rxSequence - 1)) {
+    return;
+  }
+
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 4;
+  knxNetIpHeader(txBuffer, KNX_NET_IP_TUNNELING_ACK, length);
+  txBuffer[6] = 4;
+  txBuffer[7] = tunnel->channel;
+  txBuffer[8] = sequence;
+  txBuffer[9] = KNX_NET_IP_E_NO_ERROR;
+  knxNetIpSend(length, &tunnel->dataAddr, tunnel->dataPort);
+
+  tunnel->lastAlive = knxNetIpNow();
+  if (expected) {
+    tunnel->rxSequence++;
+    knxNetIpRequest(tunnel, &request[10], size - 10);
+  }
+}
+
+static void knxNetIpTunnelingAck(const uint8_t *request, uint16_t size) {
+  if (size < KNX_NET_IP_HEADER_SIZE + 4) {
+    return;
+  }
+
+  KnxNetIpTunnel *tunnel = knxNetIpFindTunnel(request[7]);
+  if (tunnel && tunnel->waitAck && request[8] == tunnel->txSequence) {
+    knxNetIpAcked(tunnel);
+  }
+}
+
+/**
+ * @brief Answer search or description request with device information
+ * 
+ * @param request 
+ * @param size 
+ * @param addr 
+ * @param port 
+ * @param response service
+ */
+static void knxNetIpDescribe(const uint8_t *request, uint16_t size, const ip_addr_t *addr, uint16_t port, uint16_t response) {
+  if (size < KNX_NET_IP_HEADER_SIZE + KNX_NET_IP_HPAI_SIZE) {
+    return;
+  }
+
+  ip_addr_t replyAddr;
+  uint16_t replyPort;
+  knxNetIpReadHpai(&request[6], addr, port, &replyAddr, &replyPort);
+
+  uint16_t length = KNX_NET_IP_HEADER_SIZE;
+  if (response == KNX_NET_IP_SEARCH_RESPONSE) {
+    knxNetIpWriteHpai(&txBuffer[length]);
+    length += KNX_NET_IP_HPAI_SIZE;
+  }
+  length += knxNetIpWriteDibs(&txBuffer[length]);
+
+  knxNetIpHeader(txBuffer, response, length);
+  knxNetIpSend(length, &replyAddr, replyPort);
+}
+
+/**
+ * @brief Multicast indications unless another router asked us to wait
+ * 
+ */
+static void knxNetIpRoutingSend(void) {
+  while (router.txCount && (int32_t)(knxNetIpNow() - router.busyUntil) >= 0) {
+    KnxNetIpFrame *frame = &router.tx[router.txHead];
+    uint16_t length = KNX_NET_IP_HEADER_SIZE + frame->length;
+    knxNetIpHeader(txBuffer, KNX_NET_IP_ROUTING_INDICATION, length);
+    memcpy(&txBuffer[KNX_NET_IP_HEADER_SIZE], frame->cemi, frame->length);
+    knxNetIpSend(length, &routingGroup, KNX_NET_IP_PORT);
+
+    router.txHead = (router.txHead + 1) % KNX_NET_IP_ROUTING_QUEUE_LEN;
+    router.txCount--;
+  }
+}
+
+/**
+ * @brief Ask other routers to slow down, at most once per wait time
+ * 
+ */
+static void knxNetIpRoutingBusy(void) {
+  uint32_t now = knxNetIpNow();
+  if (now - router.busySent < KNX_NET_IP_ROUTING_BUSY_WAIT_MS) {
+    return;
+  }
+  router.busySent = now;
+
+  uint16_t length = KNX_NET_IP_HEADER_SIZE + 6;
+  knxNetIpHeader(txBuffer, KNX_NET_IP_ROUTING_BUSY, length);
+  txBuffer[6] = 6;
+  txBuffer[7] = 0;  // device state
+  txBuffer[8] = KNX_NET_IP_ROUTING_BUSY_WAIT_MS >> 8;
+  txBuffer[9] = KNX_NET_IP_ROUTING_BUSY_WAIT_MS & 0xFF;
+  txBuffer[10] = 0;  // control field, everyone waits
+  txBuffer[11] = 0;
+  knxNetIpSend(length, &routingGroup, KNX_NET_IP_PORT);
+}
+
+/**
+ * @brief Move multicast frames to the bus engine as fast as TP1 takes them
+ * 
+ */
+static void knxNetIpRoutingInject(void) {
+  while (router.rxCount) {
+    KnxBusTelegram *telegram = &router.rx[router.rxHead];
+    if (router.pending.count == KNX_NET_IP_PENDING_LEN
+        || !rateLimitBus(telegram->length, knxNetIpNow())
+        || !knxNetIpSendPending(&router.pending, telegram)) {
+      return;
+    }
+
+    router.rxHead = (router.rxHead + 1) % KNX_NET_IP_ROUTING_QUEUE_LEN;
+    router.rxCount--;
+  }
+}
+
+static void knxNetIpRoutingIndication(const uint8_t *request, uint16_t size) {
+  const uint8_t *cemi = &request[KNX_NET_IP_HEADER_SIZE];
+  uint16_t cemiSize = size - KNX_NET_IP_HEADER_SIZE;
+  if (cemiSize > KNX_BUS_MAX_TELEGRAM + KNX_CEMI_OVERHEAD || cemi[0] != KNX_CEMI_LDATA_IND) {
+    return;
+  }
+
+  if (router.rxCount == KNX_NET_IP_ROUTING_QUEUE_LEN) {
+    router.lost++;
+    knxNetIpRoutingBusy();
+    return;
+  }
+
+  KnxBusTelegram *telegram = &router.rx[(router.rxHead + router.rxCount) % KNX_NET_IP_ROUTING_QUEUE_LEN];
+  telegram->length = knxCreateTelegramFromCemi(cemi, cemiSize, telegram->data);
+  if (telegram->length == 0) {
+    return;
+  }
+  router.rxCount++;
+
+  knxNetIpRoutingInject();
+
+  // Half full queue means TP1 can't keep up with the senders
+  if (router.rxCount >= KNX_NET_IP_ROUTING_QUEUE_LEN / 2) {
+    knxNetIpRoutingBusy();
+  }
+}
+
+/**
+ * @brief Other router is overloaded, hold our indications
+ * Random extra wait grows with repeated busy messages so routers don't restart together
+ * @param request 
+ * @param size 
+ */
+static void knxNetIpRoutingBusyReceived(const uint8_t *request, uint16_t size) {
+  if (size < KNX_NET_IP_HEADER_SIZE + 6) {
+    return;
+  }
+
+  uint16_t waitMs = request[8] << 8 | request[9];
+  if (router.busyCount < 10) {
+    router.busyCount++;
+  }
+
+  uint32_t until = knxNetIpNow() + waitMs + rand() % (router.busyCount * 50);
+  if ((int32_t)(until - router.busyUntil) > 0) {
+    router.busyUntil = until;
+  }
+}
+
+static void knxNetIpRecv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  uint16_t size = p->tot_len;
+  if (size < KNX_NET_IP_HEADER_SIZE || size > sizeof(rxBuffer)) {
+    pbuf_free(p);
+    return;
+  }
+
+  pbuf_copy_partial(p, rxBuffer, size, 0);
+  pbuf_free(p);
+
+  if (rxBuffer[0] != KNX_NET_IP_HEADER_SIZE || rxBuffer[1] != 0x10 || (rxBuffer[4] << 8 | rxBuffer[5]) != size) {
+    return;
+  }
+
+  // Endpoint we tell clients about is the one they reached us on
+  struct netif *netif = ip_current_netif();
+  localAddr = *netif_ip4_addr(netif);
+  memcpy(macAddr, netif->hwaddr, sizeof(macAddr));
+
+  // Our own multicast coming back
+  if (ip4_addr_get_u32(ip_2_ip4(addr)) == ip4_addr_get_u32(&localAddr)) {
+    return;
+  }
+
+  uint16_t service = rxBuffer[2] << 8 | rxBuffer[3];
+  switch (service) {
+    case KNX_NET_IP_SEARCH_REQUEST:
+      knxNetIpDescribe(rxBuffer, size, addr, port, KNX_NET_IP_SEARCH_RESPONSE);
+      break;
+    case KNX_NET_IP_DESCRIPTION_REQUEST:
+      knxNetIpDescribe(rxBuffer, size, addr, port, KNX_NET_IP_DESCRIPTION_RESPONSE);
+      break;
+    case KNX_NET_IP_CONNECT_REQUEST:
+      knxNetIpConnect(rxBuffer, size, addr, port);
+      break;
+    case KNX_NET_IP_CONNECTIONSTATE_REQUEST:
+      knxNetIpConnectionState(rxBuffer, size, addr, port, KNX_NET_IP_CONNECTIONSTATE_RESPONSE);
+      break;
+    case KNX_NET_IP_DISCONNECT_REQUEST:
+      knxNetIpConnectionState(rxBuffer, size, addr, port, KNX_NET_IP_DISCONNECT_RESPONSE);
+      break;
+    case KNX_NET_IP_TUNNELING_REQUEST:
+      knxNetIpTunneling(rxBuffer, size);
+      break;
+    case KNX_NET_IP_TUNNELING_ACK:
+      knxNetIpTunnelingAck(rxBuffer, size);
+      break;
+    case KNX_NET_IP_ROUTING_INDICATION:
+      knxNetIpRoutingIndication(rxBuffer, size);
+      break;
+    case KNX_NET_IP_ROUTING_BUSY:
+      knxNetIpRoutingBusyReceived(rxBuffer, size);
+      break;
+    case KNX_NET_IP_ROUTING_LOST_MESSAGE:
+      LOG_WARN("knxnet/ip router lost messages\n");
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * @brief Start KNXnet/IP server, lwIP has to be up
+ * 
+ * @param individualAddress of the device, tunnels get the following ones
+ * @param name friendly name, up to 30 characters are shown
+ * @return true when listening
+ */
+bool knxNetIpInit(uint16_t individualAddress, const char *name) {
+  deviceAddress = individualAddress;
+  memset(deviceName, 0, sizeof(deviceName));
+  strncpy(deviceName, name, sizeof(deviceName) - 1);
+
+  knxNetIpPcb = udp_new();
+  if (!knxNetIpPcb) {
+    return false;
+  }
+
+  if (udp_bind(knxNetIpPcb, IP_ADDR_ANY, KNX_NET_IP_PORT) != ERR_OK) {
+    udp_remove(knxNetIpPcb);
+    knxNetIpPcb = NULL;
+    return false;
+  }
+
+  udp_recv(knxNetIpPcb, knxNetIpRecv, NULL);
+  udp_set_multicast_ttl(knxNetIpPcb, KNX_NET_IP_ROUTING_TTL);
+
+  // Routing works on every interface which does IGMP
+  IP4_ADDR(ip_2_ip4(&routingGroup), 224, 0, 23, 12);
+  if (igmp_joingroup(IP4_ADDR_ANY4, ip_2_ip4(&routingGroup)) != ERR_OK) {
+    LOG_WARN("knxnet/ip routing group not joined\n");
+  }
+  return true;
+}
+
+/**
+ * @brief Pass bus engine event to connected clients and routers
+ * Confirmation goes to the tunnel which requested the telegram,
+ * everyone else gets it as indication like any received telegram.
+ * Telegrams which came in by multicast are not sent back there
+ * @param event 
+ */
+void knxNetIpBusEvent(const KnxBusEvent *event) {
+  KnxNetIpFrame frame;
+  KnxNetIpTunnel *owner = NULL;
+  bool routed = false;
+
+  if (event->type != KNX_BUS_EVENT_RECEIVED) {
+    routed = knxNetIpTakePending(&router.pending, &event->telegram);
+    knxNetIpRoutingInject();
+  }
+
+  if (event->type != KNX_BUS_EVENT_RECEIVED && !routed) {
+    for (int i = 0; i < KNX_NET_IP_MAX_TUNNELS; i++) {
+      if (tunnels[i].channel && knxNetIpTakePending(&tunnels[i].pending, &event->telegram)) {
+        owner = &tunnels[i];
+        break;
+      }
+    }
+  }
+
+  if (owner) {
+    frame.length = knxCreateCemiFromTelegram(event->telegram.data, event->telegram.length, KNX_CEMI_LDATA_CON, frame.cemi);
+    if (frame.length) {
+      if (event->type == KNX_BUS_EVENT_FAILED) {
+        frame.cemi[2] |= KNX_CEMI_CTRL1_ERROR;
+      }
+      knxNetIpQueue(owner, frame.cemi, frame.length);
+    }
+  }
+
+  if (event->type == KNX_BUS_EVENT_FAILED) {
+    return;
+  }
+
+  frame.length = knxCreateCemiFromTelegram(event->telegram.data, event->telegram.length, KNX_CEMI_LDATA_IND, frame.cemi);
+  if (frame.length == 0) {
+    return;
+  }
+
+  for (int i = 0; i < KNX_NET_IP_MAX_TUNNELS; i++) {
+    if (tunnels[i].channel && &tunnels[i] != owner) {
+      knxNetIpQueue(&tunnels[i], frame.cemi, frame.length);
+    }
+  }
+
+  if (routed) {
+    return;
+  }
+
+  if (router.txCount == KNX_NET_IP_ROUTING_QUEUE_LEN) {
+    router.lost++;
+  } else {
+    router.tx[(router.txHead + router.txCount) % KNX_NET_IP_ROUTING_QUEUE_LEN] = frame;
+    router.txCount++;
+  }
+  knxNetIpRoutingSend();
+}
+
+/**
+ * @brief Repeat unacked frames, drop silent clients and resume routing
+ * Frame is repeated once, tunnel is closed when the repetition is not acked either
+ * @param arg unused
+ */
+void knxNetIpTick(void *arg) {
+  (void)arg;
+  uint32_t now = knxNetIpNow();
+
+  knxNetIpRoutingInject();
+  knxNetIpRoutingSend();
+  if (router.busyCount && (int32_t)(now - router.busyUntil) >= 0) {
+    router.busyCount--;
+  }
+
+  if (router.lost) {
+    uint16_t length = KNX_NET_IP_HEADER_SIZE + 4;
+    knxNetIpHeader(txBuffer, KNX_NET_IP_ROUTING_LOST_MESSAGE, length);
+    txBuffer[6] = 4;
+    txBuffer[7] = 0;  // device state
+    txBuffer[8] = router.lost >> 8;
+    txBuffer[9] = router.lost & 0xFF;
+    knxNetIpSend(length, &routingGroup, KNX_NET_IP_PORT);
+    LOG_WARN("knxnet/ip routing lost %u frames\n", router.lost);
+    router.lost = 0;
+  }
+
+  for (int i = 0; i < KNX_NET_IP_MAX_TUNNELS; i++) {
+    KnxNetIpTunnel *tunnel = &tunnels[i];
+    if (!tunnel->channel) {
+      continue;
+    }
+
+    if (now - tunnel->lastAlive > KNX_NET_IP_ALIVE_TIMEOUT_MS) {
+      LOG_WARN("tunnel %u timed out\n", tunnel->channel);
+      knxNetIpDisconnect(tunnel);
+    } else if (tunnel->waitAck && now - tunnel->sentAt >= KNX_NET_IP_ACK_TIMEOUT_MS) {
+      if (tunnel->retries++ == 0) {
+        knxNetIpSendFrame(tunnel);
+      } else {
+        LOG_WARN("tunnel %u not acked\n", tunnel->channel);
+        knxNetIpDisconnect(tunnel);
+      }
+    }
+  }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file KnxNetIp.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief KNXnet/IP tunneling server
+ * @version 0.1
+ * @date 2023-07-21
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNXnet/IP Description
+ * 
+ * Lets ETS, home servers and visualisations use the device as a bus
+ * interface. Frames travel as cEMI in UDP datagrams on port 3671:
+ *  -> SEARCH / DESCRIPTION: device and supported services
+ *  -> CONNECT / CONNECTIONSTATE / DISCONNECT: link layer tunnels
+ *  -> TUNNELING_REQUEST / ACK: one cEMI frame each, sequence numbered
+ *  -> ROUTING_INDICATION: every bus telegram multicast to 224.0.23.12
+ * 
+ * L_Data.req from a client goes to the bus engine, L_Data.con comes back
+ * once TPUART confirmed it. Received telegrams and our own confirmed ones
+ * are sent to every tunnel as L_Data.ind. Each direction is stop and wait,
+ * frames to a client are queued until the previous one was acked.
+ * 
+ * Multicast frames go to the bus no faster than the bus rate limit lets
+ * them. Once the queue is half full other routers get ROUTING_BUSY, our
+ * own indications are held while someone else is busy. Multicast costs
+ * the same no matter how many visualisations listen.
+ * 
+ * Runs on core0 from lwIP callbacks, bus events and a periodic tick.
+ */
+
+#ifndef KNX_NET_IP_H
+#define KNX_NET_IP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxBus.h"
+
+#define KNX_NET_IP_PORT 3671
+
+/* Tunnel n uses individual address first + n */
+#define KNX_NET_IP_MAX_TUNNELS 2
+
+/* Frames waiting for the client to ack, per tunnel */
+#define KNX_NET_IP_QUEUE_LEN 8
+
+/* Requests handed to the bus engine, waiting for L_Data.con, per tunnel */
+#define KNX_NET_IP_PENDING_LEN 4
+
+/* Frames per direction held by routing flow control */
+#define KNX_NET_IP_ROUTING_QUEUE_LEN 8
+#define KNX_NET_IP_ROUTING_BUSY_WAIT_MS 100
+#define KNX_NET_IP_ROUTING_TTL 16
+
+#define KNX_NET_IP_TICK_MS 250
+#define KNX_NET_IP_ACK_TIMEOUT_MS 1000
+#define KNX_NET_IP_ALIVE_TIMEOUT_MS 120000
+
+/* Services */
+#define KNX_NET_IP_SEARCH_REQUEST 0x0201
+#define KNX_NET_IP_SEARCH_RESPONSE 0x0202
+#define KNX_NET_IP_DESCRIPTION_REQUEST 0x0203
+#define KNX_NET_IP_DESCRIPTION_RESPONSE 0x0204
+#define KNX_NET_IP_CONNECT_REQUEST 0x0205
+#define KNX_NET_IP_CONNECT_RESPONSE 0x0206
+#define KNX_NET_IP_CONNECTIONSTATE_REQUEST 0x0207
+#define KNX_NET_IP_CONNECTIONSTATE_RESPONSE 0x0208
+#define KNX_NET_IP_DISCONNECT_REQUEST 0x0209
+#define KNX_NET_IP_DISCONNECT_RESPONSE 0x020A
+#define KNX_NET_IP_TUNNELING_REQUEST 0x0420
+#define KNX_NET_IP_TUNNELING_ACK 0x0421
+#define KNX_NET_IP_ROUTING_INDICATION 0x0530
+#define KNX_NET_IP_ROUTING_LOST_MESSAGE 0x0531
+#define KNX_NET_IP_ROUTING_BUSY 0x0532
+
+/* Status codes */
+#define KNX_NET_IP_E_NO_ERROR 0x00
+#define KNX_NET_IP_E_CONNECTION_ID 0x21
+#define KNX_NET_IP_E_CONNECTION_TYPE 0x22
+#define KNX_NET_IP_E_NO_MORE_CONNECTIONS 0x24
+#define KNX_NET_IP_E_TUNNELING_LAYER 0x29
+
+/** === KNXnet/IP === */
+bool knxNetIpInit(uint16_t individualAddress, const char *name);
+void knxNetIpBusEvent(const KnxBusEvent *event);
+void knxNetIpTick(void *arg);
+
+#endif // KNX_NET_IP_H
@@ -0,0 +1,136 @@
+/**
+ * @file KnxRamp.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-25
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "pico/stdlib.h"
+#include "KnxRamp.h"
+#include "KnxTelegram.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+typedef struct {
+  bool active;
+  bool stopping;     // released, stop not on the bus yet
+  uint16_t target;
+  uint8_t control;
+  uint32_t heldAt;   // ms, last start or refresh
+} KnxRamp;
+
+static KnxRamp ramps[KNX_RAMP_MAX];
+static KnxRampWrite rampWrite;
+static SchedulerTimer rampTimer;
+static bool rampTimerRunning = false;
+
+static uint32_t knxRampNow(void) {
+  return to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * @brief Send next step of every held ramp, stops of released ones
+ * Timer runs only while some ramp is active
+ * @param arg unused
+ */
+static void knxRampStep(void *arg) {
+  (void)arg;
+  uint32_t now = knxRampNow();
+  bool running = false;
+
+  for (uint8_t i = 0; i < KNX_RAMP_MAX; i++) {
+    KnxRamp *ramp = &ramps[i];
+    if (!ramp->active) {
+      continue;
+    }
+
+    if (!ramp->stopping && now - ramp->heldAt > KNX_RAMP_HOLD_TIMEOUT_MS) {
+      LOG_WARN("ramp %04x not held, stopping\n", ramp->target);
+      ramp->stopping = true;
+    }
+
+    if (ramp->stopping) {
+      ramp->active = !rampWrite(ramp->target, KNX_DPT_DIMMING_CONTROL, ramp->control & KNX_RAMP_UP);
+    } else {
+      // Skipped step is made up by holding a bit longer
+      rampWrite(ramp->target, KNX_DPT_DIMMING_CONTROL, ramp->control);
+    }
+    running |= ramp->active;
+  }
+
+  if (!running) {
+    schedulerStopTimer(&rampTimer);
+    rampTimerRunning = false;
+  }
+}
+
+static KnxRamp *knxRampFind(uint16_t target) {
+  KnxRamp *free = NULL;
+  for (uint8_t i = 0; i < KNX_RAMP_MAX; i++) {
+    if (ramps[i].active && ramps[i].target == target) {
+      return &ramps[i];
+    }
+    if (!ramps[i].active && !free) {
+      free = &ramps[i];
+    }
+  }
+  return free;
+}
+
+/**
+ * @brief Set function used to put telegrams on the bus
+ * 
+ * @param write group value write, expected to rate limit
+ */
+void knxRampInit(KnxRampWrite write) {
+  rampWrite = write;
+}
+
+/**
+ * @brief Start, refresh or stop ramp on group address
+ * First step goes out at once, later ones on the step timer
+ * @param target 
+ * @param control DPT 3.007 value
+ * @return false when all ramps are taken or first step was not accepted
+ */
+bool knxRampControl(uint16_t target, uint8_t control) {
+  KnxRamp *ramp = knxRampFind(target);
+  if (!ramp) {
+    return false;
+  }
+
+  // Stop of a ramp which does not run still goes to the bus, it may be someone else's
+  if ((control & KNX_RAMP_STEP_MASK) == 0) {
+    if (!ramp->active) {
+      return rampWrite(target, KNX_DPT_DIMMING_CONTROL, control & KNX_RAMP_UP);
+    }
+    ramp->stopping = true;
+    ramp->active = !rampWrite(target, KNX_DPT_DIMMING_CONTROL, control & KNX_RAMP_UP);
+    return true;
+  }
+
+  bool refresh = ramp->active && !ramp->stopping && ramp->control == control;
+  ramp->heldAt = knxRampNow();
+  if (refresh) {
+    return true;
+  }
+
+  if (!rampWrite(target, KNX_DPT_DIMMING_CONTROL, control)) {
+    return false;
+  }
+
+  ramp->active = true;
+  ramp->stopping = false;
+  ramp->target = target;
+  ramp->control = control;
+
+  if (!rampTimerRunning) {
+    rampTimerRunning = true;
+    schedulerStartTimer(&rampTimer, KNX_RAMP_STEP_MS, KNX_RAMP_STEP_MS, knxRampStep, NULL);
+  }
+  return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file KnxRamp.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Hold to dim, relative dimming (DPT 3.007) ramps
+ * @version 0.1
+ * @date 2023-07-25
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Ramp Description
+ * 
+ * Control value is the DPT 3.007 nibble:
+ *  -> bit 3: direction, 1 = brighter
+ *  -> bits 2-0: step code, 0 = stop, n = 100% / 2^(n-1) per step
+ * 
+ * Client sends start with a step code while the button is held and
+ * repeats it to show it still is, stop (step code 0) once released. The
+ * device sends one step telegram every KNX_RAMP_STEP_MS meanwhile, so the
+ * bus sees the same few telegrams per second no matter how often clients
+ * refresh. Ramp without refresh for KNX_RAMP_HOLD_TIMEOUT_MS is stopped,
+ * a closed browser tab never leaves the light dimming.
+ * 
+ * Stop is retried every step until the bus takes it. Core0 only.
+ */
+
+#ifndef KNX_RAMP_H
+#define KNX_RAMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KNX_RAMP_MAX 4
+#define KNX_RAMP_STEP_MS 250
+#define KNX_RAMP_HOLD_TIMEOUT_MS 1000
+
+#define KNX_RAMP_UP 0x08
+#define KNX_RAMP_STEP_MASK 0x07
+
+typedef bool (*KnxRampWrite)(uint16_t target, uint8_t dpt, uint8_t value);
+
+/** === KNX Ramp === */
+void knxRampInit(KnxRampWrite write);
+bool knxRampControl(uint16_t target, uint8_t control);
+
+#endif // KNX_RAMP_H
@@ -0,0 +1,470 @@
+/**
+ * @file KnxRule.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-27
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "KnxRule.h"
+#include "KnxTelegram.h"
+#include "KnxCache.h"
+#include "KnxTimer.h"
+#include "Config.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#define KNX_RULE_FORMAT "%d/%d/%d,%3[a-z],%d,%d/%d/%d,%d,%d"
+#define KNX_RULE_FORWARD -1
+
+typedef struct {
+  uint16_t source;
+  uint16_t target;
+  uint16_t delay;     // s
+  int16_t value;      // KNX_RULE_FORWARD or 0-255
+  uint8_t op;         // KNX_RULE_OP_EQ - LT, END = any value
+  uint8_t constant;
+  bool used;
+} KnxRuleDefinition;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t checksum;
+  KnxRuleDefinition definitions[KNX_RULE_MAX];
+} KnxRuleStore;
+
+typedef struct {
+  uint16_t source;
+  uint16_t offset;
+} KnxRuleIndex;
+
+static const struct {
+  const char *name;
+  uint8_t op;
+} ruleOps[] = {
+  { "any", KNX_RULE_OP_END },
+  { "eq", KNX_RULE_OP_EQ },
+  { "ne", KNX_RULE_OP_NE },
+  { "gt", KNX_RULE_OP_GT },
+  { "lt", KNX_RULE_OP_LT },
+};
+
+static KnxRuleDefinition definitions[KNX_RULE_MAX];
+static uint16_t ruleCount = 0;
+
+/** === Compiled, only these are touched for bus events === */
+static uint8_t code[KNX_RULE_CODE_SIZE];
+static KnxRuleIndex sources[KNX_RULE_MAX];
+static uint16_t sourceCount = 0;
+
+static KnxRuleWrite ruleWrite;
+static KnxRuleAccept ruleAccept;
+static SchedulerTimer saveTimer;
+static KnxRuleStore store;
+
+/**
+ * @brief Binary search in the sorted index of sources
+ * 
+ * @param source 
+ * @return uint16_t position of source, sourceCount when it has no rules
+ */
+static uint16_t knxRuleFindSource(uint16_t source) {
+  uint16_t low = 0;
+  uint16_t high = sourceCount;
+  while (low < high) {
+    uint16_t middle = (low + high) / 2;
+    if (sources[middle].source < source) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low < sourceCount && sources[low].source == source ? low : sourceCount;
+}
+
+/**
+ * @brief Rebuild bytecode and index from definitions, rules of one source run in the order they were added
+ * Sources are acknowledged on the bus, new ones before the ones without rules are dropped
+ */
+static void knxRuleCompile(void) {
+  uint8_t order[KNX_RULE_MAX];
+  uint16_t previous[KNX_RULE_MAX];
+  uint16_t previousCount = sourceCount;
+  uint16_t count = 0;
+  uint16_t pc = 0;
+
+  for (uint16_t i = 0; i < sourceCount; i++) {
+    previous[i] = sources[i].source;
+  }
+
+  // Stable insertion sort by source
+  for (uint8_t i = 0; i < KNX_RULE_MAX; i++) {
+    if (!definitions[i].used) {
+      continue;
+    }
+    uint16_t j = count++;
+    while (j > 0 && definitions[order[j - 1]].source > definitions[i].source) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  sourceCount = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    const KnxRuleDefinition *rule = &definitions[order[i]];
+    if (sourceCount == 0 || sources[sourceCount - 1].source != rule->source) {
+      if (sourceCount) {
+        code[pc++] = KNX_RULE_OP_END;
+      }
+      sources[sourceCount].source = rule->source;
+      sources[sourceCount].offset = pc;
+      sourceCount++;
+    }
+
+    uint16_t header = pc;
+    code[pc++] = KNX_RULE_OP_RULE;
+    pc++;
+
+    if (rule->op != KNX_RULE_OP_END) {
+      code[pc++] = rule->op;
+      code[pc++] = rule->constant;
+    }
+
+    if (rule->delay) {
+      code[pc++] = KNX_RULE_OP_DELAY;
+      code[pc++] = rule->delay >> 8;
+      code[pc++] = rule->delay & 0xFF;
+    }
+
+    code[pc++] = rule->value == KNX_RULE_FORWARD ? KNX_RULE_OP_FORWARD : KNX_RULE_OP_WRITE;
+    code[pc++] = rule->target >> 8;
+    code[pc++] = rule->target & 0xFF;
+    if (rule->value != KNX_RULE_FORWARD) {
+      code[pc++] = rule->value;
+    }
+
+    code[header + 1] = pc - header - 2;
+  }
+  code[pc++] = KNX_RULE_OP_END;
+
+  for (uint16_t i = 0; i < sourceCount; i++) {
+    ruleAccept(sources[i].source, true);
+  }
+  for (uint16_t i = 0; i < previousCount; i++) {
+    if (knxRuleFindSource(previous[i]) == sourceCount) {
+      ruleAccept(previous[i], false);
+    }
+  }
+}
+
+static void knxRuleSave(void *arg) {
+  (void)arg;
+  store.magic = KNX_RULE_MAGIC;
+  store.version = KNX_RULE_VERSION;
+  store.count = 0;
+
+  // Kept at their index up to the last used one, ids stay valid across reboots
+  for (uint8_t i = 0; i < KNX_RULE_MAX; i++) {
+    store.definitions[i] = definitions[i];
+    if (definitions[i].used) {
+      store.count = i + 1;
+    }
+  }
+
+  store.checksum = configHash(store.definitions, store.count * sizeof(KnxRuleDefinition));
+  if (configSectorSave(CONFIG_SECTOR_RULES, &store, offsetof(KnxRuleStore, definitions) + store.count * sizeof(KnxRuleDefinition))) {
+    LOG_INFO("rules saved: %u\n", store.count);
+  }
+}
+
+static void knxRuleChanged(void) {
+  knxRuleCompile();
+  schedulerStartTimer(&saveTimer, CONFIG_SAVE_DELAY_MS, 0, knxRuleSave, NULL);
+}
+
+/**
+ * @brief Write now or through a timer, bus which is too busy right now gets it a second later
+ * 
+ * @param target 
+ * @param dpt 
+ * @param value 
+ * @param delay 
+ */
+static void knxRuleAction(uint16_t target, uint8_t dpt, uint8_t value, uint16_t delay) {
+  if (delay == 0 && ruleWrite(target, dpt, value)) {
+    return;
+  }
+
+  // Never restarts a staircase timer or another rule's write on the same target
+  if (knxTimerOnce(delay ? delay : 1, target, dpt, value) < 0) {
+    LOG_WARN("rule write to %04x dropped, no timer left\n", target);
+  }
+}
+
+/**
+ * @brief Run code of one source until its END
+ * 
+ * @param pc 
+ * @param groupValue 
+ */
+static void knxRuleRun(uint16_t pc, const KnxGroupValue *groupValue) {
+  uint16_t next = pc;
+  uint16_t delay = 0;
+
+  while (pc < sizeof(code)) {
+    const uint8_t *op = &code[pc];
+    bool pass;
+
+    switch (op[0]) {
+      case KNX_RULE_OP_RULE:
+        next = pc + 2 + op[1];
+        delay = 0;
+        pc += 2;
+        continue;
+
+      case KNX_RULE_OP_EQ:
+        pass = groupValue->value == op[1];
+        break;
+
+      case KNX_RULE_OP_NE:
+        pass = groupValue->value != op[1];
+        break;
+
+      case KNX_RULE_OP_GT:
+        pass = groupValue->value > op[1];
+        break;
+
+      case KNX_RULE_OP_LT:
+        pass = groupValue->value < op[1];
+        break;
+
+      case KNX_RULE_OP_DELAY:
+        delay = op[1] << 8 | op[2];
+        pc += 3;
+        continue;
+
+      case KNX_RULE_OP_WRITE:
+        knxRuleAction(op[1] << 8 | op[2], knxCacheDpt(op[1] << 8 | op[2], op[3]), op[3], delay);
+        pc += 4;
+        continue;
+
+      case KNX_RULE_OP_FORWARD:
+        knxRuleAction(op[1] << 8 | op[2], groupValue->dpt, groupValue->value, delay);
+        pc += 3;
+        continue;
+
+      default:
+        return;
+    }
+
+    pc = pass ? pc + 2 : next;
+  }
+}
+
+/**
+ * @brief Load rules from flash and compile them
+ * 
+ * @param write group value write, expected to rate limit
+ * @param accept acknowledge source on the bus or stop doing so
+ */
+void knxRuleInit(KnxRuleWrite write, KnxRuleAccept accept) {
+  ruleWrite = write;
+  ruleAccept = accept;
+
+  const KnxRuleStore *stored = configSectorData(CONFIG_SECTOR_RULES);
+  if (stored->magic == KNX_RULE_MAGIC && stored->version == KNX_RULE_VERSION && stored->count <= KNX_RULE_MAX
+      && stored->checksum == configHash(stored->definitions, stored->count * sizeof(KnxRuleDefinition))) {
+    memcpy(definitions, stored->definitions, stored->count * sizeof(KnxRuleDefinition));
+    for (uint16_t i = 0; i < stored->count; i++) {
+      ruleCount += definitions[i].used;
+    }
+    LOG_INFO("rules loaded: %u\n", ruleCount);
+  }
+
+  knxRuleCompile();
+}
+
+/**
+ * @brief Check whether a write to one group address leads through rules to a write to another one
+ * Every rule is followed at most once, so loops among the existing rules end the search too
+ * @param from 
+ * @param to 
+ * @return true when to is from itself or a target of a chain of rules starting at from
+ */
+static bool knxRuleReaches(uint16_t from, uint16_t to) {
+  uint16_t pending[KNX_RULE_MAX + 1];
+  bool followed[KNX_RULE_MAX] = { false };
+  uint16_t count = 0;
+
+  pending[count++] = from;
+  while (count) {
+    uint16_t address = pending[--count];
+    if (address == to) {
+      return true;
+    }
+
+    for (uint8_t i = 0; i < KNX_RULE_MAX; i++) {
+      if (definitions[i].used && !followed[i] && definitions[i].source == address) {
+        followed[i] = true;
+        pending[count++] = definitions[i].target;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Parse, add and compile rule
+ * 
+ * @param rule text as described in the header
+ * @return int32_t rule id, -1 when text is invalid, rule would close a loop or there is no room
+ */
+int32_t knxRuleAdd(const char *rule) {
+  int sourceMain, sourceMiddle, sourceSub, targetMain, targetMiddle, targetSub, constant, value, delay;
+  char name[4];
+  KnxRuleDefinition definition = { 0 };
+
+  if (sscanf(rule, KNX_RULE_FORMAT, &sourceMain, &sourceMiddle, &sourceSub, name, &constant,
+      &targetMain, &targetMiddle, &targetSub, &value, &delay) != 10) {
+    return -1;
+  }
+
+  definition.op = 0xFF;
+  for (uint8_t i = 0; i < sizeof(ruleOps) / sizeof(ruleOps[0]); i++) {
+    if (strcmp(name, ruleOps[i].name) == 0) {
+      definition.op = ruleOps[i].op;
+    }
+  }
+
+  KnxTargetGroupAddress source = { sourceMain, sourceMiddle, sourceSub };
+  KnxTargetGroupAddress target = { targetMain, targetMiddle, targetSub };
+  definition.source = knxTargetGroupAddressStructToField(source);
+  definition.target = knxTargetGroupAddressStructToField(target);
+  definition.constant = constant;
+  definition.value = value;
+  definition.delay = delay;
+  definition.used = true;
+
+  if (definition.op == 0xFF || constant < 0 || constant > 255 || value < KNX_RULE_FORWARD || value > 255
+      || delay < 0 || delay > UINT16_MAX) {
+    return -1;
+  }
+
+  // Our own confirmed writes run rules too, so a rule whose target leads back to its
+  // source, directly or through other rules, would keep the bus busy forever
+  if (knxRuleReaches(definition.target, definition.source)) {
+    return -1;
+  }
+
+  for (uint8_t i = 0; i < KNX_RULE_MAX; i++) {
+    if (!definitions[i].used) {
+      definitions[i] = definition;
+      ruleCount++;
+      knxRuleChanged();
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Remove rule and compile the rest
+ * 
+ * @param id 
+ * @return false when there is no such rule
+ */
+bool knxRuleRemove(uint16_t id) {
+  if (id >= KNX_RULE_MAX || !definitions[id].used) {
+    return false;
+  }
+
+  definitions[id].used = false;
+  ruleCount--;
+  knxRuleChanged();
+  return true;
+}
+
+/**
+ * @brief Number of rules
+ * 
+ * @return uint16_t 
+ */
+uint16_t knxRuleCount(void) {
+  return ruleCount;
+}
+
+/**
+ * @brief Format rule for the /rule listing, in the text it was added with, KNX_RULE_ROW_WIDTH characters
+ * 
+ * @param index n-th rule by id
+ * @param row 
+ * @return false when there are not that many
+ */
+bool knxRuleRow(uint16_t index, char *row) {
+  for (uint8_t i = 0; i < KNX_RULE_MAX; i++) {
+    if (!definitions[i].used || index--) {
+      continue;
+    }
+
+    const KnxRuleDefinition *rule = &definitions[i];
+    const char *name = "";
+    for (uint8_t j = 0; j < sizeof(ruleOps) / sizeof(ruleOps[0]); j++) {
+      if (ruleOps[j].op == rule->op) {
+        name = ruleOps[j].name;
+      }
+    }
+
+    char text[KNX_RULE_ROW_WIDTH];
+    KnxTargetGroupAddress source = knxDecodeTargetGroupAddressField(rule->source);
+    KnxTargetGroupAddress target = knxDecodeTargetGroupAddressField(rule->target);
+    snprintf(text, sizeof(text), "\"%u/%u/%u,%s,%u,%u/%u/%u,%d,%u\"", source.main, source.middle, source.sub, name,
+      rule->constant, target.main, target.middle, target.sub, rule->value, rule->delay);
+    snprintf(row, KNX_RULE_ROW_WIDTH + 1, "{\"id\":%2u,\"rule\":%-37s}", i, text);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Run rules of the group address a value was written to or reported on
+ * Responses we sent ourselves are skipped, a polling visualisation must not re-fire rules
+ * @param event live bus event
+ */
+void knxRuleBusEvent(const KnxBusEvent *event) {
+  KnxGroupValue groupValue;
+  if (sourceCount == 0 || event->type == KNX_BUS_EVENT_FAILED
+      || !knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue)
+      || groupValue.cmd == KNX_CMD_VALUE_READ || groupValue.dpt == KNX_DPT_DIMMING_CONTROL) {
+    return;
+  }
+
+  // Our own responses only repeat a cached value to whoever polled it, nothing happened
+  if (event->type == KNX_BUS_EVENT_CONFIRMED && groupValue.cmd == KNX_CMD_VALUE_RESPONSE) {
+    return;
+  }
+
+  uint16_t index = knxRuleFindSource(groupValue.target);
+  if (index < sourceCount) {
+    knxRuleRun(sources[index].offset, &groupValue);
+  }
+}
+
+/**
+ * @brief Check whether any rule runs on values of a group address
+ * 
+ * @param group 
+ * @return true when it is a source of a rule
+ */
+bool knxRuleSource(uint16_t group) {
+  return knxRuleFindSource(group) < sourceCount;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file KnxRule.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Local logic compiled to bytecode, run on received group values
+ * @version 0.1
+ * @date 2023-07-27
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Rule Description
+ * 
+ * Rule text: source,op,constant,target,value,delay
+ *  -> source / target: group address as main/middle/sub
+ *  -> op: any, eq, ne, gt, lt, value received on source is compared to constant
+ *  -> value: written to target with the DPT last seen on it, -1 forwards
+ *     the received one
+ *  -> delay: seconds, 0 writes at once, otherwise through a timer
+ * 
+ * "1/2/3,eq,1,1/2/4,0,2" writes 0 to 1/2/4 two seconds after 1/2/3 got 1,
+ * "1/2/5,gt,128,1/2/6,1,0" switches 1/2/6 on once dimmer goes above 128.
+ * 
+ * Rules are kept in flash as parsed fields under their id and compiled
+ * into one bytecode table grouped by source, with a sorted index of
+ * sources in front. A group value write or response from the live bus
+ * finds its code with a binary search and runs it right in the core0
+ * event handler. Replayed
+ * captures and our own read responses never run rules. Our own confirmed
+ * writes do, so a rule which would trigger itself again through a chain
+ * of rules is refused. Every source is acknowledged on the bus, the
+ * accept callback is told when one gains or loses its last rule. Core0 only.
+ * 
+ * Bytecode:
+ *  -> RULE n: rule starts, next one is n bytes after this header
+ *  -> EQ / NE / GT / LT k: rest of the rule is skipped unless value op k
+ *  -> DELAY hi lo: following write goes through a timer
+ *  -> WRITE hi lo v / FORWARD hi lo: group value write
+ *  -> END: no more rules for this source
+ */
+
+#ifndef KNX_RULE_H
+#define KNX_RULE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxBus.h"
+
+#define KNX_RULE_MAX 64
+
+/* Header, condition, delay and write of every rule plus end of every source */
+#define KNX_RULE_CODE_SIZE (KNX_RULE_MAX * 12)
+
+#define KNX_RULE_MAGIC 0x524E4B  // "KNR"
+#define KNX_RULE_VERSION 1
+
+/* {"id":63,"rule":"31/7/255,any,255,31/7/255,255,65535"} */
+#define KNX_RULE_ROW_WIDTH 54
+
+#define KNX_RULE_OP_END 0x00
+#define KNX_RULE_OP_RULE 0x01
+#define KNX_RULE_OP_EQ 0x02
+#define KNX_RULE_OP_NE 0x03
+#define KNX_RULE_OP_GT 0x04
+#define KNX_RULE_OP_LT 0x05
+#define KNX_RULE_OP_DELAY 0x06
+#define KNX_RULE_OP_WRITE 0x07
+#define KNX_RULE_OP_FORWARD 0x08
+
+typedef bool (*KnxRuleWrite)(uint16_t target, uint8_t dpt, uint8_t value);
+typedef void (*KnxRuleAccept)(uint16_t group, bool accept);
+
+/** === KNX Rule === */
+void knxRuleInit(KnxRuleWrite write, KnxRuleAccept accept);
+int32_t knxRuleAdd(const char *rule);
+bool knxRuleRemove(uint16_t id);
+uint16_t knxRuleCount(void);
+bool knxRuleRow(uint16_t index, char *row);
+void knxRuleBusEvent(const KnxBusEvent *event);
+bool knxRuleSource(uint16_t group);
+
+#endif // KNX_RULE_H
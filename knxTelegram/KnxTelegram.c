@@ -211,7 +211,7 @@ KnxTargetPhysicalAddress knxDecodeTargetPhysicalAddressField(uint16_t field) {
  */
 KnxTargetGroupAddress knxDecodeTargetGroupAddressField(uint16_t field) {
     KnxTargetGroupAddress target;
-    target.main = ((field & 0x7800) >> 11);
+    target.main = ((field & 0xF800) >> 11);
     target.middle = ((field & 0x0700) >> 8);
     target.sub = ((field & 0x00FF));
 
@@ -325,6 +325,30 @@ uint16_t knxCreateTargetGroupAddressFieldFromString(char* address) {
   return knxTargetGroupAddressStructToField(addressStruct);
 }
 
+/**
+ * @brief Check group address parts before they are ORed into one field
+ * 
+ * @param main 0 - 31
+ * @param middle 0 - 7
+ * @param sub 0 - 255
+ * @return false when a part would spill into another one
+ */
+bool knxTargetGroupAddressValid(int main, int middle, int sub) {
+  return main >= 0 && main <= 31 && middle >= 0 && middle <= 7 && sub >= 0 && sub <= 255;
+}
+
+/**
+ * @brief Check group address string in format "main.middle.sub"
+ * 
+ * @param address 
+ * @return false when it is malformed or out of range
+ */
+bool knxTargetGroupAddressStringValid(const char *address) {
+  int main, middle, sub;
+  char end;
+  return sscanf(address, "%d.%d.%d%c", &main, &middle, &sub, &end) == 3 && knxTargetGroupAddressValid(main, middle, sub);
+}
+
 void knxPrintTargetGroupAddress(KnxTargetGroupAddress address) {
   printf("Main: %d, Middle: %d, Sub: %d \n", address.main, address.middle, address.sub);
 }
@@ -439,6 +463,185 @@ uint32_t knxCreateDataDimmingField(uint8_t cmd, uint8_t value) {
   return field;
 }
 
+/**
+ * @brief Create group value read/write/response telegram
+ * Switch and dimming control values are packed into the command byte, dimming value gets its own byte
+ * @param telegram at least 10 bytes
+ * @param sourceAddress 
+ * @param groupValue 
+ * @return uint8_t telegram size
+ */
+uint8_t knxCreateGroupValueTelegram(uint8_t telegram[], uint16_t sourceAddress, KnxGroupValue groupValue) {
+  uint8_t byte5 = 0x00;
+  uint8_t size;
+  knxSetTargetAddressType(&byte5, true);
+  knxSetRoutingCounter(&byte5, 6);
+
+  telegram[0] = knxCreateControlField(false, "auto");
+  telegram[1] = (sourceAddress >> 8) & 0x00FF;
+  telegram[2] = (sourceAddress & 0x00FF);
+  telegram[3] = (groupValue.target >> 8) & 0x00FF;
+  telegram[4] = (groupValue.target) & 0x00FF;
+
+  if (groupValue.dpt == KNX_DPT_DIMMING && groupValue.cmd != KNX_CMD_VALUE_READ) {
+    uint32_t data = knxCreateDataDimmingField(groupValue.cmd, groupValue.value);
+    knxSetDataLength(&byte5, 2);
+    telegram[6] = (data >> 16) & 0x00FF;
+    telegram[7] = (data >> 8) & 0x00FF;
+    telegram[8] = data & 0x00FF;
+    size = 10;
+  } else {
+    uint16_t data = (groupValue.cmd << 6) | (groupValue.value & 0x3F);
+    knxSetDataLength(&byte5, 1);
+    telegram[6] = (data >> 8) & 0x00FF;
+    telegram[7] = data & 0x00FF;
+    size = 9;
+  }
+
+  telegram[5] = byte5;
+  telegram[size - 1] = knxCalculateChecksum(telegram, size);
+  return size;
+}
+
+/**
+ * @brief Decode group value read/write/response telegram
+ * Standard frames only, one byte payload is reported as switch or dimming control, one more byte as dimming
+ * @param telegram 
+ * @param size 
+ * @param dpt DPT our own telegram was queued with, 0 when it came from the bus
+ * @param groupValue 
+ * @return true when telegram carries a group value
+ */
+bool knxDecodeGroupValueTelegram(const uint8_t telegram[], uint8_t size, uint8_t dpt, KnxGroupValue *groupValue) {
+  if (size < 9 || (telegram[0] & TPUART_FRAME_MASK) != TPUART_FRAME_STANDARD) {
+    return false;
+  }
+
+  uint8_t length = knxGetDataLength(telegram[5]);
+  if (!knxGetTargetAddressType(telegram[5]) || size != length + 8) {
+    return false;
+  }
+
+  groupValue->cmd = ((telegram[6] & 0x03) << 2) | (telegram[7] >> 6);
+  if (groupValue->cmd > KNX_CMD_VALUE_WRITE) {
+    return false;
+  }
+
+  groupValue->target = telegram[3] << 8 | telegram[4];
+  if (length == 1) {
+    groupValue->value = telegram[7] & 0x3F;
+    if (dpt == KNX_DPT_SWITCH || dpt == KNX_DPT_DIMMING_CONTROL) {
+      groupValue->dpt = dpt;
+    } else {
+      // Wire format is the same, down stop and down step 1 of others look like a switch
+      groupValue->dpt = groupValue->value > 1 ? KNX_DPT_DIMMING_CONTROL : KNX_DPT_SWITCH;
+    }
+  } else if (length == 2) {
+    groupValue->dpt = KNX_DPT_DIMMING;
+    groupValue->value = telegram[8];
+  } else {
+    // Floats, counters and other longer types are not decoded (yet)
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Create telegram to individual address, used by the transport layer
+ * Transport control goes first in tpdu, application control and data follow it
+ * @param telegram at least 7 + length bytes
+ * @param sourceAddress 
+ * @param targetAddress 
+ * @param tpdu 
+ * @param length 1 - KNX_TPDU_MAX
+ * @return uint8_t telegram size, 0 when tpdu does not fit standard frame
+ */
+uint8_t knxCreateIndividualTelegram(uint8_t telegram[], uint16_t sourceAddress, uint16_t targetAddress, const uint8_t tpdu[], uint8_t length) {
+  uint8_t byte5 = 0x00;
+  if (length == 0 || length > KNX_TPDU_MAX) {
+    return 0;
+  }
+
+  knxSetTargetAddressType(&byte5, false);
+  knxSetRoutingCounter(&byte5, 6);
+  knxSetDataLength(&byte5, length - 1);
+
+  telegram[0] = knxCreateControlField(false, "auto");
+  telegram[1] = (sourceAddress >> 8) & 0x00FF;
+  telegram[2] = (sourceAddress & 0x00FF);
+  telegram[3] = (targetAddress >> 8) & 0x00FF;
+  telegram[4] = (targetAddress) & 0x00FF;
+  telegram[5] = byte5;
+  memcpy(&telegram[6], tpdu, length);
+  telegram[6 + length] = knxCalculateChecksum(telegram, 7 + length);
+  return 7 + length;
+}
+
+/**
+ * @brief Convert cEMI L_Data frame to TP1 telegram
+ * Additional info is skipped, only standard frames fit TP1 standard format
+ * @param cemi 
+ * @param size 
+ * @param telegram at least size bytes
+ * @return uint8_t telegram size with checksum, 0 when frame can't be sent
+ */
+uint8_t knxCreateTelegramFromCemi(const uint8_t cemi[], uint8_t size, uint8_t telegram[]) {
+  if (size < 2) {
+    return 0;
+  }
+
+  // Message code, additional info length and additional info
+  uint8_t start = 2 + cemi[1];
+  if (size < start + 8) {
+    return 0;
+  }
+
+  const uint8_t *frame = &cemi[start];
+  uint8_t length = frame[6];
+  if (length > 15 || size != start + 8 + length || (frame[1] & 0x0F) != 0) {
+    return 0;
+  }
+
+  // Not repeated, priority from ctrl1; address type and hop count from ctrl2
+  telegram[0] = knxCreateControlField(false, "system") | (frame[0] & 0x0C);
+  memcpy(&telegram[1], &frame[2], 4);
+  telegram[5] = (frame[1] & 0xF0) | length;
+  memcpy(&telegram[6], &frame[7], length + 1);
+
+  uint8_t telegramSize = length + 8;
+  telegram[telegramSize - 1] = knxCalculateChecksum(telegram, telegramSize);
+  return telegramSize;
+}
+
+/**
+ * @brief Convert TP1 standard telegram to cEMI L_Data frame
+ * Caller sets KNX_CEMI_CTRL1_ERROR in cemi[2] for negative confirmations
+ * @param telegram with checksum
+ * @param size 
+ * @param messageCode 
+ * @param cemi at least size + KNX_CEMI_OVERHEAD bytes
+ * @return uint8_t cEMI size, 0 when telegram is not a standard frame
+ */
+uint8_t knxCreateCemiFromTelegram(const uint8_t telegram[], uint8_t size, uint8_t messageCode, uint8_t cemi[]) {
+  if (size < 8 || (telegram[0] & TPUART_FRAME_MASK) != TPUART_FRAME_STANDARD) {
+    return 0;
+  }
+
+  uint8_t length = knxGetDataLength(telegram[5]);
+  if (size != length + 8) {
+    return 0;
+  }
+
+  cemi[0] = messageCode;
+  cemi[1] = 0;
+  cemi[2] = telegram[0] & 0xBC;
+  cemi[3] = telegram[5] & 0xF0;
+  memcpy(&cemi[4], &telegram[1], 4);
+  cemi[8] = length;
+  memcpy(&cemi[9], &telegram[6], length + 1);
+  return size + KNX_CEMI_OVERHEAD;
+}
+
 uint8_t knxCalculateChecksum(uint8_t telegram[], uint8_t size)
 {
   uint8_t indexChecksum, xorSum = 0;  
@@ -37,9 +37,43 @@
 #define KNX_CMD_VALUE_WRITE 0b00000010
 #define KNX_CMD_MEMORY_WRITE 0b00001010
 
+/* Transport layer control, first byte after the length field */
+#define KNX_TPCI_DATA_CONNECTED 0b01000000
+#define KNX_TPCI_CONNECT 0b10000000
+#define KNX_TPCI_DISCONNECT 0b10000001
+#define KNX_TPCI_ACK 0b11000010
+#define KNX_TPCI_NAK 0b11000011
+#define KNX_TPCI_SEQUENCE(seq) (((seq) & 0x0F) << 2)
+
+/* Transport control, application control and 14 data bytes fill a standard frame */
+#define KNX_TPDU_MAX 16
+
 /* Used for communication with TPUART chip */
 #define TPUART_DATA_START_CONTINUE 0B10000000
 #define TPUART_DATA_END 0B01000000
+#define TPUART_ACK_INFORMATION 0B00010000
+#define TPUART_ACK_ADDRESSED 0B00000001
+
+/* Services received from TPUART chip */
+#define TPUART_DATA_CON_POSITIVE 0B10001011
+#define TPUART_DATA_CON_NEGATIVE 0B00001011
+#define TPUART_FRAME_MASK 0B11010011
+#define TPUART_FRAME_STANDARD 0B10010000
+#define TPUART_FRAME_EXTENDED 0B00010000
+
+/* cEMI message codes, frames are carried this way over KNXnet/IP */
+#define KNX_CEMI_LDATA_REQ 0x11
+#define KNX_CEMI_LDATA_CON 0x2E
+#define KNX_CEMI_LDATA_IND 0x29
+#define KNX_CEMI_CTRL1_ERROR 0x01
+
+/* cEMI frame adds message code and additional info length to the TP1 frame */
+#define KNX_CEMI_OVERHEAD 2
+
+/* Datapoint types of group values */
+#define KNX_DPT_SWITCH 1
+#define KNX_DPT_DIMMING_CONTROL 3
+#define KNX_DPT_DIMMING 5
 
 typedef struct {
   uint8_t area;
@@ -64,6 +98,13 @@ typedef struct {
   char* priority;
 } KnxControl;
 
+typedef struct {
+  uint16_t target;
+  uint8_t cmd;
+  uint8_t dpt;
+  uint8_t value;
+} KnxGroupValue;
+
 /** === Control Field === */
 uint8_t knxCreateControlField(bool retransmission, char* priority);
 KnxControl knxDecodeControlField(uint8_t field);
@@ -89,6 +130,8 @@ uint16_t knxCreateTargetPhysicalAddressFieldFromString(char* address);
 KnxTargetGroupAddress knxCreateTargetGroupAddressStructFromString(char* address);
 uint16_t knxTargetGroupAddressStructToField(KnxTargetGroupAddress address);
 uint16_t knxCreateTargetGroupAddressFieldFromString(char* address);
+bool knxTargetGroupAddressValid(int main, int middle, int sub);
+bool knxTargetGroupAddressStringValid(const char *address);
 void knxPrintTargetGroupAddress(KnxTargetGroupAddress address);
 
 /** === Target address type*/
@@ -111,6 +154,17 @@ uint32_t knxCreateDataDimmingField(uint8_t cmd, uint8_t value);
 
 /** There will be more DPTs soon ... */
 
+/** === Group value telegram === */
+uint8_t knxCreateGroupValueTelegram(uint8_t telegram[], uint16_t sourceAddress, KnxGroupValue groupValue);
+bool knxDecodeGroupValueTelegram(const uint8_t telegram[], uint8_t size, uint8_t dpt, KnxGroupValue *groupValue);
+
+/** === Point to point telegram === */
+uint8_t knxCreateIndividualTelegram(uint8_t telegram[], uint16_t sourceAddress, uint16_t targetAddress, const uint8_t tpdu[], uint8_t length);
+
+/** === cEMI === */
+uint8_t knxCreateTelegramFromCemi(const uint8_t cemi[], uint8_t size, uint8_t telegram[]);
+uint8_t knxCreateCemiFromTelegram(const uint8_t telegram[], uint8_t size, uint8_t messageCode, uint8_t cemi[]);
+
 /** === Checksum === */
 uint8_t knxCalculateChecksum(uint8_t telegram[], uint8_t size);
 
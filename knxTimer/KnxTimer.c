@@ -0,0 +1,449 @@
+/**
+ * @file KnxTimer.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "KnxTimer.h"
+#include "KnxTelegram.h"
+#include "Config.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#define KNX_TIMER_NONE 0xFFFF
+#define KNX_TIMER_SLOT_MASK (KNX_TIMER_WHEEL_SLOTS - 1)
+
+#define KNX_TIMER_USED 0x01
+#define KNX_TIMER_DAILY 0x02
+#define KNX_TIMER_ARMED 0x04
+#define KNX_TIMER_RESTART 0x08  // after timer, next one on the same group address replaces it
+
+_Static_assert(KNX_TIMER_MAX < KNX_TIMER_NONE, "KNX_TIMER_MAX has to fit into 16 bit index");
+_Static_assert(KNX_TIMER_WHEELS * KNX_TIMER_WHEEL_SLOTS <= 256, "Wheel slot has to fit into 8 bit index");
+
+typedef struct {
+  uint32_t expires;      // tick
+  uint32_t secondOfDay;  // daily only
+  uint16_t prev;
+  uint16_t next;         // also free list
+  uint16_t target;
+  uint8_t dpt;
+  uint8_t value;
+  uint8_t flags;
+  uint8_t slot;          // wheel * slots + slot, list head of an armed timer
+} KnxTimer;
+
+typedef struct {
+  uint32_t secondOfDay;
+  uint16_t target;
+  uint8_t dpt;
+  uint8_t value;
+  uint16_t id;           // loaded into the same slot, ids stay valid across reboots
+} KnxTimerRecord;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t checksum;
+  KnxTimerRecord records[KNX_TIMER_DAILY_MAX];
+} KnxTimerStore;
+
+static KnxTimer timers[KNX_TIMER_MAX];
+static uint16_t wheel[KNX_TIMER_WHEELS * KNX_TIMER_WHEEL_SLOTS];
+static uint16_t freeList;
+static uint32_t pendingCount = 0;
+static uint32_t dailyCount = 0;
+
+static uint32_t current = 0;  // last tick processed, seconds since init
+static uint64_t startUs;
+static bool clockSet = false;
+static uint32_t clockOffset;  // local seconds at tick 0
+
+static KnxTimerWrite timerWrite;
+static SchedulerTimer saveTimer;
+static KnxTimerStore store;
+
+/**
+ * @brief Wheel slot for expiry, lowest wheel which still tells it apart from now
+ * 
+ * @param expires 
+ * @return uint8_t 
+ */
+static uint8_t knxTimerSlotFor(uint32_t expires) {
+  uint8_t level = 0;
+  while (level < KNX_TIMER_WHEELS - 1
+      && (expires >> (KNX_TIMER_WHEEL_BITS * (level + 1))) != (current >> (KNX_TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  return level * KNX_TIMER_WHEEL_SLOTS + ((expires >> (KNX_TIMER_WHEEL_BITS * level)) & KNX_TIMER_SLOT_MASK);
+}
+
+static void knxTimerLink(uint16_t id) {
+  KnxTimer *timer = &timers[id];
+  timer->slot = knxTimerSlotFor(timer->expires);
+  timer->prev = KNX_TIMER_NONE;
+  timer->next = wheel[timer->slot];
+  if (timer->next != KNX_TIMER_NONE) {
+    timers[timer->next].prev = id;
+  }
+  wheel[timer->slot] = id;
+  timer->flags |= KNX_TIMER_ARMED;
+}
+
+static void knxTimerUnlink(uint16_t id) {
+  KnxTimer *timer = &timers[id];
+  if (timer->prev != KNX_TIMER_NONE) {
+    timers[timer->prev].next = timer->next;
+  } else {
+    wheel[timer->slot] = timer->next;
+  }
+  if (timer->next != KNX_TIMER_NONE) {
+    timers[timer->next].prev = timer->prev;
+  }
+  timer->flags &= ~KNX_TIMER_ARMED;
+}
+
+/**
+ * @brief Put daily timer at its next time of day, waits for the clock otherwise
+ * 
+ * @param id 
+ */
+static void knxTimerArmDaily(uint16_t id) {
+  KnxTimer *timer = &timers[id];
+  if (!clockSet) {
+    return;
+  }
+
+  uint32_t now = (current + clockOffset) % KNX_TIMER_DAY_SECONDS;
+  uint32_t delay = (timer->secondOfDay + KNX_TIMER_DAY_SECONDS - now) % KNX_TIMER_DAY_SECONDS;
+  timer->expires = current + (delay ? delay : KNX_TIMER_DAY_SECONDS);
+  knxTimerLink(id);
+}
+
+static int32_t knxTimerAlloc(uint16_t target, uint8_t dpt, uint8_t value) {
+  if (freeList == KNX_TIMER_NONE) {
+    return -1;
+  }
+
+  uint16_t id = freeList;
+  KnxTimer *timer = &timers[id];
+  freeList = timer->next;
+  timer->flags = KNX_TIMER_USED;
+  timer->target = target;
+  timer->dpt = dpt;
+  timer->value = value;
+  pendingCount++;
+  return id;
+}
+
+static void knxTimerFree(uint16_t id) {
+  timers[id].flags = 0;
+  timers[id].next = freeList;
+  freeList = id;
+  pendingCount--;
+}
+
+static void knxTimerSave(void *arg) {
+  (void)arg;
+  store.magic = KNX_TIMER_MAGIC;
+  store.version = KNX_TIMER_VERSION;
+  store.count = 0;
+
+  for (uint16_t i = 0; i < KNX_TIMER_MAX; i++) {
+    const KnxTimer *timer = &timers[i];
+    if (timer->flags & KNX_TIMER_DAILY) {
+      KnxTimerRecord *record = &store.records[store.count++];
+      record->secondOfDay = timer->secondOfDay;
+      record->target = timer->target;
+      record->dpt = timer->dpt;
+      record->value = timer->value;
+      record->id = i;
+    }
+  }
+
+  store.checksum = configHash(store.records, store.count * sizeof(KnxTimerRecord));
+  if (configSectorSave(CONFIG_SECTOR_TIMERS, &store, offsetof(KnxTimerStore, records) + store.count * sizeof(KnxTimerRecord))) {
+    LOG_INFO("timers saved: %u daily\n", store.count);
+  }
+}
+
+static void knxTimerSetDaily(uint16_t id, uint32_t secondOfDay) {
+  timers[id].flags |= KNX_TIMER_DAILY;
+  timers[id].secondOfDay = secondOfDay;
+  dailyCount++;
+  knxTimerArmDaily(id);
+}
+
+static int32_t knxTimerAddDaily(uint32_t secondOfDay, uint16_t target, uint8_t dpt, uint8_t value) {
+  if (secondOfDay >= KNX_TIMER_DAY_SECONDS || dailyCount >= KNX_TIMER_DAILY_MAX) {
+    return -1;
+  }
+
+  int32_t id = knxTimerAlloc(target, dpt, value);
+  if (id < 0) {
+    return -1;
+  }
+
+  knxTimerSetDaily(id, secondOfDay);
+  return id;
+}
+
+static void knxTimerFire(uint16_t id) {
+  KnxTimer *timer = &timers[id];
+  timer->flags &= ~KNX_TIMER_ARMED;
+
+  // Bus is saturated, try again next second
+  if (!timerWrite(timer->target, timer->dpt, timer->value)) {
+    timer->expires = current + 1;
+    knxTimerLink(id);
+    return;
+  }
+
+  if (timer->flags & KNX_TIMER_DAILY) {
+    knxTimerArmDaily(id);
+  } else {
+    knxTimerFree(id);
+  }
+}
+
+/**
+ * @brief Advance wheels by one second
+ * Wheels above move one slot down first, so timers due now are in the first wheel
+ */
+static void knxTimerAdvance(void) {
+  current++;
+
+  for (uint8_t level = KNX_TIMER_WHEELS - 1; level > 0; level--) {
+    if (current & ((1u << (KNX_TIMER_WHEEL_BITS * level)) - 1)) {
+      continue;
+    }
+
+    uint8_t slot = level * KNX_TIMER_WHEEL_SLOTS + ((current >> (KNX_TIMER_WHEEL_BITS * level)) & KNX_TIMER_SLOT_MASK);
+    uint16_t id = wheel[slot];
+    wheel[slot] = KNX_TIMER_NONE;
+    while (id != KNX_TIMER_NONE) {
+      uint16_t next = timers[id].next;
+      knxTimerLink(id);
+      id = next;
+    }
+  }
+
+  uint8_t slot = current & KNX_TIMER_SLOT_MASK;
+  uint16_t id = wheel[slot];
+  wheel[slot] = KNX_TIMER_NONE;
+  while (id != KNX_TIMER_NONE) {
+    uint16_t next = timers[id].next;
+    knxTimerFire(id);
+    id = next;
+  }
+}
+
+/**
+ * @brief Set up pool and load daily timers from flash
+ * 
+ * @param write group value write, expected to rate limit
+ */
+void knxTimerInit(KnxTimerWrite write) {
+  timerWrite = write;
+  startUs = time_us_64();
+  memset(wheel, 0xFF, sizeof(wheel));
+
+  const KnxTimerStore *stored = configSectorData(CONFIG_SECTOR_TIMERS);
+  if (stored->magic == KNX_TIMER_MAGIC && stored->version == KNX_TIMER_VERSION && stored->count <= KNX_TIMER_DAILY_MAX
+      && stored->checksum == configHash(stored->records, stored->count * sizeof(KnxTimerRecord))) {
+    for (uint16_t i = 0; i < stored->count; i++) {
+      const KnxTimerRecord *record = &stored->records[i];
+      if (record->id >= KNX_TIMER_MAX || timers[record->id].flags || record->secondOfDay >= KNX_TIMER_DAY_SECONDS) {
+        continue;
+      }
+
+      KnxTimer *timer = &timers[record->id];
+      timer->flags = KNX_TIMER_USED;
+      timer->target = record->target;
+      timer->dpt = record->dpt;
+      timer->value = record->value;
+      pendingCount++;
+      knxTimerSetDaily(record->id, record->secondOfDay);
+    }
+    LOG_INFO("timers loaded: %u daily\n", dailyCount);
+  }
+
+  // Free list around the loaded ones, low ids are handed out first
+  freeList = KNX_TIMER_NONE;
+  for (uint16_t i = KNX_TIMER_MAX; i-- > 0;) {
+    if (!timers[i].flags) {
+      timers[i].next = freeList;
+      freeList = i;
+    }
+  }
+}
+
+/**
+ * @brief Catch up with uptime, a late tick runs every second it missed
+ * 
+ * @param arg unused
+ */
+void knxTimerTick(void *arg) {
+  (void)arg;
+  uint32_t now = (time_us_64() - startUs) / 1000000;
+  while ((int32_t)(now - current) > 0) {
+    knxTimerAdvance();
+  }
+}
+
+/**
+ * @brief Set local time, daily timers are (re)armed from it
+ * 
+ * @param localSeconds seconds since epoch in local time, only time of day is used
+ */
+void knxTimerSetClock(uint32_t localSeconds) {
+  clockOffset = localSeconds - current;
+  clockSet = true;
+
+  for (uint16_t i = 0; i < KNX_TIMER_MAX; i++) {
+    if (!(timers[i].flags & KNX_TIMER_DAILY)) {
+      continue;
+    }
+    if (timers[i].flags & KNX_TIMER_ARMED) {
+      knxTimerUnlink(i);
+    }
+    knxTimerArmDaily(i);
+  }
+}
+
+/**
+ * @brief Write value once after delay, restarts pending after timer on the same group address
+ * 
+ * @param seconds up to ~194 days
+ * @param target 
+ * @param dpt 
+ * @param value 
+ * @return int32_t timer id, -1 when pool is full or delay too long
+ */
+int32_t knxTimerAfter(uint32_t seconds, uint16_t target, uint8_t dpt, uint8_t value) {
+  if (seconds > KNX_TIMER_MAX_SECONDS) {
+    return -1;
+  }
+
+  for (uint16_t i = 0; i < KNX_TIMER_MAX; i++) {
+    if ((timers[i].flags & KNX_TIMER_RESTART) && timers[i].target == target) {
+      knxTimerCancel(i);
+    }
+  }
+
+  int32_t id = knxTimerOnce(seconds, target, dpt, value);
+  if (id >= 0) {
+    timers[id].flags |= KNX_TIMER_RESTART;
+  }
+  return id;
+}
+
+/**
+ * @brief Write value once after delay, other timers on the same group address are left alone
+ * 
+ * @param seconds up to ~194 days
+ * @param target 
+ * @param dpt 
+ * @param value 
+ * @return int32_t timer id, -1 when pool is full or delay too long
+ */
+int32_t knxTimerOnce(uint32_t seconds, uint16_t target, uint8_t dpt, uint8_t value) {
+  if (seconds > KNX_TIMER_MAX_SECONDS) {
+    return -1;
+  }
+
+  int32_t id = knxTimerAlloc(target, dpt, value);
+  if (id < 0) {
+    return -1;
+  }
+
+  // Current second is already done
+  timers[id].expires = current + (seconds ? seconds : 1);
+  knxTimerLink(id);
+  return id;
+}
+
+/**
+ * @brief Write value every day at local time of day, kept in flash
+ * 
+ * @param secondOfDay 
+ * @param target 
+ * @param dpt 
+ * @param value 
+ * @return int32_t timer id, -1 when there is no room
+ */
+int32_t knxTimerDaily(uint32_t secondOfDay, uint16_t target, uint8_t dpt, uint8_t value) {
+  int32_t id = knxTimerAddDaily(secondOfDay, target, dpt, value);
+  if (id >= 0) {
+    schedulerStartTimer(&saveTimer, CONFIG_SAVE_DELAY_MS, 0, knxTimerSave, NULL);
+  }
+  return id;
+}
+
+/**
+ * @brief Remove pending timer
+ * 
+ * @param id 
+ * @return false when there is no such timer
+ */
+bool knxTimerCancel(uint16_t id) {
+  if (id >= KNX_TIMER_MAX || !(timers[id].flags & KNX_TIMER_USED)) {
+    return false;
+  }
+
+  if (timers[id].flags & KNX_TIMER_ARMED) {
+    knxTimerUnlink(id);
+  }
+
+  if (timers[id].flags & KNX_TIMER_DAILY) {
+    dailyCount--;
+    schedulerStartTimer(&saveTimer, CONFIG_SAVE_DELAY_MS, 0, knxTimerSave, NULL);
+  }
+
+  knxTimerFree(id);
+  return true;
+}
+
+/**
+ * @brief Timer counts
+ * 
+ * @return KnxTimerStats 
+ */
+KnxTimerStats knxTimerStats(void) {
+  KnxTimerStats stats = { pendingCount, dailyCount, clockSet };
+  return stats;
+}
+
+/**
+ * @brief Format daily timer for the /timer listing, KNX_TIMER_ROW_WIDTH characters
+ * 
+ * @param index n-th daily timer by id
+ * @param row 
+ * @return false when there are not that many
+ */
+bool knxTimerDailyRow(uint16_t index, char *row) {
+  for (uint16_t i = 0; i < KNX_TIMER_MAX; i++) {
+    if (!(timers[i].flags & KNX_TIMER_DAILY) || index--) {
+      continue;
+    }
+
+    char target[11];
+    KnxTargetGroupAddress address = knxDecodeTargetGroupAddressField(timers[i].target);
+    snprintf(target, sizeof(target), "\"%u/%u/%u\"", address.main, address.middle, address.sub);
+    snprintf(row, KNX_TIMER_ROW_WIDTH + 1, "{\"id\":%4u,\"time\":\"%02lu:%02lu\",\"target\":%-10s,\"dpt\":%u,\"value\":%3u}",
+      i, (unsigned long)(timers[i].secondOfDay / 3600), (unsigned long)(timers[i].secondOfDay / 60 % 60), target,
+      timers[i].dpt, timers[i].value);
+    return true;
+  }
+  return false;
+}
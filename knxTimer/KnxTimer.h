@@ -0,0 +1,80 @@
+/**
+ * @file KnxTimer.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Timed group writes on a hierarchical timer wheel
+ * @version 0.1
+ * @date 2023-07-26
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Timer Description
+ * 
+ * Timers:
+ *  -> After: one shot in n seconds, new one on the same group address
+ *     restarts it (staircase light)
+ *  -> Once: one shot in n seconds which never restarts or gets restarted,
+ *     rule actions and their retries
+ *  -> Daily: every day at local time of day, kept in flash under its id
+ * 
+ * Pending timers sit in 4 wheels of 64 slots, one second per slot of the
+ * first one, 64 times more per wheel above it (~194 days). A tick fires
+ * one slot and every 64th tick moves one slot of the wheel above down, so
+ * a tick costs the same with ten timers or a thousand. Timers are
+ * intrusive lists in a fixed pool, cancel is O(1) as well.
+ * 
+ * Device has no battery backed clock. Daily timers are loaded at boot but
+ * wait until a client sets the local time, after timers run on uptime.
+ * Write the bus did not take is retried on the next tick. Core0 only.
+ */
+
+#ifndef KNX_TIMER_H
+#define KNX_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef KNX_TIMER_MAX
+#define KNX_TIMER_MAX 1024
+#endif
+
+/* Daily timers kept in the flash sector */
+#define KNX_TIMER_DAILY_MAX 256
+
+#define KNX_TIMER_TICK_MS 1000
+#define KNX_TIMER_WHEEL_BITS 6
+#define KNX_TIMER_WHEEL_SLOTS (1 << KNX_TIMER_WHEEL_BITS)
+#define KNX_TIMER_WHEELS 4
+#define KNX_TIMER_MAX_SECONDS ((1u << (KNX_TIMER_WHEEL_BITS * KNX_TIMER_WHEELS)) - 1)
+
+#define KNX_TIMER_DAY_SECONDS 86400
+
+#define KNX_TIMER_MAGIC 0x544E4B  // "KNT"
+#define KNX_TIMER_VERSION 2
+
+/* {"id":1023,"time":"23:59","target":"31/7/255","dpt":5,"value":255} */
+#define KNX_TIMER_ROW_WIDTH 66
+
+typedef bool (*KnxTimerWrite)(uint16_t target, uint8_t dpt, uint8_t value);
+
+typedef struct {
+  uint32_t pending;
+  uint32_t daily;
+  bool clockSet;
+} KnxTimerStats;
+
+/** === KNX Timer === */
+void knxTimerInit(KnxTimerWrite write);
+void knxTimerTick(void *arg);
+void knxTimerSetClock(uint32_t localSeconds);
+
+int32_t knxTimerAfter(uint32_t seconds, uint16_t target, uint8_t dpt, uint8_t value);
+int32_t knxTimerOnce(uint32_t seconds, uint16_t target, uint8_t dpt, uint8_t value);
+int32_t knxTimerDaily(uint32_t secondOfDay, uint16_t target, uint8_t dpt, uint8_t value);
+bool knxTimerCancel(uint16_t id);
+KnxTimerStats knxTimerStats(void);
+bool knxTimerDailyRow(uint16_t index, char *row);
+
+#endif // KNX_TIMER_H
@@ -0,0 +1,201 @@
+/**
+ * @file KnxTransport.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-28
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include "KnxTransport.h"
+#include "KnxTelegram.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+static uint16_t ownAddress;
+static KnxTransportSend transportSend;
+static SchedulerTimer ackTimer;
+
+/** === Connection === */
+static bool active = false;
+static uint16_t peer;
+static uint8_t sequenceSend;
+static uint8_t sequenceReceive;
+static uint8_t repeats;
+static int8_t result = 0;
+
+/** === Block being written === */
+static uint8_t block[KNX_TRANSPORT_MAX_BLOCK];
+static uint16_t blockAddress;
+static uint16_t blockLength;
+static uint16_t written;
+static uint8_t chunk;
+
+static void knxTransportSendTpdu(const uint8_t tpdu[], uint8_t length) {
+  uint8_t telegram[KNX_BUS_MAX_TELEGRAM];
+  uint8_t size = knxCreateIndividualTelegram(telegram, ownAddress, peer, tpdu, length);
+
+  // Full command ring is handled like a lost frame, the ack timeout repeats it
+  if (!transportSend(telegram, size)) {
+    LOG_WARN("transport frame to %04x not queued\n", peer);
+  }
+}
+
+static void knxTransportTimeout(void *arg);
+
+/**
+ * @brief Send next part of the block, waits for its T_ACK
+ * 
+ */
+static void knxTransportSendChunk(void) {
+  uint8_t tpdu[KNX_TPDU_MAX];
+  uint16_t address = blockAddress + written;
+  chunk = blockLength - written < KNX_TRANSPORT_MEMORY_CHUNK ? blockLength - written : KNX_TRANSPORT_MEMORY_CHUNK;
+
+  tpdu[0] = KNX_TPCI_DATA_CONNECTED | KNX_TPCI_SEQUENCE(sequenceSend) | (KNX_CMD_MEMORY_WRITE >> 2);
+  tpdu[1] = (KNX_CMD_MEMORY_WRITE & 0x03) << 6 | chunk;
+  tpdu[2] = address >> 8;
+  tpdu[3] = address & 0xFF;
+  memcpy(&tpdu[4], &block[written], chunk);
+
+  knxTransportSendTpdu(tpdu, 4 + chunk);
+  schedulerStartTimer(&ackTimer, KNX_TRANSPORT_ACK_TIMEOUT_MS, 0, knxTransportTimeout, NULL);
+}
+
+/**
+ * @brief Close connection
+ * 
+ * @param ok 
+ * @param disconnect false when device already closed it
+ */
+static void knxTransportFinish(bool ok, bool disconnect) {
+  if (disconnect) {
+    uint8_t tpdu[] = { KNX_TPCI_DISCONNECT };
+    knxTransportSendTpdu(tpdu, sizeof(tpdu));
+  }
+
+  schedulerStopTimer(&ackTimer);
+  active = false;
+  result = ok ? 1 : -1;
+  LOG_INFO("memory write to %04x %s, %u of %u bytes\n", peer, ok ? "done" : "failed", written, blockLength);
+}
+
+static void knxTransportRepeat(void) {
+  if (repeats++ >= KNX_TRANSPORT_REPEATS) {
+    knxTransportFinish(false, true);
+    return;
+  }
+  knxTransportSendChunk();
+}
+
+static void knxTransportTimeout(void *arg) {
+  (void)arg;
+  if (active) {
+    knxTransportRepeat();
+  }
+}
+
+/**
+ * @brief Set our individual address and how frames get to the bus
+ * 
+ * @param individualAddress 
+ * @param send bus engine queue, connection paces itself so it is not rate limited
+ */
+void knxTransportInit(uint16_t individualAddress, KnxTransportSend send) {
+  ownAddress = individualAddress;
+  transportSend = send;
+}
+
+/**
+ * @brief Connect to device and write block to its memory
+ * Runs in the background, see knxTransportStatus
+ * @param destination individual address
+ * @param address memory address
+ * @param data copied
+ * @param length 
+ * @return false when a write is running or block is too big or runs past 0xFFFF
+ */
+bool knxTransportMemoryWrite(uint16_t destination, uint16_t address, const uint8_t data[], uint16_t length) {
+  if (active || length == 0 || length > KNX_TRANSPORT_MAX_BLOCK || (uint32_t)address + length > 0x10000) {
+    return false;
+  }
+
+  memcpy(block, data, length);
+  blockAddress = address;
+  blockLength = length;
+  written = 0;
+
+  peer = destination;
+  sequenceSend = 0;
+  sequenceReceive = 0;
+  repeats = 0;
+  result = 0;
+  active = true;
+
+  uint8_t tpdu[] = { KNX_TPCI_CONNECT };
+  knxTransportSendTpdu(tpdu, sizeof(tpdu));
+  knxTransportSendChunk();
+  return true;
+}
+
+/**
+ * @brief Handle frames of the connected device
+ * 
+ * @param event live bus event
+ */
+void knxTransportBusEvent(const KnxBusEvent *event) {
+  const uint8_t *telegram = event->telegram.data;
+  if (!active || event->type != KNX_BUS_EVENT_RECEIVED || event->telegram.length < 8
+      || (telegram[0] & TPUART_FRAME_MASK) != TPUART_FRAME_STANDARD || knxGetTargetAddressType(telegram[5])
+      || (telegram[1] << 8 | telegram[2]) != peer || (telegram[3] << 8 | telegram[4]) != ownAddress) {
+    return;
+  }
+
+  uint8_t tpci = telegram[6];
+  uint8_t sequence = (tpci >> 2) & 0x0F;
+
+  if (tpci == KNX_TPCI_DISCONNECT) {
+    knxTransportFinish(false, false);
+    return;
+  }
+
+  if ((tpci & 0xC3) == KNX_TPCI_ACK && sequence == sequenceSend) {
+    written += chunk;
+    sequenceSend = (sequenceSend + 1) & 0x0F;
+    repeats = 0;
+    if (written == blockLength) {
+      knxTransportFinish(true, true);
+    } else {
+      knxTransportSendChunk();
+    }
+    return;
+  }
+
+  if ((tpci & 0xC3) == KNX_TPCI_NAK && sequence == sequenceSend) {
+    knxTransportRepeat();
+    return;
+  }
+
+  // Repeated frame is acked again, it means our T_ACK got lost
+  if ((tpci & 0xC0) == KNX_TPCI_DATA_CONNECTED
+      && (sequence == sequenceReceive || sequence == ((sequenceReceive - 1) & 0x0F))) {
+    uint8_t tpdu[] = { KNX_TPCI_ACK | KNX_TPCI_SEQUENCE(sequence) };
+    knxTransportSendTpdu(tpdu, sizeof(tpdu));
+    if (sequence == sequenceReceive) {
+      sequenceReceive = (sequenceReceive + 1) & 0x0F;
+    }
+  }
+}
+
+/**
+ * @brief Progress of the last memory write
+ * 
+ * @return KnxTransportStatus 
+ */
+KnxTransportStatus knxTransportStatus(void) {
+  KnxTransportStatus status = { active, written, blockLength, result };
+  return status;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file KnxTransport.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Connection oriented transport, memory write to other devices
+ * @version 0.1
+ * @date 2023-07-28
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * KNX Transport Description
+ * 
+ * Client side of the point to point connection, one at a time:
+ *  -> T_Connect to the device
+ *  -> T_Data_Connected with A_Memory_Write of 12 bytes, sequence 0-15
+ *  -> T_ACK with the same sequence moves on to the next 12 bytes,
+ *     T_NAK or no answer within KNX_TRANSPORT_ACK_TIMEOUT_MS repeats it
+ *  -> T_Disconnect once the block is written or repeats ran out
+ * 
+ * Transport allows one unacknowledged frame per direction, so the next
+ * one is built and queued straight from the T_ACK, the connection never
+ * waits for a tick or for read back. Data the device sends us on the
+ * connection is acknowledged and dropped.
+ * 
+ * Bus engine frames are standard ones, 12 data bytes per write. Core0 only.
+ */
+
+#ifndef KNX_TRANSPORT_H
+#define KNX_TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxBus.h"
+
+#define KNX_TRANSPORT_MAX_BLOCK 1024
+#define KNX_TRANSPORT_ACK_TIMEOUT_MS 3000
+#define KNX_TRANSPORT_REPEATS 3
+
+/* Memory address takes 2 bytes of the tpdu after transport and application control */
+#define KNX_TRANSPORT_MEMORY_CHUNK (KNX_TPDU_MAX - 4)
+
+typedef bool (*KnxTransportSend)(const uint8_t telegram[], uint8_t size);
+
+typedef struct {
+  bool active;
+  uint16_t written;
+  uint16_t length;
+  int8_t result;  // 0 = none yet, 1 = written, -1 = failed
+} KnxTransportStatus;
+
+/** === KNX Transport === */
+void knxTransportInit(uint16_t individualAddress, KnxTransportSend send);
+bool knxTransportMemoryWrite(uint16_t destination, uint16_t address, const uint8_t data[], uint16_t length);
+void knxTransportBusEvent(const KnxBusEvent *event);
+KnxTransportStatus knxTransportStatus(void);
+
+#endif // KNX_TRANSPORT_H
@@ -0,0 +1,123 @@
+/**
+ * @file Log.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "Log.h"
+#include "KnxRing.h"
+
+typedef struct {
+  const char *fmt;
+  uint32_t timestamp;
+  uint32_t args[6];
+} LogEntry;
+
+static LogEntry entries[2][LOG_RING_SIZE];
+static KnxRing rings[2];
+static volatile uint32_t dropped = 0;
+
+/**
+ * @brief Set up rings of both cores, before anything logs
+ * 
+ */
+void logInit(void) {
+  for (uint8_t core = 0; core < 2; core++) {
+    knxRingInit(&rings[core], entries[core], sizeof(LogEntry), LOG_RING_SIZE);
+  }
+}
+
+/**
+ * @brief Store raw entry in ring of calling core
+ * Interrupts are masked for the push only, so IRQ handlers may log too
+ * @param fmt literal
+ * @param a 
+ * @param b 
+ * @param c 
+ * @param d 
+ * @param e 
+ * @param f 
+ */
+void logWrite(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f) {
+  LogEntry entry = { fmt, time_us_32(), { a, b, c, d, e, f } };
+
+  uint32_t irq = save_and_disable_interrupts();
+  bool pushed = knxRingPush(&rings[get_core_num()], &entry);
+  restore_interrupts(irq);
+
+  if (!pushed) {
+    dropped++;
+  }
+}
+
+#if LOG_BINARY
+/**
+ * @brief Write entry as raw frame, bypassing stdio CR/LF translation
+ * 
+ * @param core 
+ * @param entry 
+ */
+static void logPutFrame(uint8_t core, const LogEntry *entry) {
+  uint32_t words[8] = { LOG_ARG(entry->fmt), entry->timestamp };
+  memcpy(&words[2], entry->args, sizeof(entry->args));
+
+  putchar_raw(LOG_FRAME_SYNC0);
+  putchar_raw(LOG_FRAME_SYNC1);
+  putchar_raw(core);
+  for (uint8_t i = 0; i < 8; i++) {
+    for (uint8_t shift = 0; shift < 32; shift += 8) {
+      putchar_raw(words[i] >> shift);
+    }
+  }
+}
+#endif
+
+/**
+ * @brief Format pending entries, runs from scheduler on core0
+ * Core1 entries come out after core0 ones of the same flush
+ * @param arg 
+ */
+void logFlush(void *arg) {
+  static uint32_t lastDropped = 0;
+  LogEntry entry;
+  (void)arg;
+
+  for (uint8_t core = 0; core < 2; core++) {
+    while (knxRingPop(&rings[core], &entry)) {
+#if LOG_BINARY
+      logPutFrame(core, &entry);
+#else
+      printf("[%lu.%06lu] %u ", (unsigned long)(entry.timestamp / 1000000), (unsigned long)(entry.timestamp % 1000000), core);
+      printf(entry.fmt, entry.args[0], entry.args[1], entry.args[2], entry.args[3], entry.args[4], entry.args[5]);
+#endif
+    }
+  }
+
+  if (dropped != lastDropped) {
+#if LOG_BINARY
+    LogEntry report = { NULL, time_us_32(), { dropped - lastDropped } };
+    logPutFrame(0, &report);
+#else
+    printf("log entries dropped: %lu\n", (unsigned long)(dropped - lastDropped));
+#endif
+    lastDropped = dropped;
+  }
+}
+
+/**
+ * @brief Entries lost because ring was full
+ * 
+ * @return uint32_t 
+ */
+uint32_t logDropped(void) {
+  return dropped;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file Log.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Deferred logging
+ * @version 0.1
+ * @date 2023-07-18
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Log Description
+ * 
+ * Hot paths never call printf:
+ *  -> Levels above LOG_LEVEL are removed by the preprocessor
+ *  -> Entry is format pointer, timestamp and up to 6 raw 32 bit arguments
+ *  -> Each core writes its own lock-free ring, core0 formats entries later from logFlush
+ * 
+ * Format strings have to be literals. %s arguments have to point to
+ * static strings, the pointer is printed long after the call.
+ * 
+ * With LOG_BINARY logFlush doesn't format at all, entries go to stdio
+ * as raw frames and host/logDecode turns them into text using the
+ * firmware ELF for format and %s strings:
+ *  -> LOG_FRAME_SYNC0, LOG_FRAME_SYNC1, core
+ *  -> format address, timestamp, 6 arguments, 32 bit little endian each
+ * Format address 0 reports args[0] dropped entries. Anything between
+ * frames is passed through as text.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/* Entries per core, has to be power of 2 */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 32
+#endif
+
+#define LOG_FLUSH_MS 100
+
+#ifndef LOG_BINARY
+#define LOG_BINARY 0
+#endif
+
+#define LOG_FRAME_SYNC0 0xA5
+#define LOG_FRAME_SYNC1 0x5A
+#define LOG_FRAME_SIZE (3 + 8 * 4)
+
+#define LOG_ARG(x) ((uint32_t)(uintptr_t)(x))
+#define LOG_WRITE(fmt, a, b, c, d, e, f, ...) \
+  logWrite(fmt, LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d), LOG_ARG(e), LOG_ARG(f))
+
+/* Level letter is glued to the format, so entries don't need to store it */
+#define LOG_AT(prefix, ...) LOG_WRITE(prefix __VA_ARGS__, 0, 0, 0, 0, 0, 0, 0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT("E ", __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT("W ", __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT("I ", __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT("D ", __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+/** === Log === */
+void logInit(void);
+void logWrite(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, uint32_t f);
+void logFlush(void *arg);
+uint32_t logDropped(void);
+
+#endif // LOG_H
@@ -7,4 +7,51 @@
 // This example uses a common include to avoid repetition
 #include "lwipopts_examples_common.h"
 
+// KNXnet/IP routing listens on the 224.0.23.12 multicast group
+#undef LWIP_IGMP
+#define LWIP_IGMP                   1
+
+// MQTT bridge: batched state publishes wait in the client output ring,
+// its cyclic timer needs one more timeout
+#define MQTT_OUTPUT_RINGBUF_SIZE    1024
+#undef MEMP_NUM_SYS_TIMEOUT
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1)
+
+// Profile for many short HTTP control requests from a handful of phones.
+// Build with -DLWIPOPTS_PROFILE_CONTROL=0 to fall back to the example defaults
+#ifndef LWIPOPTS_PROFILE_CONTROL
+#define LWIPOPTS_PROFILE_CONTROL 1
+#endif
+
+#if LWIPOPTS_PROFILE_CONTROL
+
+// Full sized segments, a whole page goes out in one or two of them
+#undef TCP_MSS
+#define TCP_MSS                     1460
+
+// Responses are a few KB at most and requests fit into a single segment,
+// so small per connection windows leave room for more connections
+#undef TCP_SND_BUF
+#define TCP_SND_BUF                 (4 * TCP_MSS)
+#undef TCP_WND
+#define TCP_WND                     (2 * TCP_MSS)
+
+// Templates are queued in many small by-reference pieces
+#undef TCP_SND_QUEUELEN
+#define TCP_SND_QUEUELEN            24
+#undef MEMP_NUM_TCP_SEG
+#define MEMP_NUM_TCP_SEG            32
+#undef MEMP_NUM_PBUF
+#define MEMP_NUM_PBUF               32
+
+// Server closes first, so closed connections sit in TIME_WAIT for a while
+#undef MEMP_NUM_TCP_PCB
+#define MEMP_NUM_TCP_PCB            12
+
+// Incoming requests, DHCP and DNS queries are small
+#undef PBUF_POOL_SIZE
+#define PBUF_POOL_SIZE              16
+
+#endif // LWIPOPTS_PROFILE_CONTROL
+
 #endif
@@ -0,0 +1,215 @@
+/**
+ * @file MqttBridge.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "lwip/apps/mqtt.h"
+#include "MqttBridge.h"
+#include "KnxCache.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+static mqtt_client_t *mqttClient;
+static ip_addr_t mqttBroker;
+static MqttBridgeWrite mqttWrite;
+
+static SchedulerTimer flushTimer;
+static SchedulerTimer reconnectTimer;
+static bool flushArmed = false;
+
+static uint16_t dirty[MQTT_BRIDGE_MAX_DIRTY];
+static uint8_t dirtyCount = 0;
+static bool resync = false;
+static uint16_t resyncIndex = 0;
+
+/** === Incoming set publish, topic and payload arrive separately === */
+static int32_t setTarget = -1;
+static char setPayload[16];
+static uint8_t setPayloadLen = 0;
+
+static const struct mqtt_connect_client_info_t mqttClientInfo = {
+  .client_id = MQTT_BRIDGE_CLIENT_ID,
+  .keep_alive = MQTT_BRIDGE_KEEP_ALIVE_S,
+  .will_topic = MQTT_BRIDGE_STATUS_TOPIC,
+  .will_msg = "offline",
+  .will_qos = 0,
+  .will_retain = 1,
+};
+
+static void mqttBridgeConnect(void *arg);
+static void mqttBridgeFlush(void *arg);
+
+static void mqttBridgeArmFlush(void) {
+  if (!flushArmed) {
+    flushArmed = true;
+    schedulerStartTimer(&flushTimer, MQTT_BRIDGE_FLUSH_MS, 0, mqttBridgeFlush, NULL);
+  }
+}
+
+/**
+ * @brief Publish group value as retained state, QoS 0 so nothing waits for acks
+ * 
+ * @param groupValue 
+ * @return false when output ring is full
+ */
+static bool mqttBridgePublish(const KnxGroupValue *groupValue) {
+  char topic[32];
+  char payload[32];
+  KnxTargetGroupAddress target = knxDecodeTargetGroupAddressField(groupValue->target);
+  snprintf(topic, sizeof(topic), MQTT_BRIDGE_STATE_TOPIC, target.main, target.middle, target.sub);
+  int len = snprintf(payload, sizeof(payload), "{\"dpt\":%d,\"value\":%d}", groupValue->dpt, groupValue->value);
+
+  return mqtt_publish(mqttClient, topic, payload, len, 0, 1, NULL, NULL) == ERR_OK;
+}
+
+/**
+ * @brief Send everything marked since last flush
+ * Cache walk after (re)connect goes first, dirty addresses follow
+ * @param arg unused
+ */
+static void mqttBridgeFlush(void *arg) {
+  (void)arg;
+  KnxGroupValue groupValue;
+  flushArmed = false;
+
+  if (!mqtt_client_is_connected(mqttClient)) {
+    return;
+  }
+
+  for (; resync && resyncIndex < KNX_CACHE_SIZE; resyncIndex++) {
+    if (knxCacheAt(resyncIndex, &groupValue) && !mqttBridgePublish(&groupValue)) {
+      mqttBridgeArmFlush();
+      return;
+    }
+  }
+  resync = false;
+
+  while (dirtyCount) {
+    if (knxCacheGet(dirty[dirtyCount - 1], &groupValue) && !mqttBridgePublish(&groupValue)) {
+      mqttBridgeArmFlush();
+      return;
+    }
+    dirtyCount--;
+  }
+}
+
+static void mqttBridgeResync(void) {
+  resync = true;
+  resyncIndex = 0;
+  dirtyCount = 0;
+  mqttBridgeArmFlush();
+}
+
+static void mqttBridgeIncomingPublish(void *arg, const char *topic, u32_t totalLen) {
+  int main, middle, sub;
+  setPayloadLen = 0;
+  setTarget = -1;
+
+  if (sscanf(topic, MQTT_BRIDGE_SET_TOPIC, &main, &middle, &sub) == 3) {
+    KnxTargetGroupAddress address = { main, middle, sub };
+    setTarget = knxTargetGroupAddressStructToField(address);
+  }
+}
+
+static void mqttBridgeIncomingData(void *arg, const u8_t *data, u16_t len, u8_t flags) {
+  if (setTarget < 0) {
+    return;
+  }
+
+  uint8_t copy = sizeof(setPayload) - 1 - setPayloadLen;
+  if (len < copy) {
+    copy = len;
+  }
+  memcpy(&setPayload[setPayloadLen], data, copy);
+  setPayloadLen += copy;
+  if (!(flags & MQTT_DATA_FLAG_LAST)) {
+    return;
+  }
+
+  setPayload[setPayloadLen] = 0;
+  int value;
+  if (sscanf(setPayload, "%d", &value) != 1 || value < 0 || value > 255) {
+    return;
+  }
+
+  if (!mqttWrite(setTarget, knxCacheDpt(setTarget, value), value)) {
+    LOG_WARN("mqtt write to %04x dropped, bus busy\n", setTarget);
+  }
+  setTarget = -1;
+}
+
+static void mqttBridgeConnected(mqtt_client_t *client, void *arg, mqtt_connection_status_t status) {
+  if (status != MQTT_CONNECT_ACCEPTED) {
+    LOG_WARN("mqtt disconnected %d\n", status);
+    schedulerStartTimer(&reconnectTimer, MQTT_BRIDGE_RECONNECT_MS, 0, mqttBridgeConnect, NULL);
+    return;
+  }
+
+  LOG_INFO("mqtt connected\n");
+  mqtt_subscribe(client, MQTT_BRIDGE_SET_FILTER, 0, NULL, NULL);
+  mqtt_publish(client, MQTT_BRIDGE_STATUS_TOPIC, "online", 6, 0, 1, NULL, NULL);
+  mqttBridgeResync();
+}
+
+static void mqttBridgeConnect(void *arg) {
+  (void)arg;
+  err_t err = mqtt_client_connect(mqttClient, &mqttBroker, MQTT_BRIDGE_PORT, mqttBridgeConnected, NULL, &mqttClientInfo);
+  if (err != ERR_OK) {
+    schedulerStartTimer(&reconnectTimer, MQTT_BRIDGE_RECONNECT_MS, 0, mqttBridgeConnect, NULL);
+  }
+}
+
+/**
+ * @brief Start connecting to broker, retried until it is there
+ * 
+ * @param write group value write, expected to rate limit
+ * @return true when client was created
+ */
+bool mqttBridgeInit(MqttBridgeWrite write) {
+  mqttWrite = write;
+  if (!ipaddr_aton(MQTT_BRIDGE_BROKER, &mqttBroker)) {
+    return false;
+  }
+
+  mqttClient = mqtt_client_new();
+  if (!mqttClient) {
+    return false;
+  }
+
+  mqtt_set_inpub_callback(mqttClient, mqttBridgeIncomingPublish, mqttBridgeIncomingData, NULL);
+  mqttBridgeConnect(NULL);
+  return true;
+}
+
+/**
+ * @brief Mark group address for the next batch
+ * Only address is kept, value is read from the cache when publishing
+ * @param groupValue 
+ */
+void mqttBridgeStateChanged(const KnxGroupValue *groupValue) {
+  if (!mqttClient || !mqtt_client_is_connected(mqttClient)) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < dirtyCount; i++) {
+    if (dirty[i] == groupValue->target) {
+      return;
+    }
+  }
+
+  if (dirtyCount == MQTT_BRIDGE_MAX_DIRTY) {
+    mqttBridgeResync();
+    return;
+  }
+
+  dirty[dirtyCount++] = groupValue->target;
+  mqttBridgeArmFlush();
+}
@@ -0,0 +1,67 @@
+/**
+ * @file MqttBridge.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Group values to and from an MQTT broker
+ * @version 0.1
+ * @date 2023-07-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * MQTT Bridge Description
+ * 
+ * Topics:
+ *  -> knx/state/<main>/<middle>/<sub>: {"dpt":1,"value":1}, retained
+ *  -> knx/set/<main>/<middle>/<sub>: value, becomes group value write
+ *  -> knx/status: online / offline (will), retained
+ * 
+ * State changes only mark the group address dirty, publishes go out
+ * together from a short one shot timer with the latest cached value, so
+ * a burst of changes on one address costs one QoS 0 publish. When the
+ * output ring is full the rest waits for the next flush.
+ * 
+ * Nothing is kept while the broker is away, every (re)connect publishes
+ * the whole state cache instead.
+ * 
+ * Set topics take the datapoint type last seen on that address, unknown
+ * addresses are switched for 0/1 and dimmed above.
+ */
+
+#ifndef MQTT_BRIDGE_H
+#define MQTT_BRIDGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "KnxTelegram.h"
+
+/* Broker sits on the access point network, first DHCP lease by default */
+#ifndef MQTT_BRIDGE_BROKER
+#define MQTT_BRIDGE_BROKER "192.168.4.16"
+#endif
+#ifndef MQTT_BRIDGE_PORT
+#define MQTT_BRIDGE_PORT 1883
+#endif
+#define MQTT_BRIDGE_CLIENT_ID "knx-wifi-switch"
+#define MQTT_BRIDGE_KEEP_ALIVE_S 30
+
+#define MQTT_BRIDGE_STATE_TOPIC "knx/state/%d/%d/%d"
+#define MQTT_BRIDGE_SET_TOPIC "knx/set/%d/%d/%d"
+#define MQTT_BRIDGE_SET_FILTER "knx/set/#"
+#define MQTT_BRIDGE_STATUS_TOPIC "knx/status"
+
+/* Changes within this window go out in one batch */
+#define MQTT_BRIDGE_FLUSH_MS 50
+#define MQTT_BRIDGE_RECONNECT_MS 5000
+
+/* More dirty addresses than this fall back to publishing the whole cache */
+#define MQTT_BRIDGE_MAX_DIRTY 16
+
+typedef bool (*MqttBridgeWrite)(uint16_t target, uint8_t dpt, uint8_t value);
+
+/** === MQTT Bridge === */
+bool mqttBridgeInit(MqttBridgeWrite write);
+void mqttBridgeStateChanged(const KnxGroupValue *groupValue);
+
+#endif // MQTT_BRIDGE_H
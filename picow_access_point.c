@@ -10,15 +10,31 @@
  */
 
 #include <string.h>
+#include <ctype.h>
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
 #include "server.h"
 #include "lwip/tcp.h"
 #include "knxTelegram.h"
+#include "KnxBus.h"
+#include "KnxCache.h"
+#include "KnxNetIp.h"
+#include "KnxCapture.h"
+#include "KnxRamp.h"
+#include "KnxTimer.h"
+#include "KnxRule.h"
+#include "KnxTransport.h"
+#include "MqttBridge.h"
+#include "RateLimit.h"
+#include "Log.h"
+#include "Config.h"
+#include "Scheduler.h"
+#include "Template.h"
 
 #define AP_NAME "Zolisz KNX Switch"
 #define AP_PASSWORD "password123"
+#define AP_HOST_NAME "knx.switch"
 
 #define LED_GPIO 0
 
@@ -34,17 +50,116 @@
 #define KNX_TARGET_PARAM "main=%d&middle=%d&sub=%d"
 #define KNX_DIMMING_ROUTE "/dimming"
 #define KNX_DIMMING_PARAM "value=%d"
+#define KNX_RAMP_PARAM "ramp=%d"
+#define KNX_STATE_ROUTE "/state"
+#define KNX_CAPTURE_ROUTE "/capture"
+#define KNX_REPLAY_ROUTE "/capture/replay"
+#define KNX_REPLAY_PARAM "speed=%d"
+#define KNX_TIMER_ROUTE "/timer"
+#define KNX_TIMER_AFTER_PARAM "after=%d&main=%d&middle=%d&sub=%d&value=%d%n"
+#define KNX_TIMER_DAILY_PARAM "hour=%d&minute=%d&main=%d&middle=%d&sub=%d&value=%d%n"
+#define KNX_TIMER_DPT_PARAM "&dpt=%d"
+#define KNX_TIMER_CANCEL_PARAM "cancel=%d"
+#define KNX_TIMER_CLOCK_PARAM "clock=%lu"
+#define KNX_RULE_ROUTE "/rule"
+#define KNX_RULE_ADD_PARAM "add="
+#define KNX_RULE_REMOVE_PARAM "remove=%d"
+#define KNX_MEMORY_ROUTE "/memory"
+#define KNX_MEMORY_PARAM "device=%u.%u.%u&address=%x&data=%n"
 
 /**
  * WebServer Templates
  */
 #define TEMPLATE_HEADER "<html><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\"><style>body{font-family: Arial, sans-serif; background-color: #f2f2f2; text-align: center;} h1{color: #333;} p{color: #666;} a{color: #007bff; text-decoration: none;} a:hover{color: #0056b3; text-decoration: underline;} input[type=\"submit\"],button{border-radius: 4px; padding: 8px 16px; background-color: #4caf50; color: white; border: none; cursor: pointer;} input[type=\"submit\"]:hover{background-color: #45a049;} @media (max-width: 480px) { body{padding: 20px;} h{font-size: 24px;} p{font-size: 16px;} }</style></head><body><h1>KNX WiFi Switch.</h1><p>by Mateusz Zolisz 2023</p><p><a href=\"" KNX_SWITCH_ROUTE "\">Switch</a> | <a href=\"" KNX_TARGET_ROUTE "\">Target</a> | <a href=\"" KNX_DIMMING_ROUTE "\">Dimming</a></p></br>"
 
-#define TEMPLATE_SWITCH_BODY TEMPLATE_HEADER "<p><a href=\"" KNX_SWITCH_ROUTE "?" KNX_SWITCH_PARAM "\"><button>Switch KNX %s</button></a></p></body></html>"
-
-#define TEMPLATE_ADDRESS_BODY TEMPLATE_HEADER "<form action=\"" KNX_TARGET_ROUTE "\"><label for=\"main\">Main</label></br><input type=\"number\" id=\"main\" name=\"main\" value=\"%d\" placeholder=\"main\" required><br><br><label for=\"middle\">Middle</label></br><input type=\"number\" name=\"middle\" id=\"middle\" placeholder=\"middle\" value=\"%d\" required><br><br><label for=\"sub\">Sub</label></br><input type=\"number\" id=\"sub\" name=\"sub\" value=\"%d\" placeholder=\"sub\" required><br><br><input type=\"submit\" value=\"Change Address\"></form></body></html>"
-
-#define TEMPLATE_DIMMING_BODY TEMPLATE_HEADER "<form action=\"" KNX_DIMMING_ROUTE "\"><label for=\"value\">Value (0-255)</label></br><input type=\"number\" min=0 max=255 id=\"value\" name=\"value\" value=\"%d\" placeholder=\"value\" required style=\"width: 100px\"><br><br><input type=\"submit\" value=\"Set Dimmer\"></form></body></html>"
+#define TEMPLATE_FOOTER "</body></html>"
+
+TEMPLATE_DEFINE_TYPE(stateTemplate, TEMPLATE_TYPE_JSON,
+    TEMPLATE_TEXT("{\"switch\":"),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT(",\"dimming\":"),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT(",\"target\":\""),
+    TEMPLATE_INT(2),
+    TEMPLATE_TEXT("/"),
+    TEMPLATE_INT(3),
+    TEMPLATE_TEXT("/"),
+    TEMPLATE_INT(4),
+    TEMPLATE_TEXT("\"}"));
+
+TEMPLATE_DEFINE_TYPE(timerTemplate, TEMPLATE_TYPE_JSON,
+    TEMPLATE_TEXT("{\"id\":"),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT(",\"pending\":"),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT(",\"daily\":"),
+    TEMPLATE_INT(2),
+    TEMPLATE_TEXT(",\"clock\":"),
+    TEMPLATE_INT(3),
+    TEMPLATE_TEXT(",\"list\":"),
+    TEMPLATE_STREAM(4),
+    TEMPLATE_TEXT("}"));
+
+TEMPLATE_DEFINE_TYPE(ruleTemplate, TEMPLATE_TYPE_JSON,
+    TEMPLATE_TEXT("{\"id\":"),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT(",\"rules\":"),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT(",\"list\":"),
+    TEMPLATE_STREAM(2),
+    TEMPLATE_TEXT("}"));
+
+TEMPLATE_DEFINE_TYPE(memoryTemplate, TEMPLATE_TYPE_JSON,
+    TEMPLATE_TEXT("{\"active\":"),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT(",\"written\":"),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT(",\"length\":"),
+    TEMPLATE_INT(2),
+    TEMPLATE_TEXT(",\"result\":"),
+    TEMPLATE_INT(3),
+    TEMPLATE_TEXT("}"));
+
+TEMPLATE_DEFINE_TYPE(captureTemplate, TEMPLATE_TYPE_PCAP,
+    TEMPLATE_STREAM(0));
+
+TEMPLATE_DEFINE_TYPE(replayTemplate, TEMPLATE_TYPE_JSON,
+    TEMPLATE_TEXT("{\"events\":"),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT("}"));
+
+/* Toggles over the WebSocket when it is up, the link stays as fallback */
+#define TEMPLATE_SWITCH_SCRIPT "var a=document.querySelector(\"a[href^='" KNX_SWITCH_ROUTE "?']\"),b=a.firstChild,s=new WebSocket(\"ws://\"+location.host+\"" WS_ROUTE "\");s.binaryType=\"arraybuffer\";s.onmessage=function(e){var d=new Uint8Array(e.data);if((d[0]<<8|d[1])==g&&d[2]==1){v=d[3];b.textContent=\"Switch KNX \"+(v?\"OFF\":\"ON\");a.href=\"" KNX_SWITCH_ROUTE "?value=\"+(v?0:1);}};b.onclick=function(e){if(s.readyState==1){e.preventDefault();s.send(new Uint8Array([g>>8,g&255,1,v?0:1]));}};"
+
+TEMPLATE_DEFINE(switchTemplate,
+    TEMPLATE_TEXT(TEMPLATE_HEADER "<p><a href=\"" KNX_SWITCH_ROUTE "?value="),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT("\"><button>Switch KNX "),
+    TEMPLATE_STRING(1),
+    TEMPLATE_TEXT("</button></a></p><script>var g="),
+    TEMPLATE_INT(2),
+    TEMPLATE_TEXT(",v="),
+    TEMPLATE_INT(3),
+    TEMPLATE_TEXT(";" TEMPLATE_SWITCH_SCRIPT "</script>" TEMPLATE_FOOTER));
+
+TEMPLATE_DEFINE(addressTemplate,
+    TEMPLATE_TEXT(TEMPLATE_HEADER "<form action=\"" KNX_TARGET_ROUTE "\"><label for=\"main\">Main</label></br><input type=\"number\" id=\"main\" name=\"main\" value=\""),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT("\" placeholder=\"main\" required><br><br><label for=\"middle\">Middle</label></br><input type=\"number\" name=\"middle\" id=\"middle\" placeholder=\"middle\" value=\""),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT("\" required><br><br><label for=\"sub\">Sub</label></br><input type=\"number\" id=\"sub\" name=\"sub\" value=\""),
+    TEMPLATE_INT(2),
+    TEMPLATE_TEXT("\" placeholder=\"sub\" required><br><br><input type=\"submit\" value=\"Change Address\"></form>" TEMPLATE_FOOTER));
+
+/* Held buttons repeat the ramp start, release sends stop. WebSocket when it is up, API otherwise */
+#define TEMPLATE_RAMP_SCRIPT "var s=new WebSocket(\"ws://\"+location.host+\"" WS_ROUTE "\"),t;function r(v){s.readyState==1?s.send(new Uint8Array([g>>8,g&255,3,v])):fetch(\"" KNX_DIMMING_ROUTE "?ramp=\"+v);}function h(i,v){var b=document.getElementById(i);b.onpointerdown=function(){r(v);t=setInterval(function(){r(v);},500);};b.onpointerup=b.onpointerleave=function(){if(t){clearInterval(t);t=0;r(v&8);}};}h(\"d\",5);h(\"u\",13);"
+
+TEMPLATE_DEFINE(dimmingTemplate,
+    TEMPLATE_TEXT(TEMPLATE_HEADER "<form action=\"" KNX_DIMMING_ROUTE "\"><label for=\"value\">Value (0-255)</label></br><input type=\"number\" min=0 max=255 id=\"value\" name=\"value\" value=\""),
+    TEMPLATE_INT(0),
+    TEMPLATE_TEXT("\" placeholder=\"value\" required style=\"width: 100px\"><br><br><input type=\"submit\" value=\"Set Dimmer\"></form><p><button id=\"d\">Hold to Dim -</button> <button id=\"u\">Hold to Dim +</button></p><script>var g="),
+    TEMPLATE_INT(1),
+    TEMPLATE_TEXT(";" TEMPLATE_RAMP_SCRIPT "</script>" TEMPLATE_FOOTER));
 
 /**
  * UART Settings
@@ -54,28 +169,27 @@
 #define UART_TX_PIN 4
 #define UART_RX_PIN 5
 
+/* Boot does not wait for the USB console unless asked to, startup logs stay in the ring */
+#ifndef BOOT_WAIT_USB_MS
+#define BOOT_WAIT_USB_MS 0
+#endif
+
+/* How often bus statistics are rolled up */
+#define KNX_BUS_STATS_MS 10000
+
 static int knxState = 0;
 static int knxDimmingValue = 0;
 char knxTargetAddr[11] = KNX_DEFAULT_TARGET_ADDRESS;
 
-static bool sendKnxTelegram(const char telegram[], int messageSize) {
-    uint8_t sendbuf[2];
-    for (int i = 0; i < messageSize; i++) {
-        if (i == (messageSize - 1)) {
-            sendbuf[0] = TPUART_DATA_END;
-        }  else {
-            sendbuf[0] = TPUART_DATA_START_CONTINUE;
-        }
-
-        sendbuf[0] |= i;
-        sendbuf[1] = telegram[i];
-
-        uart_putc_raw(UART_ID, sendbuf[0]);
-        uart_putc_raw(UART_ID, sendbuf[1]);
-    }
-
-    return true;
-}
+static SchedulerWork knxBusWork;
+static SchedulerTimer knxBusStatsTimer;
+static SchedulerTimer logTimer;
+static SchedulerTimer dhcpLeaseTimer;
+static SchedulerTimer ledTimer;
+static SchedulerTimer configSaveTimer;
+static SchedulerTimer knxNetIpTimer;
+static SchedulerTimer knxTimerTimer;
+static uint16_t ledToggles = 0;
 
 void blinkLed(uint8_t count, uint time) {
     for (size_t i = 0; i < count; i++) {
@@ -86,32 +200,73 @@ void blinkLed(uint8_t count, uint time) {
     }
 }
 
-int switchController(const char *params, char *result, size_t max_result_len) {
-    int len = 0;
-    uint8_t telegram[9];
-    uint16_t data;
-    uint8_t checksum;
-    uint8_t controlByte = knxCreateControlField(false, "auto");
-    uint16_t sourceAddress = knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS);
+static void ledFlashStep(void *arg) {
+    (void)arg;
+    ledToggles--;
+    bool flash = ledToggles && (ledToggles % 2) == 0;
+    cyw43_arch_gpio_put(LED_GPIO, flash ? !knxState : knxState);
+    if (ledToggles == 0) {
+        schedulerStopTimer(&ledTimer);
+    }
+}
+
+/**
+ * Non blocking version of blinkLed for use once scheduler runs
+ */
+void flashLed(uint8_t count, uint time) {
+    ledToggles = count * 2;
+    cyw43_arch_gpio_put(LED_GPIO, !knxState);
+    schedulerStartTimer(&ledTimer, time, time, ledFlashStep, NULL);
+}
+
+/**
+ * @brief Queue group value telegram for the bus engine
+ * 
+ * @param groupValue 
+ * @return true when queued, false when bus is saturated
+ */
+static bool knxGroupSend(KnxGroupValue groupValue) {
+    uint8_t telegram[10];
+    uint8_t size = knxCreateGroupValueTelegram(telegram, knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS), groupValue);
+    if (!rateLimitBus(size, to_ms_since_boot(get_absolute_time()))) {
+        return false;
+    }
+    return knxBusSendTagged(telegram, size, groupValue.dpt);
+}
+
+/**
+ * @brief Queue group value write for the bus engine
+ * 
+ * @param targetAddress 
+ * @param dpt 
+ * @param value 
+ * @return true when queued, false when bus is saturated
+ */
+bool knxGroupWrite(uint16_t targetAddress, uint8_t dpt, uint8_t value) {
+    KnxGroupValue groupValue = { targetAddress, KNX_CMD_VALUE_WRITE, dpt, value };
+    return knxGroupSend(groupValue);
+}
+
+/**
+ * @brief Acknowledge rule source on the bus, target address stays acknowledged when it is one
+ * 
+ * @param group 
+ * @param accept 
+ */
+static void knxRuleAcceptGroup(uint16_t group, bool accept) {
+    knxBusAcceptGroup(group, accept || group == knxCreateTargetGroupAddressFieldFromString(knxTargetAddr));
+}
+
+int switchController(const char *params, TemplateRender *render) {
     uint16_t targetAddress = knxCreateTargetGroupAddressFieldFromString(knxTargetAddr);
-    uint8_t byte5 = 0x00;
-    knxSetTargetAddressType(&byte5, true);
-    knxSetRoutingCounter(&byte5, 6);  
-    knxSetDataLength(&byte5, 1);  
-
-    /* === Fill telegram === */
-    telegram[0] = controlByte;
-    telegram[1] = (sourceAddress >> 8) & 0x00FF;
-    telegram[2] = (sourceAddress & 0x00FF);
-    telegram[3] = (targetAddress >> 8) & 0x00FF;
-    telegram[4] = (targetAddress) & 0x00FF;
-    telegram[5] = byte5;
-    data = knxCreateDataSwitchField(KNX_CMD_VALUE_WRITE, !knxState);
-    telegram[6] = (data >> 8) & 0x00FF;
-    telegram[7] = data & 0x00FF;
-    telegram[8] = knxCalculateChecksum(telegram, sizeof(telegram)/sizeof(uint8_t));
+    bool value = !knxState;
 
     if (params) {
+        bool sendTelegram = knxGroupWrite(targetAddress, KNX_DPT_SWITCH, value);
+        if (!sendTelegram) {
+            return SERVER_CONTENT_BUSY;
+        }
+
         int knxSwitchParam = sscanf(params, KNX_SWITCH_PARAM, &knxState);
         if (knxSwitchParam == 1) {
             if (knxState) {
@@ -120,74 +275,260 @@ int switchController(const char *params, char *result, size_t max_result_len) {
                 knxState = false;
             }
         }
+        cyw43_arch_gpio_put(LED_GPIO, knxState);
+    }
 
-        bool sendTelegram = sendKnxTelegram(telegram, 9);
-        if (sendTelegram) {
-            cyw43_arch_gpio_put(LED_GPIO, knxState);
+    templateRenderInit(render, &switchTemplate);
+    templateSetInt(render, 0, !knxState);
+    templateSetString(render, 1, knxState ? "OFF" : "ON");
+    templateSetInt(render, 2, targetAddress);
+    templateSetInt(render, 3, knxState);
+    return templateLength(render);
+}
+
+int dimmingController(const char *params, TemplateRender *render) {
+    uint16_t targetAddress = knxCreateTargetGroupAddressFieldFromString(knxTargetAddr);
+    int control;
+    if (params && sscanf(params, KNX_RAMP_PARAM, &control) == 1) {
+        if (!knxRampControl(targetAddress, control & 0x0F)) {
+            return SERVER_CONTENT_BUSY;
         }
+    } else if (params) {
+        int value = knxDimmingValue;
+        sscanf(params, KNX_DIMMING_PARAM, &value);
+
+        bool sendTelegram = knxGroupWrite(targetAddress, KNX_DPT_DIMMING, value);
+        if (!sendTelegram) {
+            return SERVER_CONTENT_BUSY;
+        }
+
+        knxDimmingValue = value;
+        flashLed(10, 30);
     }
 
-    if (knxState) {
-        return snprintf(result, max_result_len, TEMPLATE_SWITCH_BODY, 0, "OFF");
-    } else {
-        return snprintf(result, max_result_len, TEMPLATE_SWITCH_BODY, 1, "ON");
+    templateRenderInit(render, &dimmingTemplate);
+    templateSetInt(render, 0, knxDimmingValue);
+    templateSetInt(render, 1, targetAddress);
+    return templateLength(render);
+}
+
+static void configSaveTarget(void *arg) {
+    (void)arg;
+    KnxConfig config = { 0 };
+    strncpy(config.targetAddress, knxTargetAddr, sizeof(config.targetAddress) - 1);
+    if (configSave(&config)) {
+        LOG_INFO("config saved\n");
     }
 }
 
-int dimmingController(const char *params, char *result, size_t max_result_len) {
+int targetController(const char *params, TemplateRender *render) {
+    int main, middle, sub;
     if (params) {
-        sscanf(params, KNX_DIMMING_PARAM, &knxDimmingValue);
-
-        uint8_t telegram[10];
-        uint32_t data = knxCreateDataDimmingField(KNX_CMD_VALUE_WRITE, knxDimmingValue);
-        uint8_t checksum;
-        uint8_t controlByte = knxCreateControlField(false, "auto");
-        uint16_t sourceAddress = knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS);
-        uint16_t targetAddress = knxCreateTargetGroupAddressFieldFromString(knxTargetAddr);
-        uint8_t byte5 = 0x00;
-        knxSetTargetAddressType(&byte5, true);
-        knxSetRoutingCounter(&byte5, 6);  
-        knxSetDataLength(&byte5, 2);  
-
-        /* === Fill telegram === */
-        telegram[0] = controlByte;
-        telegram[1] = (sourceAddress >> 8) & 0x00FF;
-        telegram[2] = (sourceAddress & 0x00FF);
-        telegram[3] = (targetAddress >> 8) & 0x00FF;
-        telegram[4] = (targetAddress) & 0x00FF;
-        telegram[5] = byte5;
-        telegram[6] = (data >> 16) & 0x00FF;
-        telegram[7] = (data >> 8) & 0x00FF;
-        telegram[8] = data & 0x00FF;
-        telegram[9] = knxCalculateChecksum(telegram, sizeof(telegram)/sizeof(uint8_t));
-
-        bool sendTelegram = sendKnxTelegram(telegram, 10);
-
-        if (sendTelegram) {
-            blinkLed(10, 30);
+        // Saved to flash and restored on every boot, never store something broken
+        if (sscanf(params, KNX_TARGET_PARAM, &main, &middle, &sub) != 3 || !knxTargetGroupAddressValid(main, middle, sub)) {
+            return SERVER_CONTENT_BAD_REQUEST;
+        }
+
+        uint16_t previous = knxCreateTargetGroupAddressFieldFromString(knxTargetAddr);
+        snprintf(knxTargetAddr, sizeof(knxTargetAddr), "%d.%d.%d", main, middle, sub);
+
+        // New address is acknowledged before the old one stops being, no frame falls in between
+        uint16_t target = knxCreateTargetGroupAddressFieldFromString(knxTargetAddr);
+        knxBusAcceptGroup(target, true);
+        // Rules still running on the old address keep it acknowledged
+        if (previous != target && !knxRuleSource(previous)) {
+            knxBusAcceptGroup(previous, false);
         }
+        flashLed(3, 100);
+        DEBUG_printf("ADDR: %s \n", knxTargetAddr);
+        // Restarted on every change, flash is written once the user is done
+        schedulerStartTimer(&configSaveTimer, CONFIG_SAVE_DELAY_MS, 0, configSaveTarget, NULL);
+    } else {
+        sscanf(knxTargetAddr, "%d.%d.%d", &main, &middle, &sub);
     }
 
-    return snprintf(result, max_result_len, TEMPLATE_DIMMING_BODY, knxDimmingValue);
+    templateRenderInit(render, &addressTemplate);
+    templateSetInt(render, 0, main);
+    templateSetInt(render, 1, middle);
+    templateSetInt(render, 2, sub);
+    return templateLength(render);
 }
 
-int targetController(const char *params, char *result, size_t max_result_len) {
+int stateController(const char *params, TemplateRender *render) {
     int main, middle, sub;
-    if (params) {
-        sscanf(params, KNX_TARGET_PARAM, &main, &middle, &sub);
-        sprintf(knxTargetAddr, "%d.%d.%d", main, middle, sub);
-        blinkLed(3, 100);
-        DEBUG_printf("ADDR: %s \n", knxTargetAddr);
+    sscanf(knxTargetAddr, "%d.%d.%d", &main, &middle, &sub);
+
+    templateRenderInit(render, &stateTemplate);
+    templateSetInt(render, 0, knxState);
+    templateSetInt(render, 1, knxDimmingValue);
+    templateSetInt(render, 2, main);
+    templateSetInt(render, 3, middle);
+    templateSetInt(render, 4, sub);
+    return templateLength(render);
+}
+
+/**
+ * @brief Check target and value of a timer write and pick its DPT
+ * Explicit dpt= wins, otherwise the one last seen on the address, so 0 and 1 still dim a dimmer
+ * @param extra params after the value
+ * @param main 
+ * @param middle 
+ * @param sub 
+ * @param value 
+ * @param groupValue target, dpt and value are filled in
+ * @return false when something is out of range
+ */
+static bool timerGroupValue(const char *extra, int main, int middle, int sub, int value, KnxGroupValue *groupValue) {
+    int dpt;
+    if (!knxTargetGroupAddressValid(main, middle, sub) || value < 0 || value > 255) {
+        return false;
+    }
+
+    KnxTargetGroupAddress target = { main, middle, sub };
+    groupValue->target = knxTargetGroupAddressStructToField(target);
+    groupValue->value = value;
+    if (sscanf(extra, KNX_TIMER_DPT_PARAM, &dpt) == 1) {
+        groupValue->dpt = dpt;
     } else {
-        sscanf(knxTargetAddr, "%d.%d.%d", &main, &middle, &sub);
+        groupValue->dpt = knxCacheDpt(groupValue->target, value);
+    }
+
+    return groupValue->dpt == KNX_DPT_DIMMING || (groupValue->dpt == KNX_DPT_SWITCH && value <= 1);
+}
+
+// Daily timers and rules by id, ids are what cancel= and remove= take
+static const char *timerListRead(uint32_t offset, uint16_t *length) {
+    return templateListRead(offset, length, knxTimerStats().daily, KNX_TIMER_ROW_WIDTH, knxTimerDailyRow);
+}
+
+static const char *ruleListRead(uint32_t offset, uint16_t *length) {
+    return templateListRead(offset, length, knxRuleCount(), KNX_RULE_ROW_WIDTH, knxRuleRow);
+}
+
+int timerController(const char *params, TemplateRender *render) {
+    int32_t id = -1;
+    int seconds, hour, minute, main, middle, sub, value, end = 0;
+    unsigned long clock;
+    KnxGroupValue groupValue;
+
+    if (params && sscanf(params, KNX_TIMER_AFTER_PARAM, &seconds, &main, &middle, &sub, &value, &end) == 5) {
+        if (seconds < 0 || !timerGroupValue(params + end, main, middle, sub, value, &groupValue)) {
+            return SERVER_CONTENT_BAD_REQUEST;
+        }
+        id = knxTimerAfter(seconds, groupValue.target, groupValue.dpt, groupValue.value);
+    } else if (params && sscanf(params, KNX_TIMER_DAILY_PARAM, &hour, &minute, &main, &middle, &sub, &value, &end) == 6) {
+        // Out of range parts would silently name another time of day
+        if (hour < 0 || hour > 23 || minute < 0 || minute > 59
+            || !timerGroupValue(params + end, main, middle, sub, value, &groupValue)) {
+            return SERVER_CONTENT_BAD_REQUEST;
+        }
+        id = knxTimerDaily(hour * 3600 + minute * 60, groupValue.target, groupValue.dpt, groupValue.value);
+    } else if (params && sscanf(params, KNX_TIMER_CANCEL_PARAM, &value) == 1) {
+        id = knxTimerCancel(value) ? value : -1;
+    } else if (params && sscanf(params, KNX_TIMER_CLOCK_PARAM, &clock) == 1) {
+        knxTimerSetClock(clock);
+    }
+
+    KnxTimerStats stats = knxTimerStats();
+    templateRenderInit(render, &timerTemplate);
+    templateSetInt(render, 0, id);
+    templateSetInt(render, 1, stats.pending);
+    templateSetInt(render, 2, stats.daily);
+    templateSetInt(render, 3, stats.clockSet);
+    templateSetStream(render, 4, timerListRead, templateListLength(stats.daily, KNX_TIMER_ROW_WIDTH));
+    return templateLength(render);
+}
+
+int ruleController(const char *params, TemplateRender *render) {
+    int32_t id = -1;
+    int remove;
+
+    if (params && strncmp(params, KNX_RULE_ADD_PARAM, sizeof(KNX_RULE_ADD_PARAM) - 1) == 0) {
+        id = knxRuleAdd(params + sizeof(KNX_RULE_ADD_PARAM) - 1);
+    } else if (params && sscanf(params, KNX_RULE_REMOVE_PARAM, &remove) == 1) {
+        id = knxRuleRemove(remove) ? remove : -1;
+    }
+
+    templateRenderInit(render, &ruleTemplate);
+    templateSetInt(render, 0, id);
+    templateSetInt(render, 1, knxRuleCount());
+    templateSetStream(render, 2, ruleListRead, templateListLength(knxRuleCount(), KNX_RULE_ROW_WIDTH));
+    return templateLength(render);
+}
+
+int memoryController(const char *params, TemplateRender *render) {
+    unsigned int area, line, device, address;
+    int offset = 0;
+
+    // Data is hex, two digits a byte, without params only progress is reported
+    if (params && sscanf(params, KNX_MEMORY_PARAM, &area, &line, &device, &address, &offset) == 4 && offset) {
+        static uint8_t data[KNX_TRANSPORT_MAX_BLOCK];
+        uint16_t length = 0;
+        const char *hex = params + offset;
+        while (length < sizeof(data) && isxdigit((unsigned char)hex[0]) && isxdigit((unsigned char)hex[1])) {
+            sscanf(hex, "%2hhx", &data[length++]);
+            hex += 2;
+        }
+
+        // Empty, odd, too long or not hex at all, nothing the device could be sent
+        if (length == 0 || (*hex && *hex != '&')) {
+            return SERVER_CONTENT_BAD_REQUEST;
+        }
+
+        // Fields are ORed into one word, out of range ones would address another device
+        if (area > 15 || line > 15 || device > 255 || address > 0xFFFF || address + length > 0x10000) {
+            return SERVER_CONTENT_BAD_REQUEST;
+        }
+
+        KnxTargetPhysicalAddress destination = { area, line, device };
+        if (!knxTransportMemoryWrite(knxTargetPhysicalAddressStructToField(destination), address, data, length)) {
+            return SERVER_CONTENT_BUSY;
+        }
+    }
+
+    KnxTransportStatus status = knxTransportStatus();
+    templateRenderInit(render, &memoryTemplate);
+    templateSetInt(render, 0, status.active);
+    templateSetInt(render, 1, status.written);
+    templateSetInt(render, 2, status.length);
+    templateSetInt(render, 3, status.result);
+    return templateLength(render);
+}
+
+int captureController(const char *params, TemplateRender *render) {
+    int32_t length = knxCapturePcapOpen();
+    if (length < 0) {
+        return SERVER_CONTENT_BUSY;
+    }
+
+    templateRenderInit(render, &captureTemplate);
+    templateSetStream(render, 0, knxCapturePcapRead, length);
+    return templateLength(render);
+}
+
+static void knxBusHandleEvent(TCP_SERVER_T *state, const KnxBusEvent *event);
+
+static void knxBusReplayEvent(const KnxBusEvent *event, void *arg) {
+    knxBusHandleEvent((TCP_SERVER_T*)arg, event);
+}
+
+int replayController(const char *params, TemplateRender *render) {
+    int speed = 1;
+    if (params) {
+        sscanf(params, KNX_REPLAY_PARAM, &speed);
     }
 
-    return snprintf(result, max_result_len, TEMPLATE_ADDRESS_BODY, main, middle, sub);
+    // Replayed traffic only reaches core0 consumers, never the bus or KNXnet/IP
+    uint32_t events = knxCaptureReplay(speed < 0 ? 0 : speed, knxBusReplayEvent, knxBusWork.arg);
+
+    templateRenderInit(render, &replayTemplate);
+    templateSetInt(render, 0, events);
+    return templateLength(render);
 }
 
-int server_content(const char *request, const char *params, char *result, size_t max_result_len) {
+int server_content(const char *request, const char *params, TemplateRender *render) {
     int len = 0;
-    int (*controllerFunc) (const char*, char*, size_t);
+    int (*controllerFunc) (const char*, TemplateRender*) = NULL;
     /* Default Route */
     if (strncmp(request, KNX_SWITCH_ROUTE, sizeof(KNX_SWITCH_ROUTE) - 1) == 0 
         || strncmp(request, "/ ", 2) == 0) {
@@ -202,14 +543,241 @@ int server_content(const char *request, const char *params, char *result, size_t
        controllerFunc = &targetController;
     }
 
-     return (*controllerFunc) (params, result, max_result_len);    
+    if (strncmp(request, KNX_STATE_ROUTE, sizeof(KNX_STATE_ROUTE) - 1) == 0) {
+       controllerFunc = &stateController;
+    }
+
+    if (strncmp(request, KNX_TIMER_ROUTE, sizeof(KNX_TIMER_ROUTE) - 1) == 0) {
+       controllerFunc = &timerController;
+    }
+
+    if (strncmp(request, KNX_RULE_ROUTE, sizeof(KNX_RULE_ROUTE) - 1) == 0) {
+       controllerFunc = &ruleController;
+    }
+
+    if (strncmp(request, KNX_MEMORY_ROUTE, sizeof(KNX_MEMORY_ROUTE) - 1) == 0) {
+       controllerFunc = &memoryController;
+    }
+
+    if (strncmp(request, KNX_CAPTURE_ROUTE, sizeof(KNX_CAPTURE_ROUTE) - 1) == 0) {
+       controllerFunc = &captureController;
+    }
+
+    if (strncmp(request, KNX_REPLAY_ROUTE, sizeof(KNX_REPLAY_ROUTE) - 1) == 0) {
+       controllerFunc = &replayController;
+    }
+
+    // Unknown route, redirect to the switch
+    if (!controllerFunc) {
+        return 0;
+    }
+
+     return (*controllerFunc) (params, render);    
+}
+
+/**
+ * @brief Capture, timers and rules change without a state version bump, they never match an ETag
+ * 
+ * @param request 
+ * @return false for routes which must always be generated
+ */
+bool server_content_cacheable(const char *request) {
+    return strncmp(request, KNX_CAPTURE_ROUTE, sizeof(KNX_CAPTURE_ROUTE) - 1) != 0
+        && strncmp(request, KNX_TIMER_ROUTE, sizeof(KNX_TIMER_ROUTE) - 1) != 0
+        && strncmp(request, KNX_RULE_ROUTE, sizeof(KNX_RULE_ROUTE) - 1) != 0
+        && strncmp(request, KNX_MEMORY_ROUTE, sizeof(KNX_MEMORY_ROUTE) - 1) != 0;
+}
+
+/**
+ * @brief WebSocket binary message: [group address high, group address low, DPT, value]
+ * 
+ * @param state 
+ * @param data 
+ * @param len 
+ */
+void server_ws_message(TCP_SERVER_T *state, const uint8_t *data, uint8_t len) {
+    if (len >= 4 && data[2] == KNX_DPT_DIMMING_CONTROL) {
+        knxRampControl(data[0] << 8 | data[1], data[3] & 0x0F);
+        return;
+    }
+
+    if (len < 4 || (data[2] != KNX_DPT_SWITCH && data[2] != KNX_DPT_DIMMING)) {
+        return;
+    }
+
+    // State update goes out once the bus confirms the telegram
+    knxGroupWrite(data[0] << 8 | data[1], data[2], data[3]);
+}
+
+/**
+ * @brief Publish telegram to bus monitor clients, formatted once for all of them
+ * 
+ * @param state 
+ * @param telegram 
+ * @param groupValue NULL when telegram carries no group value
+ */
+static void knxPublishTelegram(TCP_SERVER_T *state, const KnxBusTelegram *telegram, const KnxGroupValue *groupValue) {
+    SERVER_EVENT_T *event = server_event_alloc(state);
+    if (!event) {
+        return;
+    }
+
+    KnxSourceAddress source = knxDecodeSourceAddressField(telegram->data[1] << 8 | telegram->data[2]);
+    uint16_t targetField = telegram->data[3] << 8 | telegram->data[4];
+    if (groupValue) {
+        KnxTargetGroupAddress target = knxDecodeTargetGroupAddressField(targetField);
+        event->len = snprintf(event->data, sizeof(event->data),
+            "event: telegram\ndata: {\"src\":\"%d.%d.%d\",\"dst\":\"%d/%d/%d\",\"cmd\":%d,\"dpt\":%d,\"value\":%d}\n\n",
+            source.area, source.line, source.device, target.main, target.middle, target.sub,
+            groupValue->cmd, groupValue->dpt, groupValue->value);
+    } else {
+        KnxTargetPhysicalAddress target = knxDecodeTargetPhysicalAddressField(targetField);
+        event->len = snprintf(event->data, sizeof(event->data),
+            "event: telegram\ndata: {\"src\":\"%d.%d.%d\",\"dst\":\"%d.%d.%d\"}\n\n",
+            source.area, source.line, source.device, target.area, target.line, target.device);
+    }
+    server_event_publish(state, event);
+}
+
+/**
+ * @brief Publish state cache change to bus monitor clients
+ * 
+ * @param state 
+ * @param groupValue 
+ */
+static void knxPublishState(TCP_SERVER_T *state, const KnxGroupValue *groupValue) {
+    SERVER_EVENT_T *event = server_event_alloc(state);
+    if (!event) {
+        return;
+    }
+
+    KnxTargetGroupAddress target = knxDecodeTargetGroupAddressField(groupValue->target);
+    event->len = snprintf(event->data, sizeof(event->data),
+        "event: state\ndata: {\"ga\":\"%d/%d/%d\",\"dpt\":%d,\"value\":%d}\n\n",
+        target.main, target.middle, target.sub, groupValue->dpt, groupValue->value);
+    server_event_publish(state, event);
+}
+
+/**
+ * @brief Everything core0 does with a bus event, live or replayed
+ * 
+ * @param state 
+ * @param event 
+ */
+static void knxBusHandleEvent(TCP_SERVER_T *state, const KnxBusEvent *event) {
+    KnxGroupValue groupValue;
+    if (event->type == KNX_BUS_EVENT_FAILED) {
+        LOG_WARN("telegram not confirmed by TPUART\n");
+        return;
+    }
+
+    bool isGroupValue = knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue);
+    knxPublishTelegram(state, &event->telegram, isGroupValue ? &groupValue : NULL);
+
+    // Writes from the bus and our own confirmed writes update the UI, dimming steps are no state
+    if (!isGroupValue || groupValue.cmd == KNX_CMD_VALUE_READ || groupValue.dpt == KNX_DPT_DIMMING_CONTROL) {
+        return;
+    }
+
+    if (groupValue.dpt == KNX_DPT_SWITCH && groupValue.target == knxCreateTargetGroupAddressFieldFromString(knxTargetAddr)) {
+        knxState = groupValue.value & 0x01;
+        cyw43_arch_gpio_put(LED_GPIO, knxState);
+    }
+
+    uint8_t update[4] = { groupValue.target >> 8, groupValue.target & 0xFF, groupValue.dpt, groupValue.value };
+    server_ws_broadcast(state, update, sizeof(update));
+
+    if (knxCacheUpdate(&groupValue)) {
+        mqttBridgeStateChanged(&groupValue);
+        knxPublishState(state, &groupValue);
+        server_state_changed(state);
+    }
+}
+
+/**
+ * @brief Answer GroupValueRead on addresses we acknowledge with the cached value
+ * Reads of tunnel clients are answered too, only the device's own are not
+ * @param event live bus event
+ */
+static void knxAnswerRead(const KnxBusEvent *event) {
+    KnxGroupValue groupValue;
+    if (event->type == KNX_BUS_EVENT_FAILED
+        || !knxDecodeGroupValueTelegram(event->telegram.data, event->telegram.length, event->dpt, &groupValue)
+        || groupValue.cmd != KNX_CMD_VALUE_READ || !knxBusGroupAccepted(groupValue.target)) {
+        return;
+    }
+
+    uint16_t source = event->telegram.data[1] << 8 | event->telegram.data[2];
+    if (source == knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS)) {
+        return;
+    }
+
+    KnxGroupValue response;
+    if (!knxCacheGet(groupValue.target, &response)) {
+        // Switch object has a value before anything was written to it
+        if (groupValue.target != knxCreateTargetGroupAddressFieldFromString(knxTargetAddr)) {
+            return;
+        }
+        response.target = groupValue.target;
+        response.dpt = KNX_DPT_SWITCH;
+        response.value = knxState;
+    }
+
+    response.cmd = KNX_CMD_VALUE_RESPONSE;
+    if (!knxGroupSend(response)) {
+        LOG_WARN("read response on %04x dropped, bus busy\n", groupValue.target);
+    }
+}
+
+static void knxBusProcessEvents(void *arg) {
+    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    KnxBusEvent event;
+    while (knxBusPollEvent(&event)) {
+        knxCacheTagEvent(&event);
+        knxCaptureRecord(&event);
+        knxNetIpBusEvent(&event);
+        knxAnswerRead(&event);
+        knxRuleBusEvent(&event);
+        knxTransportBusEvent(&event);
+        knxBusHandleEvent(state, &event);
+    }
 }
 
+static void knxBusWake(void *arg) {
+    schedulerWake((SchedulerWork*)arg);
+}
+
+static void knxBusStats(void *arg) {
+    static uint32_t lastDropped = 0;
+    static RateLimitStats lastLimited;
+    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    uint32_t dropped = knxBusDroppedEvents();
+    RateLimitStats limited = rateLimitStats();
+
+    if (dropped != lastDropped) {
+        LOG_INFO("bus events dropped: %u\n", dropped - lastDropped);
+        lastDropped = dropped;
+    }
+
+    if (memcmp(&limited, &lastLimited, sizeof(limited)) != 0) {
+        LOG_INFO("rate limited: client %u, requests %u, bandwidth %u, websocket %u\n",
+            limited.clientLimited, limited.requestLimited, limited.bandwidthLimited, state->ws_limited);
+        lastLimited = limited;
+    }
+}
+
+static void dhcpLeaseExpiry(void *arg) {
+    dhcp_server_expire_leases((dhcp_server_t*)arg);
+}
 
 int main() {
-    sleep_ms(500);
     stdio_init_all();
-    sleep_ms(500);
+    logInit();
+#if BOOT_WAIT_USB_MS
+    sleep_ms(BOOT_WAIT_USB_MS);
+#endif
+
+    // Bus comes first, it does not need Wi-Fi and is the slowest thing to miss
     uart_init(UART_ID, BAUD_RATE);
 
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
@@ -217,63 +785,98 @@ int main() {
 
     uart_set_format(UART_ID, 8, 1, UART_PARITY_EVEN);
 
+    KnxConfig config;
+    if (configLoad(&config)) {
+        strncpy(knxTargetAddr, config.targetAddress, sizeof(knxTargetAddr) - 1);
+        knxTargetAddr[sizeof(knxTargetAddr) - 1] = 0;
+    }
+
+    // Filter is in place before the first frame, device and tunnels are acknowledged
+    knxBusAcceptGroup(knxCreateTargetGroupAddressFieldFromString(knxTargetAddr), true);
+    knxBusAcceptIndividual(knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS), 1 + KNX_NET_IP_MAX_TUNNELS);
+
+    // From now on UART belongs to the bus engine on core1, events queue up
+    // in its ring until core0 has the scheduler running
+    knxBusInit(UART_ID);
+    uint32_t busReadyUs = time_us_32();
+
     TCP_SERVER_T *state = calloc(1, sizeof(TCP_SERVER_T));
     if (!state) {
-        DEBUG_printf("failed to allocate state\n");
+        LOG_ERROR("failed to allocate state\n");
+        logFlush(NULL);
         return 1;
     }
 
     if (cyw43_arch_init()) {
         blinkLed(10, 100);
-        DEBUG_printf("failed to initialise\n");
+        LOG_ERROR("failed to initialise\n");
+        logFlush(NULL);
         return 1;
     }
 
-    blinkLed(3, 200);
+    // Both poll and background builds run everything on cyw43 async_context
+    schedulerInit(cyw43_arch_async_context());
+    schedulerStartTimer(&logTimer, LOG_FLUSH_MS, LOG_FLUSH_MS, logFlush, NULL);
+    schedulerAddWork(&knxBusWork, knxBusProcessEvents, state);
+    schedulerStartTimer(&knxBusStatsTimer, KNX_BUS_STATS_MS, KNX_BUS_STATS_MS, knxBusStats, state);
+    rateLimitInit(to_ms_since_boot(get_absolute_time()));
+    knxRampInit(knxGroupWrite);
+
+    // Daily timers come back from flash, they wait for a client to set the clock
+    knxTimerInit(knxGroupWrite);
+    schedulerStartTimer(&knxTimerTimer, KNX_TIMER_TICK_MS, KNX_TIMER_TICK_MS, knxTimerTick, NULL);
+    knxRuleInit(knxGroupWrite, knxRuleAcceptGroup);
+
+    // Connection paces itself by its acks, it skips the group rate limit
+    knxTransportInit(knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS), knxBusSend);
+
+    // Take over whatever arrived on the bus while Wi-Fi was starting
+    knxBusSetNotify(knxBusWake, &knxBusWork);
+    schedulerWake(&knxBusWork);
 
-    cyw43_arch_gpio_put(LED_GPIO, 1);
     cyw43_arch_enable_ap_mode(AP_NAME, AP_PASSWORD, CYW43_AUTH_WPA2_MIXED_PSK);
 
     ip4_addr_t mask;
     IP4_ADDR(ip_2_ip4(&state->gw), 192, 168, 4, 1);
     IP4_ADDR(ip_2_ip4(&mask), 255, 255, 255, 0);
 
-    blinkLed(3, 200);
-    // Start the dhcp server
-    dhcp_server_t dhcp_server;
+    // Start the dhcp server, lease table is too big for the stack
+    static dhcp_server_t dhcp_server;
     dhcp_server_init(&dhcp_server, &state->gw, &mask);
+    schedulerStartTimer(&dhcpLeaseTimer, DHCPS_WHEEL_TICK_MS, DHCPS_WHEEL_TICK_MS, dhcpLeaseExpiry, &dhcp_server);
 
     // Start the dns server
-    dns_server_t dns_server;
+    static dns_server_t dns_server;
     dns_server_init(&dns_server, &state->gw);
+    dns_server_add_host(&dns_server, AP_HOST_NAME, &state->gw);
+
+    // Tunneling for ETS and home servers, device address comes first, tunnels follow it
+    if (knxNetIpInit(knxCreateSourceAddressFieldFromString(KNX_SOURCE_ADDRESS), AP_NAME)) {
+        schedulerStartTimer(&knxNetIpTimer, KNX_NET_IP_TICK_MS, KNX_NET_IP_TICK_MS, knxNetIpTick, NULL);
+    } else {
+        LOG_ERROR("failed to open knxnet/ip on port %d\n", KNX_NET_IP_PORT);
+    }
 
-    blinkLed(3, 200);
 
     if (!tcp_server_open(state)) {
         blinkLed(10, 200);
-        DEBUG_printf("failed to open server\n");
+        LOG_ERROR("failed to open server\n");
+        logFlush(NULL);
         return 1;
     }
-    
-    blinkLed(3, 200);
-
-    while(!state->complete) {
-        // the following #ifdef is only here so this same example can be used in multiple modes;
-        // you do not need it in your code
-#if PICO_CYW43_ARCH_POLL
-        // if you are using pico_cyw43_arch_poll, then you must poll periodically from your
-        // main loop (not from a timer interrupt) to check for Wi-Fi driver or lwIP work that needs to be done.
-        cyw43_arch_poll();
-        // you can poll as often as you like, however if you have nothing else to do you can
-        // choose to sleep until either a specified time, or cyw43_arch_poll() has work to do:
-        cyw43_arch_wait_for_work_until(make_timeout_time_ms(1000));
-#else
-        // if you are not using pico_cyw43_arch_poll, then Wi-FI driver and lwIP work
-        // is done via interrupt in the background. This sleep is just an example of some (blocking)
-        // work you might be doing.
-        sleep_ms(1000);
-#endif
+
+    // Home automation broker, keeps retrying in the background until it is reachable
+    if (!mqttBridgeInit(knxGroupWrite)) {
+        LOG_ERROR("failed to start mqtt bridge\n");
     }
+
+    // Ready, flashed from the scheduler so nothing waits for the LED
+    flashLed(3, 100);
+    LOG_INFO("boot: bus ready after %u us, http ready after %u us\n", busReadyUs, time_us_32());
+
+    // Sleeps until Wi-Fi, lwIP, bus events or timers have work
+    schedulerRun(&state->complete);
+
     dns_server_deinit(&dns_server);
     dhcp_server_deinit(&dhcp_server);
     cyw43_arch_deinit();
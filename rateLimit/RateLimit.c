@@ -0,0 +1,150 @@
+/**
+ * @file RateLimit.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-16
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stddef.h>
+#include "RateLimit.h"
+
+typedef struct {
+  uint32_t ip;
+  RateBucket bucket;
+} RateLimitClient;
+
+static RateLimitClient clients[RATE_LIMIT_CLIENTS];
+static uint8_t clientCount = 0;
+static RateBucket busRequests;
+static RateBucket busBytes;
+static RateLimitStats stats;
+
+/**
+ * @brief Start with full bucket
+ * 
+ * @param bucket 
+ * @param rate tokens per second
+ * @param burst 
+ * @param nowMs 
+ */
+void rateBucketInit(RateBucket *bucket, uint16_t rate, uint16_t burst, uint32_t nowMs) {
+  bucket->rate = rate;
+  bucket->burst = burst;
+  bucket->tokens = burst * 1000u;
+  bucket->updated = nowMs;
+}
+
+/**
+ * @brief Refill bucket for elapsed time and take tokens
+ * 
+ * @param bucket 
+ * @param cost tokens
+ * @param nowMs 
+ * @return true when there were enough tokens
+ */
+bool rateBucketTake(RateBucket *bucket, uint16_t cost, uint32_t nowMs) {
+  uint32_t elapsed = nowMs - bucket->updated;
+  uint32_t capacity = bucket->burst * 1000u;
+
+  // rate tokens per second is rate milli-tokens per ms
+  if (elapsed >= capacity / (bucket->rate ? bucket->rate : 1)) {
+    bucket->tokens = capacity;
+  } else {
+    bucket->tokens += elapsed * bucket->rate;
+    if (bucket->tokens > capacity) {
+      bucket->tokens = capacity;
+    }
+  }
+  bucket->updated = nowMs;
+
+  if (bucket->tokens < cost * 1000u) {
+    return false;
+  }
+
+  bucket->tokens -= cost * 1000u;
+  return true;
+}
+
+/**
+ * @brief Set up global buckets
+ * 
+ * @param nowMs 
+ */
+void rateLimitInit(uint32_t nowMs) {
+  clientCount = 0;
+  rateBucketInit(&busRequests, RATE_LIMIT_BUS_RATE, RATE_LIMIT_BUS_BURST, nowMs);
+  rateBucketInit(&busBytes, RATE_LIMIT_BUS_BYTES, RATE_LIMIT_BUS_BYTES_BURST, nowMs);
+}
+
+/**
+ * @brief Take one request from client bucket
+ * When table is full, client idle for the longest time is forgotten
+ * @param ip IPv4 address
+ * @param nowMs 
+ * @return true when client may proceed
+ */
+bool rateLimitClient(uint32_t ip, uint32_t nowMs) {
+  RateLimitClient *client = NULL;
+
+  for (uint8_t i = 0; i < clientCount; i++) {
+    if (clients[i].ip == ip) {
+      client = &clients[i];
+      break;
+    }
+  }
+
+  if (!client) {
+    if (clientCount < RATE_LIMIT_CLIENTS) {
+      client = &clients[clientCount++];
+    } else {
+      client = &clients[0];
+      for (uint8_t i = 1; i < RATE_LIMIT_CLIENTS; i++) {
+        if (nowMs - clients[i].bucket.updated > nowMs - client->bucket.updated) {
+          client = &clients[i];
+        }
+      }
+    }
+    client->ip = ip;
+    rateBucketInit(&client->bucket, RATE_LIMIT_CLIENT_RATE, RATE_LIMIT_CLIENT_BURST, nowMs);
+  }
+
+  if (!rateBucketTake(&client->bucket, 1, nowMs)) {
+    stats.clientLimited++;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Take one telegram and its bytes from global buckets
+ * 
+ * @param telegramSize 
+ * @param nowMs 
+ * @return true when telegram may be sent
+ */
+bool rateLimitBus(uint8_t telegramSize, uint32_t nowMs) {
+  if (!rateBucketTake(&busRequests, 1, nowMs)) {
+    stats.requestLimited++;
+    return false;
+  }
+
+  if (!rateBucketTake(&busBytes, telegramSize, nowMs)) {
+    // Request token is not given back, a flood keeps paying for it
+    stats.bandwidthLimited++;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Counters of rejected requests since boot
+ * 
+ * @return RateLimitStats 
+ */
+RateLimitStats rateLimitStats(void) {
+  return stats;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file RateLimit.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Token bucket limits in front of the bus
+ * @version 0.1
+ * @date 2023-07-16
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Rate Limit Description
+ * 
+ * Buckets:
+ *  -> Per client (keyed by IPv4 address, small table, least recently used entry is reused)
+ *  -> Global bus requests (telegrams per second)
+ *  -> Global bus bandwidth (telegram bytes per second)
+ * 
+ * Tokens are kept in 1/1000 units so refill needs no division. Core0 only.
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef RATE_LIMIT_CLIENTS
+#define RATE_LIMIT_CLIENTS 16
+#endif
+
+/* Requests per second and burst of every client */
+#ifndef RATE_LIMIT_CLIENT_RATE
+#define RATE_LIMIT_CLIENT_RATE 5
+#endif
+#ifndef RATE_LIMIT_CLIENT_BURST
+#define RATE_LIMIT_CLIENT_BURST 10
+#endif
+
+/* Telegrams per second and burst of everyone together */
+#ifndef RATE_LIMIT_BUS_RATE
+#define RATE_LIMIT_BUS_RATE 20
+#endif
+#ifndef RATE_LIMIT_BUS_BURST
+#define RATE_LIMIT_BUS_BURST 20
+#endif
+
+/* Telegram bytes per second, roughly half of what TP1 carries */
+#ifndef RATE_LIMIT_BUS_BYTES
+#define RATE_LIMIT_BUS_BYTES 250
+#endif
+#ifndef RATE_LIMIT_BUS_BYTES_BURST
+#define RATE_LIMIT_BUS_BYTES_BURST 100
+#endif
+
+/* Sent to limited HTTP clients as Retry-After */
+#ifndef RATE_LIMIT_RETRY_S
+#define RATE_LIMIT_RETRY_S 1
+#endif
+
+typedef struct {
+  uint32_t tokens;   // 1/1000 of token
+  uint32_t updated;  // ms
+  uint16_t rate;     // tokens per second
+  uint16_t burst;    // tokens
+} RateBucket;
+
+typedef struct {
+  uint32_t clientLimited;
+  uint32_t requestLimited;
+  uint32_t bandwidthLimited;
+} RateLimitStats;
+
+/** === Bucket === */
+void rateBucketInit(RateBucket *bucket, uint16_t rate, uint16_t burst, uint32_t nowMs);
+bool rateBucketTake(RateBucket *bucket, uint16_t cost, uint32_t nowMs);
+
+/** === Limits === */
+void rateLimitInit(uint32_t nowMs);
+bool rateLimitClient(uint32_t ip, uint32_t nowMs);
+bool rateLimitBus(uint8_t telegramSize, uint32_t nowMs);
+RateLimitStats rateLimitStats(void);
+
+#endif // RATE_LIMIT_H
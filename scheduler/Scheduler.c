@@ -0,0 +1,117 @@
+/**
+ * @file Scheduler.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-04
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include "pico/stdlib.h"
+#include "Scheduler.h"
+
+static async_context_t *schedulerContext;
+
+static void schedulerTimerWorker(async_context_t *context, async_at_time_worker_t *worker) {
+  SchedulerTimer *timer = (SchedulerTimer*)worker->user_data;
+
+  // Re-arm before callback, so callback is free to stop or restart the timer.
+  // Next deadline is based on previous one, so periodic tasks do not drift.
+  if (timer->periodMs) {
+    async_context_add_at_time_worker_at(context, worker, delayed_by_ms(worker->next_time, timer->periodMs));
+  }
+
+  timer->callback(timer->arg);
+}
+
+static void schedulerWorkWorker(async_context_t *context, async_when_pending_worker_t *worker) {
+  SchedulerWork *work = (SchedulerWork*)worker->user_data;
+  (void)context;
+
+  work->callback(work->arg);
+}
+
+/**
+ * @brief Initialize scheduler
+ * 
+ * @param context cyw43_arch_async_context()
+ */
+void schedulerInit(async_context_t *context) {
+  schedulerContext = context;
+}
+
+/**
+ * @brief Run scheduler until complete is set
+ * Sleeps until there is work, no busy waiting in both build modes
+ * 
+ * @param complete 
+ */
+void schedulerRun(volatile bool *complete) {
+  while (! *complete) {
+    // Poll build runs all work from here, background build from low priority IRQ
+    async_context_poll(schedulerContext);
+    async_context_wait_for_work_until(schedulerContext, at_the_end_of_time);
+  }
+}
+
+/**
+ * @brief Start (or restart) timer
+ * 
+ * @param timer 
+ * @param delayMs first expiry
+ * @param periodMs 0 for one shot timer
+ * @param callback 
+ * @param arg 
+ * @return true 
+ * @return false 
+ */
+bool schedulerStartTimer(SchedulerTimer *timer, uint32_t delayMs, uint32_t periodMs, SchedulerCallback callback, void *arg) {
+  async_context_remove_at_time_worker(schedulerContext, &timer->worker);
+
+  timer->worker.do_work = schedulerTimerWorker;
+  timer->worker.user_data = timer;
+  timer->periodMs = periodMs;
+  timer->callback = callback;
+  timer->arg = arg;
+
+  return async_context_add_at_time_worker_in_ms(schedulerContext, &timer->worker, delayMs);
+}
+
+/**
+ * @brief Stop timer, safe to call on timer which is not running
+ * 
+ * @param timer 
+ */
+void schedulerStopTimer(SchedulerTimer *timer) {
+  async_context_remove_at_time_worker(schedulerContext, &timer->worker);
+}
+
+/**
+ * @brief Register work item, it runs every time it is woken
+ * 
+ * @param work 
+ * @param callback 
+ * @param arg 
+ * @return true 
+ * @return false 
+ */
+bool schedulerAddWork(SchedulerWork *work, SchedulerCallback callback, void *arg) {
+  work->worker.do_work = schedulerWorkWorker;
+  work->worker.user_data = work;
+  work->callback = callback;
+  work->arg = arg;
+
+  return async_context_add_when_pending_worker(schedulerContext, &work->worker);
+}
+
+/**
+ * @brief Wake work item
+ * Safe to call from IRQ and from core1
+ * 
+ * @param work 
+ */
+void schedulerWake(SchedulerWork *work) {
+  async_context_set_work_pending(schedulerContext, &work->worker);
+}
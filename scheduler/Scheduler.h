@@ -0,0 +1,58 @@
+/**
+ * @file Scheduler.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Event driven scheduler on top of async_context
+ * @version 0.1
+ * @date 2023-07-04
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Scheduler
+ * 
+ * Same code for picow_access_point_poll and picow_access_point_background,
+ * both builds run cyw43/lwIP work on the cyw43_arch async_context and so
+ * does everything registered here:
+ *  -> Timers (one shot or periodic)
+ *  -> Work items which can be woken from any core or IRQ
+ * 
+ * Callbacks run with the async_context lock held, so they may use lwIP
+ * directly.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/async_context.h"
+
+typedef void (*SchedulerCallback)(void *arg);
+
+typedef struct {
+  async_at_time_worker_t worker;
+  uint32_t periodMs;  // 0 = one shot
+  SchedulerCallback callback;
+  void *arg;
+} SchedulerTimer;
+
+typedef struct {
+  async_when_pending_worker_t worker;
+  SchedulerCallback callback;
+  void *arg;
+} SchedulerWork;
+
+void schedulerInit(async_context_t *context);
+void schedulerRun(volatile bool *complete);
+
+/** === Timers === */
+bool schedulerStartTimer(SchedulerTimer *timer, uint32_t delayMs, uint32_t periodMs, SchedulerCallback callback, void *arg);
+void schedulerStopTimer(SchedulerTimer *timer);
+
+/** === Work items === */
+bool schedulerAddWork(SchedulerWork *work, SchedulerCallback callback, void *arg);
+void schedulerWake(SchedulerWork *work);
+
+#endif // SCHEDULER_H
@@ -1,5 +1,65 @@
 #include "server.h"
 
+#define SERVER_PROBE(path, response) { path, sizeof(path) - 1, response, sizeof(response) - 1 }
+#define SERVER_PROBE_REDIRECT(path) { path, sizeof(path) - 1, NULL, 0 }
+
+/**
+ * Connectivity checks of phones and laptops. Redirecting them makes the OS
+ * open its captive portal window with our UI right after joining the AP.
+ */
+static const SERVER_PROBE_T server_probes[] = {
+    SERVER_PROBE_REDIRECT("/generate_204"),             // Android
+    SERVER_PROBE_REDIRECT("/gen_204"),                  // Android
+    SERVER_PROBE_REDIRECT("/hotspot-detect.html"),      // iOS, macOS
+    SERVER_PROBE_REDIRECT("/library/test/success.html"), // iOS, macOS
+    SERVER_PROBE_REDIRECT("/connecttest.txt"),          // Windows
+    SERVER_PROBE_REDIRECT("/ncsi.txt"),                 // Windows
+    SERVER_PROBE_REDIRECT("/redirect"),                 // Windows
+    SERVER_PROBE_REDIRECT("/canonical.html"),           // Firefox
+    SERVER_PROBE_REDIRECT("/success.txt"),              // Firefox
+    SERVER_PROBE("/favicon.ico", HTTP_RESPONSE_NOT_FOUND),
+};
+
+static const SERVER_PROBE_T *server_find_probe(const char *request) {
+    for (size_t i = 0; i < sizeof(server_probes) / sizeof(server_probes[0]); i++) {
+        const SERVER_PROBE_T *probe = &server_probes[i];
+        if (strncmp(request, probe->path, probe->path_len) == 0) {
+            char end = request[probe->path_len];
+            if (end == 0 || end == ' ' || end == '?') {
+                return probe;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Forget the connection state, the pcb is already closed or gone
+static void tcp_server_release(TCP_CONNECT_STATE_T *con_state) {
+    TCP_SERVER_T *state = con_state->server;
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (state->ws_clients[i] == con_state) {
+            state->ws_clients[i] = NULL;
+        }
+    }
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        if (state->sse_clients[i] == con_state) {
+            state->sse_clients[i] = NULL;
+        }
+    }
+    for (int i = 0; i < SERVER_MAX_WAITERS; i++) {
+        if (state->waiters[i] == con_state) {
+            state->waiters[i] = NULL;
+        }
+    }
+    for (int i = 0; i < con_state->sse_count; i++) {
+        SERVER_EVENT_T *event = con_state->sse_queue[(con_state->sse_head + i) % SSE_QUEUE_LEN].event;
+        if (event) {
+            event->refs--;
+        }
+    }
+    free(con_state);
+}
+
 err_t tcp_close_client_connection(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *client_pcb, err_t close_err) {
     if (client_pcb) {
         assert(con_state && con_state->pcb == client_pcb);
@@ -8,14 +68,16 @@ err_t tcp_close_client_connection(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb
         tcp_sent(client_pcb, NULL);
         tcp_recv(client_pcb, NULL);
         tcp_err(client_pcb, NULL);
-        err_t err = tcp_close(client_pcb);
+        // Unacked events are sent by reference, they must not outlive the connection.
+        // A body cut short is reset, so the client does not wait for the rest of Content-Length
+        err_t err = con_state->sse || close_err == ERR_ABRT ? ERR_ABRT : tcp_close(client_pcb);
         if (err != ERR_OK) {
             DEBUG_printf("close failed %d, calling abort\n", err);
             tcp_abort(client_pcb);
             close_err = ERR_ABRT;
         }
         if (con_state) {
-            free(con_state);
+            tcp_server_release(con_state);
         }
     }
     return close_err;
@@ -29,17 +91,390 @@ void tcp_server_close(TCP_SERVER_T *state) {
     }
 }
 
+// Queue as much of the body as the send buffer takes, the rest follows from tcp_server_sent
+static err_t tcp_server_stream(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb) {
+    const char *data;
+    uint16_t len;
+    bool copy;
+    bool queued = false;
+    while (con_state->queued_len < con_state->result_len) {
+        if (!templateNextChunk(&con_state->render, &data, &len, &copy)) {
+            // Stream slot lost data it promised, the response can't be completed
+            return ERR_ABRT;
+        }
+        u16_t space = tcp_sndbuf(pcb);
+        if (space == 0) {
+            break;
+        }
+        if (len > space) {
+            len = space;
+        }
+
+        // Literals live in flash and are sent by reference, only formatted slots are copied.
+        // Everything but the last chunk is marked MORE so lwIP packs it into one segment
+        u8_t flags = copy ? TCP_WRITE_FLAG_COPY : 0;
+        if (con_state->queued_len + len < con_state->result_len) {
+            flags |= TCP_WRITE_FLAG_MORE;
+        }
+        err_t err = tcp_write(pcb, data, len, flags);
+        if (err == ERR_MEM) {
+            break; // out of segments, retried once something is acked
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
+        templateAdvance(&con_state->render, len);
+        con_state->queued_len += len;
+        queued = true;
+    }
+
+    // Don't wait for lwIP to get around to it
+    return queued ? tcp_output(pcb) : ERR_OK;
+}
+
+static uint32_t tcp_server_client_ip(struct tcp_pcb *pcb) {
+    return ip4_addr_get_u32(ip_2_ip4(&pcb->remote_ip));
+}
+
+// Frames are tiny, header and payload go out together as one copied write
+static err_t tcp_server_ws_send(TCP_CONNECT_STATE_T *con_state, uint8_t opcode, const uint8_t *data, uint8_t len) {
+    uint8_t frame[2 + WEB_SOCKET_MAX_PAYLOAD];
+    uint8_t header_len = webSocketFrameHeader(frame, opcode, len);
+    if (len) {
+        memcpy(frame + header_len, data, len);
+    }
+
+    // A client that can't keep up misses updates instead of stalling the others
+    if (tcp_sndbuf(con_state->pcb) < header_len + len) {
+        return ERR_MEM;
+    }
+    err_t err = tcp_write(con_state->pcb, frame, header_len + len, TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK) {
+        return err;
+    }
+    return tcp_output(con_state->pcb);
+}
+
+static err_t tcp_server_ws_upgrade(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb, struct pbuf *p) {
+    TCP_SERVER_T *state = con_state->server;
+    int slot = 0;
+    while (slot < WS_MAX_CLIENTS && state->ws_clients[slot]) {
+        slot++;
+    }
+    if (slot == WS_MAX_CLIENTS) {
+        return ERR_MEM;
+    }
+
+    // Key is somewhere in the headers, past what fits into con_state->headers
+    u16_t pos = pbuf_memfind(p, WS_KEY_HEADER, sizeof(WS_KEY_HEADER) - 1, 0);
+    if (pos == 0xFFFF) {
+        return ERR_VAL;
+    }
+    pos += sizeof(WS_KEY_HEADER) - 1;
+    while (pbuf_get_at(p, pos) == ' ') {
+        pos++;
+    }
+    char key[WEB_SOCKET_KEY_LENGTH];
+    if (pbuf_copy_partial(p, key, sizeof(key), pos) != sizeof(key)) {
+        return ERR_VAL;
+    }
+
+    char accept[WEB_SOCKET_ACCEPT_LENGTH + 1];
+    char response[sizeof(HTTP_RESPONSE_WS_UPGRADE) + WEB_SOCKET_ACCEPT_LENGTH];
+    webSocketAcceptKey(key, accept);
+    int len = snprintf(response, sizeof(response), HTTP_RESPONSE_WS_UPGRADE, accept);
+    err_t err = tcp_write(pcb, response, len, TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    con_state->ws = true;
+    con_state->ws_rx_len = 0;
+    state->ws_clients[slot] = con_state;
+    DEBUG_printf("websocket client connected\n");
+    return tcp_output(pcb);
+}
+
+// Returns false when the connection should be closed
+static bool tcp_server_ws_recv(TCP_CONNECT_STATE_T *con_state, struct pbuf *p) {
+    u16_t offset = 0;
+    con_state->ws_idle_polls = 0;
+    while (offset < p->tot_len) {
+        // Buffer holds the largest frame we accept, so a full buffer always parses or fails
+        u16_t copied = pbuf_copy_partial(p, con_state->ws_rx + con_state->ws_rx_len,
+            sizeof(con_state->ws_rx) - con_state->ws_rx_len, offset);
+        offset += copied;
+        con_state->ws_rx_len += copied;
+
+        WebSocketFrame frame;
+        int used;
+        while ((used = webSocketParseFrame(con_state->ws_rx, con_state->ws_rx_len, &frame)) > 0) {
+            switch (frame.opcode) {
+                case WEB_SOCKET_OPCODE_BINARY:
+                    if (rateLimitClient(tcp_server_client_ip(con_state->pcb), to_ms_since_boot(get_absolute_time()))) {
+                        server_ws_message(con_state->server, frame.payload, frame.length);
+                    } else {
+                        con_state->server->ws_limited++;
+                    }
+                    break;
+                case WEB_SOCKET_OPCODE_PING:
+                    tcp_server_ws_send(con_state, WEB_SOCKET_OPCODE_PONG, frame.payload, frame.length);
+                    break;
+                case WEB_SOCKET_OPCODE_CLOSE:
+                    tcp_server_ws_send(con_state, WEB_SOCKET_OPCODE_CLOSE, NULL, 0);
+                    return false;
+                default:
+                    break; // pong, text
+            }
+            con_state->ws_rx_len -= used;
+            memmove(con_state->ws_rx, con_state->ws_rx + used, con_state->ws_rx_len);
+        }
+        if (used < 0) {
+            DEBUG_printf("unsupported websocket frame\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write by reference and remember it until acked, false when the client is too slow
+static bool tcp_server_sse_queue(TCP_CONNECT_STATE_T *con_state, SERVER_EVENT_T *event, const char *data, u16_t len) {
+    if (con_state->sse_count == SSE_QUEUE_LEN || tcp_sndbuf(con_state->pcb) < len) {
+        return false;
+    }
+    if (tcp_write(con_state->pcb, data, len, 0) != ERR_OK) {
+        return false;
+    }
+
+    SERVER_EVENT_REF_T *ref = &con_state->sse_queue[(con_state->sse_head + con_state->sse_count) % SSE_QUEUE_LEN];
+    ref->event = event;
+    ref->len = len;
+    con_state->sse_count++;
+    if (event) {
+        event->refs++;
+    }
+    tcp_output(con_state->pcb);
+    return true;
+}
+
+static void tcp_server_sse_acked(TCP_CONNECT_STATE_T *con_state, u16_t len) {
+    con_state->sse_acked += len;
+    while (con_state->sse_count && con_state->sse_acked >= con_state->sse_queue[con_state->sse_head].len) {
+        SERVER_EVENT_REF_T *ref = &con_state->sse_queue[con_state->sse_head];
+        con_state->sse_acked -= ref->len;
+        if (ref->event) {
+            ref->event->refs--;
+        }
+        con_state->sse_head = (con_state->sse_head + 1) % SSE_QUEUE_LEN;
+        con_state->sse_count--;
+    }
+}
+
+static err_t tcp_server_sse_subscribe(TCP_CONNECT_STATE_T *con_state) {
+    TCP_SERVER_T *state = con_state->server;
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        if (!state->sse_clients[i]) {
+            if (!tcp_server_sse_queue(con_state, NULL, HTTP_RESPONSE_SSE, sizeof(HTTP_RESPONSE_SSE) - 1)) {
+                return ERR_MEM;
+            }
+            con_state->sse = true;
+            state->sse_clients[i] = con_state;
+            DEBUG_printf("event client connected\n");
+            return ERR_OK;
+        }
+    }
+    return ERR_MEM;
+}
+
+// Every live event sits in at least one client queue, so the pool can't run dry
+SERVER_EVENT_T *server_event_alloc(TCP_SERVER_T *state) {
+    bool subscribed = false;
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        subscribed |= state->sse_clients[i] != NULL;
+    }
+    if (!subscribed) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sizeof(state->events) / sizeof(state->events[0]); i++) {
+        if (state->events[i].refs == 0) {
+            state->events[i].len = 0;
+            return &state->events[i];
+        }
+    }
+    return NULL;
+}
+
+void server_event_publish(TCP_SERVER_T *state, SERVER_EVENT_T *event) {
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        TCP_CONNECT_STATE_T *con_state = state->sse_clients[i];
+        if (con_state && !tcp_server_sse_queue(con_state, event, event->data, event->len)) {
+            // Slow client is dropped, it must not hold events for everyone else
+            DEBUG_printf("dropping slow event client\n");
+            state->sse_dropped++;
+            tcp_close_client_connection(con_state, con_state->pcb, ERR_OK);
+        }
+    }
+}
+
+void server_ws_broadcast(TCP_SERVER_T *state, const uint8_t *data, uint8_t len) {
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (state->ws_clients[i]) {
+            tcp_server_ws_send(state->ws_clients[i], WEB_SOCKET_OPCODE_BINARY, data, len);
+        }
+    }
+}
+
 err_t tcp_server_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
     TCP_CONNECT_STATE_T *con_state = (TCP_CONNECT_STATE_T*)arg;
     DEBUG_printf("tcp_server_sent %u\n", len);
+    if (con_state->ws) {
+        return ERR_OK;
+    }
+    if (con_state->sse) {
+        tcp_server_sse_acked(con_state, len);
+        return ERR_OK;
+    }
     con_state->sent_len += len;
     if (con_state->sent_len >= con_state->header_len + con_state->result_len) {
         DEBUG_printf("all done\n");
         return tcp_close_client_connection(con_state, pcb, ERR_OK);
     }
+
+    err_t err = tcp_server_stream(con_state, pcb);
+    if (err != ERR_OK) {
+        DEBUG_printf("failed to write result data %d\n", err);
+        return tcp_close_client_connection(con_state, pcb, err);
+    }
     return ERR_OK;
 }
 
+// Headers go out with MORE until the body joins them, then everything is flushed
+static err_t tcp_server_send(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb, const char *headers, int header_len) {
+    // Boot time to the first answer, the number fast boot is measured by
+    static bool first_response = true;
+    if (first_response) {
+        first_response = false;
+        LOG_INFO("first response %u us after reset\n", time_us_32());
+    }
+
+    con_state->header_len = header_len;
+    con_state->sent_len = 0;
+    con_state->queued_len = 0;
+    err_t err = tcp_write(pcb, headers, header_len, con_state->result_len ? TCP_WRITE_FLAG_MORE : 0);
+    if (err != ERR_OK) {
+        DEBUG_printf("failed to write header data %d\n", err);
+        return err;
+    }
+
+    // Start streaming the body to the client, flushes headers and body together
+    return con_state->result_len ? tcp_server_stream(con_state, pcb) : tcp_output(pcb);
+}
+
+static err_t tcp_server_send_not_modified(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb) {
+    con_state->result_len = 0;
+    int header_len = snprintf(con_state->headers, sizeof(con_state->headers), HTTP_RESPONSE_NOT_MODIFIED,
+        (unsigned long)con_state->server->version);
+    return tcp_server_send(con_state, pcb, con_state->headers, header_len);
+}
+
+static err_t tcp_server_respond(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb, const char *request, const char *params) {
+    TCP_SERVER_T *state = con_state->server;
+
+    // Generate content
+    con_state->result_len = server_content(request, params, &con_state->render);
+    DEBUG_printf("Result: %d\n", con_state->result_len);
+    if (con_state->result_len == SERVER_CONTENT_BUSY) {
+        con_state->result_len = 0;
+        return tcp_server_send(con_state, pcb, HTTP_RESPONSE_TOO_MANY, sizeof(HTTP_RESPONSE_TOO_MANY) - 1);
+    }
+    if (con_state->result_len == SERVER_CONTENT_BAD_REQUEST) {
+        con_state->result_len = 0;
+        return tcp_server_send(con_state, pcb, HTTP_RESPONSE_BAD_REQUEST, sizeof(HTTP_RESPONSE_BAD_REQUEST) - 1);
+    }
+    if (con_state->result_len <= 0) {
+        // Send cached redirect
+        con_state->result_len = 0;
+        return tcp_server_send(con_state, pcb, state->redirect, state->redirect_len);
+    }
+
+    // Controllers act on params, what everyone else sees may have changed
+    if (params) {
+        server_state_changed(state);
+    }
+
+    // Generate web page
+    int header_len = snprintf(con_state->headers, sizeof(con_state->headers), HTTP_RESPONSE_HEADERS,
+        200, con_state->result_len, con_state->render.tpl->contentType, (unsigned long)state->version);
+    if (header_len > sizeof(con_state->headers) - 1) {
+        DEBUG_printf("Too much header data %d\n", header_len);
+        return ERR_CLSD;
+    }
+    return tcp_server_send(con_state, pcb, con_state->headers, header_len);
+}
+
+static bool tcp_server_not_modified(TCP_SERVER_T *state, struct pbuf *p) {
+    u16_t pos = pbuf_memfind(p, HTTP_IF_NONE_MATCH, sizeof(HTTP_IF_NONE_MATCH) - 1, 0);
+    if (pos == 0xFFFF) {
+        return false;
+    }
+
+    char etag[16];
+    u16_t len = pbuf_copy_partial(p, etag, sizeof(etag) - 1, pos + sizeof(HTTP_IF_NONE_MATCH) - 1);
+    unsigned long version;
+    etag[len] = 0;
+    return sscanf(etag, " \"%lx\"", &version) == 1 && version == state->version;
+}
+
+static void tcp_server_unwait(TCP_CONNECT_STATE_T *con_state) {
+    TCP_SERVER_T *state = con_state->server;
+    for (int i = 0; i < SERVER_MAX_WAITERS; i++) {
+        if (state->waiters[i] == con_state) {
+            state->waiters[i] = NULL;
+        }
+    }
+    con_state->wait_polls = 0;
+    tcp_poll(con_state->pcb, tcp_server_poll, POLL_TIME_S * 2);
+}
+
+// Hold the request until server_state_changed or the poll callback gives up on it
+static err_t tcp_server_wait(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *pcb, const char *request, int wait_s) {
+    TCP_SERVER_T *state = con_state->server;
+    size_t route_len = strcspn(request, " ?");
+    if (route_len + 1 >= sizeof(con_state->wait_route)) {
+        return tcp_server_send_not_modified(con_state, pcb);
+    }
+
+    for (int i = 0; i < SERVER_MAX_WAITERS; i++) {
+        if (!state->waiters[i]) {
+            // Kept with its terminating space, exactly as server_content sees a request line
+            memcpy(con_state->wait_route, request, route_len);
+            con_state->wait_route[route_len] = ' ';
+            con_state->wait_route[route_len + 1] = 0;
+            con_state->wait_polls = wait_s < SERVER_MAX_WAIT_S ? wait_s : SERVER_MAX_WAIT_S;
+            state->waiters[i] = con_state;
+            tcp_poll(pcb, tcp_server_poll, 2); // every second while held
+            return ERR_OK;
+        }
+    }
+
+    // No room to hold it, the client comes back anyway
+    return tcp_server_send_not_modified(con_state, pcb);
+}
+
+void server_state_changed(TCP_SERVER_T *state) {
+    state->version++;
+    for (int i = 0; i < SERVER_MAX_WAITERS; i++) {
+        TCP_CONNECT_STATE_T *con_state = state->waiters[i];
+        if (con_state) {
+            tcp_server_unwait(con_state);
+            if (tcp_server_respond(con_state, con_state->pcb, con_state->wait_route, NULL) != ERR_OK) {
+                tcp_close_client_connection(con_state, con_state->pcb, ERR_OK);
+            }
+        }
+    }
+}
+
 err_t tcp_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
     TCP_CONNECT_STATE_T *con_state = (TCP_CONNECT_STATE_T*)arg;
     if (!p) {
@@ -47,6 +482,12 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
         return tcp_close_client_connection(con_state, pcb, ERR_OK);
     }
     assert(con_state && con_state->pcb == pcb);
+    if (con_state->ws) {
+        bool keep = tcp_server_ws_recv(con_state, p);
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+        return keep ? ERR_OK : tcp_close_client_connection(con_state, pcb, ERR_OK);
+    }
     if (p->tot_len > 0) {
         DEBUG_printf("tcp_server_recv %d err %d\n", p->tot_len, err);
 
@@ -69,48 +510,62 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
                 }
             }
 
-            // Generate content
-            con_state->result_len = server_content(request, params, con_state->result, sizeof(con_state->result));
-            DEBUG_printf("Request: %s?%s\n", request, params);
-            DEBUG_printf("Result: %d\n", con_state->result_len);
-
-            // Check we had enough buffer space
-            if (con_state->result_len > sizeof(con_state->result) - 1) {
-                DEBUG_printf("Too much result data %d\n", con_state->result_len);
-                return tcp_close_client_connection(con_state, pcb, ERR_CLSD);
+            // Bus monitor, connection stays open and gets every event
+            if (strncmp(request, SSE_ROUTE " ", sizeof(SSE_ROUTE)) == 0) {
+                err_t err = tcp_server_sse_subscribe(con_state);
+                tcp_recved(pcb, p->tot_len);
+                pbuf_free(p);
+                if (err != ERR_OK) {
+                    DEBUG_printf("event subscribe failed %d\n", err);
+                    return tcp_close_client_connection(con_state, pcb, ERR_OK);
+                }
+                return ERR_OK;
             }
 
-            // Generate web page
-            if (con_state->result_len > 0) {
-                con_state->header_len = snprintf(con_state->headers, sizeof(con_state->headers), HTTP_RESPONSE_HEADERS,
-                    200, con_state->result_len);
-                if (con_state->header_len > sizeof(con_state->headers) - 1) {
-                    DEBUG_printf("Too much header data %d\n", con_state->header_len);
-                    return tcp_close_client_connection(con_state, pcb, ERR_CLSD);
+            // Control channel, connection stays open after the handshake
+            if (strncmp(request, WS_ROUTE " ", sizeof(WS_ROUTE)) == 0) {
+                err_t err = tcp_server_ws_upgrade(con_state, pcb, p);
+                tcp_recved(pcb, p->tot_len);
+                pbuf_free(p);
+                if (err != ERR_OK) {
+                    DEBUG_printf("websocket upgrade failed %d\n", err);
+                    return tcp_close_client_connection(con_state, pcb, ERR_OK);
                 }
-            } else {
-                // Send redirect
-                con_state->header_len = snprintf(con_state->headers, sizeof(con_state->headers), HTTP_RESPONSE_REDIRECT,
-                    ipaddr_ntoa(con_state->gw));
-                DEBUG_printf("Sending redirect %s", con_state->headers);
+                return ERR_OK;
             }
 
-            // Send the headers to the client
-            con_state->sent_len = 0;
-            err_t err = tcp_write(pcb, con_state->headers, con_state->header_len, 0);
-            if (err != ERR_OK) {
-                DEBUG_printf("failed to write header data %d\n", err);
-                return tcp_close_client_connection(con_state, pcb, err);
-            }
+            TCP_SERVER_T *state = con_state->server;
+            const SERVER_PROBE_T *probe = server_find_probe(request);
+            err_t err;
+            if (probe) {
+                // Captive portal probes never reach the controllers
+                con_state->result_len = 0;
+                err = probe->response ? tcp_server_send(con_state, pcb, probe->response, probe->response_len)
+                    : tcp_server_send(con_state, pcb, state->redirect, state->redirect_len);
+            } else {
+                // Dashboards poll with wait=, it is not an action for the controllers
+                int wait_s = 0;
+                if (params && sscanf(params, SERVER_WAIT_PARAM, &wait_s) == 1) {
+                    params = NULL;
+                }
 
-            // Send the body to the client
-            if (con_state->result_len) {
-                err = tcp_write(pcb, con_state->result, con_state->result_len, 0);
-                if (err != ERR_OK) {
-                    DEBUG_printf("failed to write result data %d\n", err);
-                    return tcp_close_client_connection(con_state, pcb, err);
+                if (params && !rateLimitClient(tcp_server_client_ip(pcb), to_ms_since_boot(get_absolute_time()))) {
+                    // Actions only, one client must not crowd out the others
+                    con_state->result_len = 0;
+                    err = tcp_server_send(con_state, pcb, HTTP_RESPONSE_TOO_MANY, sizeof(HTTP_RESPONSE_TOO_MANY) - 1);
+                } else if (!params && server_content_cacheable(request) && tcp_server_not_modified(state, p)) {
+                    err = wait_s > 0 ? tcp_server_wait(con_state, pcb, request, wait_s) : tcp_server_send_not_modified(con_state, pcb);
+                } else {
+                    err = tcp_server_respond(con_state, pcb, request, params);
                 }
             }
+
+            if (err != ERR_OK) {
+                DEBUG_printf("failed to write response %d\n", err);
+                tcp_recved(pcb, p->tot_len);
+                pbuf_free(p);
+                return tcp_close_client_connection(con_state, pcb, err == ERR_ABRT ? ERR_ABRT : ERR_OK);
+            }
         }
         tcp_recved(pcb, p->tot_len);
     }
@@ -121,14 +576,33 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 err_t tcp_server_poll(void *arg, struct tcp_pcb *pcb) {
     TCP_CONNECT_STATE_T *con_state = (TCP_CONNECT_STATE_T*)arg;
     DEBUG_printf("tcp_server_poll_fn\n");
+    if (con_state && con_state->ws && con_state->ws_idle_polls++ < WS_MAX_IDLE_POLLS) {
+        tcp_server_ws_send(con_state, WEB_SOCKET_OPCODE_PING, NULL, 0);
+        return ERR_OK;
+    }
+    if (con_state && con_state->wait_polls) {
+        if (--con_state->wait_polls) {
+            return ERR_OK;
+        }
+
+        // Nothing changed in time
+        tcp_server_unwait(con_state);
+        if (tcp_server_send_not_modified(con_state, pcb) == ERR_OK) {
+            return ERR_OK;
+        }
+    }
+    if (con_state && con_state->sse && tcp_server_sse_queue(con_state, NULL, SSE_KEEPALIVE, sizeof(SSE_KEEPALIVE) - 1)) {
+        return ERR_OK; // dead clients stop acking and fill their queue
+    }
     return tcp_close_client_connection(con_state, pcb, ERR_OK); // Just disconnect clent?
 }
 
 void tcp_server_err(void *arg, err_t err) {
     TCP_CONNECT_STATE_T *con_state = (TCP_CONNECT_STATE_T*)arg;
-    if (err != ERR_ABRT) {
+    if (con_state) {
+        // pcb is already freed by lwIP, only our state is left
         DEBUG_printf("tcp_client_err_fn %d\n", err);
-        tcp_close_client_connection(con_state, con_state->pcb, err);
+        tcp_server_release(con_state);
     }
 }
 
@@ -147,9 +621,10 @@ err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err) {
         return ERR_MEM;
     }
     con_state->pcb = client_pcb; // for checking
-    con_state->gw = &state->gw;
+    con_state->server = state;
 
-    // setup connection to client
+    // setup connection to client, responses are small and must not wait for a delayed ACK
+    tcp_nagle_disable(client_pcb);
     tcp_arg(client_pcb, con_state);
     tcp_sent(client_pcb, tcp_server_sent);
     tcp_recv(client_pcb, tcp_server_recv);
@@ -165,19 +640,19 @@ bool tcp_server_open(void *arg) {
 
     struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
-        DEBUG_printf("failed to create pcb\n");
+        LOG_ERROR("failed to create pcb\n");
         return false;
     }
 
     err_t err = tcp_bind(pcb, IP_ANY_TYPE, TCP_PORT);
     if (err) {
-        DEBUG_printf("failed to bind to port %d\n");
+        LOG_ERROR("failed to bind to port %d\n", TCP_PORT);
         return false;
     }
 
     state->server_pcb = tcp_listen_with_backlog(pcb, 1);
     if (!state->server_pcb) {
-        DEBUG_printf("failed to listen\n");
+        LOG_ERROR("failed to listen\n");
         if (pcb) {
             tcp_close(pcb);
         }
@@ -187,5 +662,8 @@ bool tcp_server_open(void *arg) {
     tcp_arg(state->server_pcb, state);
     tcp_accept(state->server_pcb, tcp_server_accept);
 
+    // Redirect never changes, so it is not formatted per request
+    state->redirect_len = snprintf(state->redirect, sizeof(state->redirect), HTTP_RESPONSE_REDIRECT, ipaddr_ntoa(&state->gw));
+
     return true;
 }
\ No newline at end of file
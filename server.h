@@ -3,29 +3,104 @@
 #include "lwip/tcp.h"
 #include "dhcpserver.h"
 #include "dnsserver.h"
+#include "Template.h"
+#include "WebSocket.h"
+#include "RateLimit.h"
+#include "Log.h"
 #include "pico/stdlib.h"
 
 #define TCP_PORT 80
 #define POLL_TIME_S 5
 #define HTTP_GET "GET"
-#define HTTP_RESPONSE_HEADERS "HTTP/1.1 %d OK\nContent-Length: %d\nContent-Type: text/html; charset=utf-8\nConnection: close\n\n"
-#define HTTP_RESPONSE_REDIRECT "HTTP/1.1 302 Redirect\nLocation: http://%s\n\n"
-#define DEBUG_printf printf
+#define HTTP_RESPONSE_HEADERS "HTTP/1.1 %d OK\r\nContent-Length: %d\r\nContent-Type: %s\r\nETag: \"%08lx\"\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n"
+#define HTTP_RESPONSE_NOT_MODIFIED "HTTP/1.1 304 Not Modified\r\nETag: \"%08lx\"\r\nConnection: close\r\n\r\n"
+#define HTTP_IF_NONE_MATCH "If-None-Match:"
+#define HTTP_RESPONSE_REDIRECT "HTTP/1.1 302 Redirect\r\nLocation: http://%s/\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_RESPONSE_WS_UPGRADE "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
+#define HTTP_RESPONSE_SSE "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n"
+#define SERVER_STR_(x) #x
+#define SERVER_STR(x) SERVER_STR_(x)
+#define HTTP_RESPONSE_TOO_MANY "HTTP/1.1 429 Too Many Requests\r\nRetry-After: " SERVER_STR(RATE_LIMIT_RETRY_S) "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_RESPONSE_NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_RESPONSE_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define DEBUG_printf LOG_DEBUG
+
+// server_content result when the bus can't take more right now, answered with 429
+#define SERVER_CONTENT_BUSY -1
+// server_content result when params can't be acted on, answered with 400
+#define SERVER_CONTENT_BAD_REQUEST -2
+
+// Conditional GET with ?wait= holds the request until the state version changes
+#define SERVER_WAIT_PARAM "wait=%d"
+#define SERVER_MAX_WAITERS 4
+#define SERVER_MAX_WAIT_S 60
+
+#define WS_ROUTE "/ws"
+#define WS_KEY_HEADER "Sec-WebSocket-Key:"
+#define WS_MAX_CLIENTS 4
+#define WS_MAX_IDLE_POLLS 3 // pinged every poll, closed when pongs stop coming
+
+#define SSE_ROUTE "/events"
+#define SSE_KEEPALIVE ":\n\n"
+#define SSE_MAX_CLIENTS 3
+#define SSE_QUEUE_LEN 4 // unacked events per client before it counts as slow
+#define SSE_EVENT_SIZE 192
+
+// Formatted once, referenced by every subscriber until all of them got it acked
+typedef struct SERVER_EVENT_T_ {
+    uint8_t refs;
+    uint16_t len;
+    char data[SSE_EVENT_SIZE];
+} SERVER_EVENT_T;
+
+typedef struct SERVER_EVENT_REF_T_ {
+    SERVER_EVENT_T *event; // NULL for static data (headers, keepalive)
+    uint16_t len;
+} SERVER_EVENT_REF_T;
 
 typedef struct TCP_SERVER_T_ {
     struct tcp_pcb *server_pcb;
     bool complete;
     ip_addr_t gw;
+    char redirect[96]; // built once, gw does not change
+    int redirect_len;
+    struct TCP_CONNECT_STATE_T_ *ws_clients[WS_MAX_CLIENTS];
+    struct TCP_CONNECT_STATE_T_ *sse_clients[SSE_MAX_CLIENTS];
+    SERVER_EVENT_T events[SSE_MAX_CLIENTS * SSE_QUEUE_LEN + 1]; // never runs out, see server_event_alloc
+    uint32_t sse_dropped;
+    uint32_t version; // bumped on every state change, sent as ETag
+    struct TCP_CONNECT_STATE_T_ *waiters[SERVER_MAX_WAITERS];
+    uint32_t ws_limited;
 } TCP_SERVER_T;
 
+// Precomputed response for a well known URL, served before any controller
+typedef struct SERVER_PROBE_T_ {
+    const char *path;
+    int path_len;
+    const char *response; // NULL for the cached redirect
+    int response_len;
+} SERVER_PROBE_T;
+
 typedef struct TCP_CONNECT_STATE_T_ {
     struct tcp_pcb *pcb;
     int sent_len;
-    char headers[128];
-    char result[2048];
+    char headers[192];
     int header_len;
     int result_len;
-    ip_addr_t *gw;
+    int queued_len; // body bytes handed to lwIP so far
+    TemplateRender render; // body is streamed from here, never buffered
+    TCP_SERVER_T *server;
+    bool ws;
+    uint8_t ws_idle_polls;
+    uint8_t ws_rx[WEB_SOCKET_MAX_FRAME]; // partial frame carried between segments
+    int ws_rx_len;
+    bool sse;
+    SERVER_EVENT_REF_T sse_queue[SSE_QUEUE_LEN]; // written, waiting for ack
+    uint8_t sse_head;
+    uint8_t sse_count;
+    u16_t sse_acked;
+    char wait_route[24];
+    uint8_t wait_polls; // seconds left while held for a state change
 } TCP_CONNECT_STATE_T;
 
 err_t tcp_close_client_connection(TCP_CONNECT_STATE_T *con_state, struct tcp_pcb *client_pcb, err_t close_err);
@@ -36,4 +111,10 @@ err_t tcp_server_poll(void *arg, struct tcp_pcb *pcb);
 void tcp_server_err(void *arg, err_t err);
 err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err);
 bool tcp_server_open(void *arg);
-int server_content(const char *request, const char *params, char *result, size_t max_result_len);
\ No newline at end of file
+int server_content(const char *request, const char *params, TemplateRender *render);
+bool server_content_cacheable(const char *request);
+void server_state_changed(TCP_SERVER_T *state);
+void server_ws_message(TCP_SERVER_T *state, const uint8_t *data, uint8_t len);
+void server_ws_broadcast(TCP_SERVER_T *state, const uint8_t *data, uint8_t len);
+SERVER_EVENT_T *server_event_alloc(TCP_SERVER_T *state);
+void server_event_publish(TCP_SERVER_T *state, SERVER_EVENT_T *event);
\ No newline at end of file
@@ -0,0 +1,224 @@
+/**
+ * @file Template.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "Template.h"
+
+/**
+ * @brief Get data of given segment, int slots are formatted into scratch
+ * 
+ * @param render 
+ * @param index 
+ * @param length 
+ * @return const char* 
+ */
+static const char *templateSegmentData(TemplateRender *render, uint8_t index, uint32_t *length) {
+  const TemplateSegment *segment = &render->tpl->segments[index];
+
+  switch (segment->type) {
+    case TEMPLATE_SEGMENT_INT:
+      if (render->scratchSegment != index) {
+        snprintf(render->scratch, sizeof(render->scratch), "%d", render->values[segment->slot].number);
+        render->scratchSegment = index;
+      }
+      *length = strlen(render->scratch);
+      return render->scratch;
+
+    case TEMPLATE_SEGMENT_STRING:
+      *length = strlen(render->values[segment->slot].string);
+      return render->values[segment->slot].string;
+
+    case TEMPLATE_SEGMENT_STREAM:
+      *length = render->values[segment->slot].stream.length;
+      return NULL;
+
+    default:
+      *length = segment->length;
+      return segment->text;
+  }
+}
+
+/**
+ * @brief Start rendering of template
+ * 
+ * @param render 
+ * @param tpl 
+ */
+void templateRenderInit(TemplateRender *render, const Template *tpl) {
+  memset(render, 0, sizeof(TemplateRender));
+  render->tpl = tpl;
+  render->scratchSegment = -1;
+}
+
+/**
+ * @brief Set value of int slot
+ * 
+ * @param render 
+ * @param slot 
+ * @param value 
+ */
+void templateSetInt(TemplateRender *render, uint8_t slot, int value) {
+  render->values[slot].number = value;
+}
+
+/**
+ * @brief Set value of string slot
+ * 
+ * @param render 
+ * @param slot 
+ * @param value static string
+ */
+void templateSetString(TemplateRender *render, uint8_t slot, const char *value) {
+  render->values[slot].string = value;
+}
+
+/**
+ * @brief Set stream slot
+ * 
+ * @param render 
+ * @param slot 
+ * @param read called with increasing offsets, repeated when a chunk was not taken
+ * @param length 
+ */
+void templateSetStream(TemplateRender *render, uint8_t slot, TemplateStreamRead read, uint32_t length) {
+  render->values[slot].stream.read = read;
+  render->values[slot].stream.length = length;
+}
+
+/**
+ * @brief Total length of rendered template, for Content-Length
+ * 
+ * @param render 
+ * @return int 
+ */
+int templateLength(TemplateRender *render) {
+  int length = 0;
+  for (uint8_t i = 0; i < render->tpl->count; i++) {
+    uint32_t segmentLength;
+    templateSegmentData(render, i, &segmentLength);
+    length += segmentLength;
+  }
+
+  // Streaming starts with a clean scratch
+  render->scratchSegment = -1;
+  return length;
+}
+
+/**
+ * @brief Get remaining part of current segment
+ * 
+ * @param render 
+ * @param data 
+ * @param length 
+ * @param volatileData true when data lives in render scratch and has to be copied
+ * @return false when whole template was streamed
+ */
+bool templateNextChunk(TemplateRender *render, const char **data, uint16_t *length, bool *volatileData) {
+  while (render->segment < render->tpl->count) {
+    const TemplateSegment *segment = &render->tpl->segments[render->segment];
+    uint32_t segmentLength;
+    const char *segmentData = templateSegmentData(render, render->segment, &segmentLength);
+
+    if (render->offset < segmentLength && segment->type == TEMPLATE_SEGMENT_STREAM) {
+      // Owner could not produce what it promised, nothing more to send
+      *data = render->values[segment->slot].stream.read(render->offset, length);
+      *volatileData = true;
+      return *data != NULL;
+    }
+
+    if (render->offset < segmentLength) {
+      uint32_t remaining = segmentLength - render->offset;
+      *data = segmentData + render->offset;
+      *length = remaining > UINT16_MAX ? UINT16_MAX : remaining;
+      *volatileData = segment->type == TEMPLATE_SEGMENT_INT;
+      return true;
+    }
+
+    // Empty slot
+    render->segment++;
+    render->offset = 0;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Mark part of current chunk as written
+ * 
+ * @param render 
+ * @param length 
+ */
+void templateAdvance(TemplateRender *render, uint16_t length) {
+  render->offset += length;
+}
+
+/**
+ * @brief Length of a streamed JSON array, brackets and a separator in front of every row
+ * 
+ * @param count 
+ * @param width 
+ * @return uint32_t 
+ */
+uint32_t templateListLength(uint16_t count, uint16_t width) {
+  return 2 + (uint32_t)count * (width + 1);
+}
+
+/**
+ * @brief Stream read of a JSON array, rows are formatted on demand
+ * List which changed under a running response ends it, rows don't line up anymore
+ * @param offset 
+ * @param length 
+ * @param count rows
+ * @param width of every row
+ * @param row 
+ * @return const char* NULL when offset is past the end or a row is gone
+ */
+const char *templateListRead(uint32_t offset, uint16_t *length, uint16_t count, uint16_t width, TemplateListRow row) {
+  static char chunk[256];
+  static char line[TEMPLATE_LIST_MAX_ROW + 1];
+  uint32_t total = templateListLength(count, width);
+  int32_t current = -1;
+  uint16_t used = 0;
+
+  if (offset >= total || width > TEMPLATE_LIST_MAX_ROW) {
+    return NULL;
+  }
+
+  for (; offset < total && used < sizeof(chunk); offset++) {
+    if (offset == 0) {
+      chunk[used++] = '[';
+      continue;
+    }
+    if (offset == total - 1) {
+      chunk[used++] = ']';
+      continue;
+    }
+
+    uint16_t index = (offset - 1) / (width + 1);
+    uint16_t column = (offset - 1) % (width + 1);
+    if (column == 0) {
+      chunk[used++] = index ? ',' : ' ';
+      continue;
+    }
+
+    if (index != current) {
+      if (!row(index, line) || strlen(line) != width) {
+        return NULL;
+      }
+      current = index;
+    }
+    chunk[used++] = line[column - 1];
+  }
+
+  *length = used;
+  return chunk;
+}
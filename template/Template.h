@@ -0,0 +1,115 @@
+/**
+ * @file Template.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief Precompiled streaming templates
+ * @version 0.1
+ * @date 2023-07-10
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * Template Description
+ * 
+ * Templates are split at compile time into segments:
+ *  -> Text (string literal, sent without copying)
+ *  -> Int slot (formatted on demand into a 12 byte scratch buffer)
+ *  -> String slot (pointer to static string, sent without copying)
+ *  -> Stream slot (generated by its owner at the requested offset, copied)
+ * 
+ * Page is never rendered as a whole, server pulls it chunk by chunk as
+ * TCP send buffer space becomes available.
+ * 
+ * JSON arrays of module entries go through a stream slot too. Every row
+ * is formatted to the same width, padded with spaces, so the length is
+ * known up front and any offset maps to one row without a buffer.
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TEMPLATE_MAX_SLOTS 6
+#define TEMPLATE_TYPE_HTML "text/html; charset=utf-8"
+#define TEMPLATE_TYPE_JSON "application/json"
+#define TEMPLATE_TYPE_PCAP "application/vnd.tcpdump.pcap"
+
+/* Longest row of a streamed list */
+#define TEMPLATE_LIST_MAX_ROW 96
+
+typedef enum {
+  TEMPLATE_SEGMENT_TEXT,
+  TEMPLATE_SEGMENT_INT,
+  TEMPLATE_SEGMENT_STRING,
+  TEMPLATE_SEGMENT_STREAM,
+} TemplateSegmentType;
+
+typedef struct {
+  uint8_t type;
+  uint8_t slot;
+  uint16_t length;
+  const char *text;
+} TemplateSegment;
+
+typedef struct {
+  const TemplateSegment *segments;
+  uint8_t count;
+  const char *contentType;
+} Template;
+
+/* Data at offset, valid until the next call. Length is known up front for Content-Length */
+typedef const char *(*TemplateStreamRead)(uint32_t offset, uint16_t *length);
+
+/* Format row index into row, exactly the list width plus NUL, false when it is gone */
+typedef bool (*TemplateListRow)(uint16_t index, char *row);
+
+typedef struct {
+  TemplateStreamRead read;
+  uint32_t length;
+} TemplateStream;
+
+typedef union {
+  int number;
+  const char *string;  // has to outlive the response
+  TemplateStream stream;
+} TemplateValue;
+
+typedef struct {
+  const Template *tpl;
+  TemplateValue values[TEMPLATE_MAX_SLOTS];
+  uint8_t segment;
+  uint32_t offset;
+  int8_t scratchSegment;
+  char scratch[12];
+} TemplateRender;
+
+#define TEMPLATE_TEXT(text) { TEMPLATE_SEGMENT_TEXT, 0, sizeof(text) - 1, text }
+#define TEMPLATE_INT(slot) { TEMPLATE_SEGMENT_INT, slot, 0, NULL }
+#define TEMPLATE_STRING(slot) { TEMPLATE_SEGMENT_STRING, slot, 0, NULL }
+#define TEMPLATE_STREAM(slot) { TEMPLATE_SEGMENT_STREAM, slot, 0, NULL }
+
+#define TEMPLATE_DEFINE_TYPE(name, type, ...) \
+  static const TemplateSegment name##Segments[] = { __VA_ARGS__ }; \
+  static const Template name = { name##Segments, sizeof(name##Segments) / sizeof(TemplateSegment), type }
+
+#define TEMPLATE_DEFINE(name, ...) TEMPLATE_DEFINE_TYPE(name, TEMPLATE_TYPE_HTML, __VA_ARGS__)
+
+/** === Rendering === */
+void templateRenderInit(TemplateRender *render, const Template *tpl);
+void templateSetInt(TemplateRender *render, uint8_t slot, int value);
+void templateSetString(TemplateRender *render, uint8_t slot, const char *value);
+void templateSetStream(TemplateRender *render, uint8_t slot, TemplateStreamRead read, uint32_t length);
+int templateLength(TemplateRender *render);
+
+/** === Lists === */
+uint32_t templateListLength(uint16_t count, uint16_t width);
+const char *templateListRead(uint32_t offset, uint16_t *length, uint16_t count, uint16_t width, TemplateListRow row);
+
+/** === Streaming === */
+bool templateNextChunk(TemplateRender *render, const char **data, uint16_t *length, bool *volatileData);
+void templateAdvance(TemplateRender *render, uint16_t length);
+
+#endif // TEMPLATE_H
@@ -0,0 +1,175 @@
+/**
+ * @file WebSocket.c
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief 
+ * @version 0.1
+ * @date 2023-07-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#include <string.h>
+#include "WebSocket.h"
+
+#define WEB_SOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint32_t sha1Rotate(uint32_t value, uint8_t bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+/**
+ * @brief Process one 64 byte block of SHA-1
+ * 
+ * @param hash 
+ * @param block 
+ */
+static void sha1Block(uint32_t hash[5], const uint8_t block[64]) {
+  uint32_t w[16];
+  uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4];
+
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  }
+
+  for (uint8_t i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i >= 16) {
+      w[i & 15] = sha1Rotate(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+    }
+
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    uint32_t temp = sha1Rotate(a, 5) + f + e + k + w[i & 15];
+    e = d;
+    d = c;
+    c = sha1Rotate(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  hash[0] += a;
+  hash[1] += b;
+  hash[2] += c;
+  hash[3] += d;
+  hash[4] += e;
+}
+
+/**
+ * @brief SHA-1 of short message (up to 119 bytes, two blocks)
+ * 
+ * @param data 
+ * @param size 
+ * @param digest 
+ */
+static void sha1(const uint8_t data[], uint8_t size, uint8_t digest[20]) {
+  uint32_t hash[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint8_t blocks[128] = { 0 };
+  uint8_t blocksSize = size + 9 <= 64 ? 64 : 128;
+  uint32_t bits = size * 8;
+
+  memcpy(blocks, data, size);
+  blocks[size] = 0x80;
+  blocks[blocksSize - 4] = bits >> 24;
+  blocks[blocksSize - 3] = bits >> 16;
+  blocks[blocksSize - 2] = bits >> 8;
+  blocks[blocksSize - 1] = bits;
+
+  for (uint8_t i = 0; i < blocksSize; i += 64) {
+    sha1Block(hash, blocks + i);
+  }
+
+  for (uint8_t i = 0; i < 20; i++) {
+    digest[i] = hash[i / 4] >> (24 - (i % 4) * 8);
+  }
+}
+
+/**
+ * @brief Compute Sec-WebSocket-Accept for client key
+ * 
+ * @param key Sec-WebSocket-Key (not terminated)
+ * @param accept null terminated
+ */
+void webSocketAcceptKey(const char key[WEB_SOCKET_KEY_LENGTH], char accept[WEB_SOCKET_ACCEPT_LENGTH + 1]) {
+  static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint8_t message[WEB_SOCKET_KEY_LENGTH + sizeof(WEB_SOCKET_GUID) - 1];
+  uint8_t digest[21];
+
+  memcpy(message, key, WEB_SOCKET_KEY_LENGTH);
+  memcpy(message + WEB_SOCKET_KEY_LENGTH, WEB_SOCKET_GUID, sizeof(WEB_SOCKET_GUID) - 1);
+  sha1(message, sizeof(message), digest);
+  digest[20] = 0;
+
+  // 20 bytes encode to 27 characters and one padding
+  for (uint8_t i = 0, j = 0; i < 21; i += 3, j += 4) {
+    uint32_t triple = digest[i] << 16 | digest[i + 1] << 8 | digest[i + 2];
+    accept[j] = base64[(triple >> 18) & 0x3F];
+    accept[j + 1] = base64[(triple >> 12) & 0x3F];
+    accept[j + 2] = base64[(triple >> 6) & 0x3F];
+    accept[j + 3] = base64[triple & 0x3F];
+  }
+  accept[WEB_SOCKET_ACCEPT_LENGTH - 1] = '=';
+  accept[WEB_SOCKET_ACCEPT_LENGTH] = 0;
+}
+
+/**
+ * @brief Parse client frame and unmask its payload in place
+ * 
+ * @param data 
+ * @param size 
+ * @param frame 
+ * @return int bytes used by frame, 0 when incomplete, -1 when not supported
+ */
+int webSocketParseFrame(uint8_t data[], size_t size, WebSocketFrame *frame) {
+  if (size < 2) {
+    return 0;
+  }
+
+  // Only final, masked frames with short payload
+  bool fin = data[0] & 0x80;
+  bool masked = data[1] & 0x80;
+  uint8_t length = data[1] & 0x7F;
+  if (!fin || !masked || length > WEB_SOCKET_MAX_PAYLOAD) {
+    return -1;
+  }
+
+  if (size < (size_t)6 + length) {
+    return 0;
+  }
+
+  const uint8_t *mask = data + 2;
+  frame->opcode = data[0] & 0x0F;
+  frame->length = length;
+  frame->payload = data + 6;
+  for (uint8_t i = 0; i < length; i++) {
+    frame->payload[i] ^= mask[i & 3];
+  }
+
+  return 6 + length;
+}
+
+/**
+ * @brief Create server frame header, payload follows it
+ * 
+ * @param header 
+ * @param opcode 
+ * @param length up to 125 bytes
+ * @return uint8_t header size
+ */
+uint8_t webSocketFrameHeader(uint8_t header[2], uint8_t opcode, uint8_t length) {
+  header[0] = 0x80 | opcode;
+  header[1] = length;
+  return 2;
+}
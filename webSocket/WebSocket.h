@@ -0,0 +1,52 @@
+/**
+ * @file WebSocket.h
+ * @author Mateusz Zolisz <mateusz.zolisz@gmail.com>
+ * @brief RFC 6455 handshake and framing
+ * @version 0.1
+ * @date 2023-07-12
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * WebSocket Description
+ * 
+ * Only what a control channel needs:
+ *  -> Handshake accept key (SHA-1 + Base64)
+ *  -> Single frame messages up to 125 bytes (no fragmentation)
+ *  -> Masked frames from client, unmasked frames from server
+ */
+
+#ifndef WEB_SOCKET_H
+#define WEB_SOCKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WEB_SOCKET_KEY_LENGTH 24
+#define WEB_SOCKET_ACCEPT_LENGTH 28
+#define WEB_SOCKET_MAX_PAYLOAD 125
+#define WEB_SOCKET_MAX_FRAME (6 + WEB_SOCKET_MAX_PAYLOAD)
+
+#define WEB_SOCKET_OPCODE_TEXT 0x1
+#define WEB_SOCKET_OPCODE_BINARY 0x2
+#define WEB_SOCKET_OPCODE_CLOSE 0x8
+#define WEB_SOCKET_OPCODE_PING 0x9
+#define WEB_SOCKET_OPCODE_PONG 0xA
+
+typedef struct {
+  uint8_t opcode;
+  uint8_t length;
+  uint8_t *payload;
+} WebSocketFrame;
+
+/** === Handshake === */
+void webSocketAcceptKey(const char key[WEB_SOCKET_KEY_LENGTH], char accept[WEB_SOCKET_ACCEPT_LENGTH + 1]);
+
+/** === Framing === */
+int webSocketParseFrame(uint8_t data[], size_t size, WebSocketFrame *frame);
+uint8_t webSocketFrameHeader(uint8_t header[2], uint8_t opcode, uint8_t length);
+
+#endif // WEB_SOCKET_H